@@ -0,0 +1,963 @@
+/*
+ *  id3v2bench - end-to-end corpus benchmark
+ *
+ * 	Generates reproducible synthetic library of tagged files and runs the
+ * 	whole program over it with cold and warm page cache. Throughput, peak
+ * 	RSS and I/O syscall counts are written as JSON and compared with
+ * 	a stored baseline, the benchmark fails when a metric regresses over
+ * 	the threshold. It is a macro benchmark, not a test.
+ *
+ *  How to build: 'make bench' (into build/<profile>/id3v2bench)
+ *
+ *  How to run: './id3v2bench [--files N] [--seed N] [--runs N] [--output result.json]
+ *                [--baseline baseline.json] [--threshold PCT] corpus_dir program [arg ...]'
+ *              e.g. './build/release/id3v2bench /tmp/corpus ./build/release/id3v2parser --build-index /tmp/l.idx'
+ *              (the program gets '--files-from corpus_dir/list.txt' appended)
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "id3v2parser.h"
+#include "id3v2crc.h"
+#include "id3v2writer.h"
+
+
+/** Default number of files of the corpus */
+#define DEFAULT_FILES 2000
+/** Default seed of the corpus */
+#define DEFAULT_SEED 1
+/** Default number of timed runs with cold and with warm cache */
+#define DEFAULT_RUNS 3
+/** Default threshold of regression in percents */
+#define DEFAULT_THRESHOLD 10.0
+/** Number of files in one directory of the corpus */
+#define FILES_PER_DIR 100
+/** Length of MPEG audio frame following the tag (128 kbps, 44.1 kHz) */
+#define AUDIO_FRAME_LEN 417
+/** Version of the generator, corpus of other version is generated again */
+#define CORPUS_VERSION 2
+
+
+/** Growable byte buffer */
+
+typedef struct bytes_s {
+	unsigned char *data;	/**< bytes */
+	size_t len;				/**< number of bytes */
+	size_t capacity;		/**< allocated length */
+} bytes_t;
+
+/** Generated corpus */
+
+typedef struct corpus_s {
+	const char *dir;		/**< directory of the corpus */
+	char list[PATH_MAX];	/**< list of the files, passed to the program */
+	uint32_t files;			/**< number of files */
+	uint64_t seed;			/**< seed of the generator */
+	uint64_t bytes;			/**< total size of the files */
+	uint32_t parsed;		/**< number of files parsed by the library */
+	char **paths;			/**< paths of the files */
+} corpus_t;
+
+/** Measurement of one run of the program */
+
+typedef struct run_result_s {
+	double seconds;			/**< wall clock time */
+	double peak_rss_kb;		/**< peak resident set size */
+	double read_syscalls;	/**< read system calls (read, pread, ...) */
+	double write_syscalls;	/**< write system calls */
+	double read_bytes;		/**< bytes fetched from the storage */
+	int exit_status;		/**< exit status of the program */
+} run_result_t;
+
+
+/** Words of generated texts */
+static const char *words[] = {
+	"love", "night", "blue", "river", "dance", "fire", "heart", "city", "rain", "dream",
+	"light", "road", "summer", "ghost", "golden", "wild", "silent", "echo", "storm", "home"
+};
+
+/** Metrics compared with the baseline, higher value of the first one is better */
+static const char *metrics[] = {"files_per_s", "mb_per_s", "peak_rss_kb", "read_syscalls", "write_syscalls"};
+
+
+/**
+ * Get next pseudo-random number (xorshift64*)
+ * @param state			state of the generator, not zero
+ * @return				pseudo-random number
+ */
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+
+/**
+ * Get pseudo-random number from the range
+ * @param state			state of the generator
+ * @param min			minimal number
+ * @param max			maximal number
+ * @return				pseudo-random number from min to max (inclusive)
+ */
+static uint32_t random_range(uint64_t *state, uint32_t min, uint32_t max) {
+	return min + next_random(state) % (max - min + 1);
+}
+
+
+/**
+ * Append bytes to the buffer
+ * @param buffer		buffer
+ * @param data			bytes to append, NULL appends zeros
+ * @param len			number of bytes
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int append_bytes(bytes_t *buffer, const void *data, size_t len) {
+	unsigned char *tmp;
+	size_t capacity;
+
+	if(buffer->len + len > buffer->capacity) {
+		capacity = buffer->capacity ? buffer->capacity : 4096;
+		while(capacity < buffer->len + len) {
+			capacity *= 2;
+		}
+		tmp = realloc(buffer->data, capacity);
+		if(tmp == NULL) {
+			fprintf(stderr, "Error while allocating memory for generated file!\n");
+			return 1;
+		}
+		buffer->data = tmp;
+		buffer->capacity = capacity;
+	}
+
+	if(data) {
+		memcpy(buffer->data + buffer->len, data, len);
+	}
+	else {
+		memset(buffer->data + buffer->len, 0, len);
+	}
+	buffer->len += len;
+
+	return 0;
+}
+
+
+/**
+ * Store number as 4 byte synchsafe integer
+ * @param p				output buffer of at least 4 bytes
+ * @param value			number less than 2^28
+ */
+static void write_synchsafe(unsigned char *p, uint32_t value) {
+	p[0] = (value >> 21) & 0x7F;
+	p[1] = (value >> 14) & 0x7F;
+	p[2] = (value >> 7) & 0x7F;
+	p[3] = value & 0x7F;
+}
+
+
+/**
+ * Append frame to the tag
+ * @param tag			serialised frames
+ * @param id			four-char frame ID code
+ * @param flags			ID3 frame header flags
+ * @param body			frame body
+ * @param len			length of the frame body
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int append_frame(bytes_t *tag, const char *id, uint16_t flags, const void *body, uint32_t len) {
+	unsigned char header[HEADER_LEN];
+
+	write_id3v2_frame_header(header, id, flags, len);
+	return append_bytes(tag, header, HEADER_LEN) || append_bytes(tag, body, len);
+}
+
+
+/**
+ * Append text frame of random words
+ * @param tag			serialised frames
+ * @param id			four-char frame ID code
+ * @param state			state of the generator
+ * @param max_words		maximal number of words
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int append_text_frame(bytes_t *tag, const char *id, uint64_t *state, uint32_t max_words) {
+	char body[256];
+	uint32_t count;
+	uint32_t i;
+	size_t len;
+
+	body[0] = ENC_UTF_8;
+	len = 1;
+	count = random_range(state, 1, max_words);
+	for(i = 0; i < count; i++) {
+		len += snprintf(body + len, sizeof(body) - len, "%s%s", i ? " " : "",
+				words[random_range(state, 0, sizeof(words) / sizeof(words[0]) - 1)]);
+	}
+	return append_frame(tag, id, 0, body, len);
+}
+
+
+/**
+ * Append attached picture, JPEG header followed by random data
+ * @param tag			serialised frames
+ * @param state			state of the generator
+ * @param len			length of the picture data
+ * @param unsync		1 to unsynchronise the frame
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int append_picture_frame(bytes_t *tag, uint64_t *state, uint32_t len, int unsync) {
+	static const unsigned char jfif[] = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00,
+			0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00};
+	static const char info[] = "\0image/jpeg\0\3Cover\0";
+	unsigned char sof[19] = {0xFF, 0xC0, 0x00, 0x11, 0x08};
+	bytes_t body = {NULL, 0, 0};
+	bytes_t synced = {NULL, 0, 0};
+	uint64_t value;
+	uint32_t size;
+	size_t i;
+	int result;
+
+	size = random_range(state, 300, 1400);
+	sof[5] = sof[7] = size >> 8;
+	sof[6] = sof[8] = size;
+	sof[9] = 3;
+
+	result = append_bytes(&body, info, sizeof(info) - 1) || append_bytes(&body, jfif, sizeof(jfif))
+			|| append_bytes(&body, sof, sizeof(sof)) || append_bytes(&body, NULL, len);
+	/* Entropy coded data are random, so they contain false synchronisations */
+	for(i = body.len - len; result == 0 && i < body.len; i += sizeof(value)) {
+		value = next_random(state);
+		memcpy(body.data + i, &value, body.len - i < sizeof(value) ? body.len - i : sizeof(value));
+	}
+
+	if(result == 0 && unsync) {
+		/* $FF followed by %111xxxxx or $00 gets $00 inserted */
+		for(i = 0; result == 0 && i < body.len; i++) {
+			result = append_bytes(&synced, body.data + i, 1);
+			if(body.data[i] == 0xFF && (i + 1 == body.len || body.data[i + 1] >= 0xE0 || body.data[i + 1] == 0x00)) {
+				result |= append_bytes(&synced, NULL, 1);
+			}
+		}
+		result = result || append_frame(tag, "APIC", FLAG_FR_UNSYNC, synced.data, synced.len);
+	}
+	else if(result == 0) {
+		result = append_frame(tag, "APIC", 0, body.data, body.len);
+	}
+
+	free(body.data);
+	free(synced.data);
+	return result;
+}
+
+
+/**
+ * Generate one file of the corpus, the mix of tags is given by the seed and the index
+ * @param corpus		corpus
+ * @param index			index of the file
+ * @param file			buffer for the content of the file
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int generate_file(const corpus_t *corpus, uint32_t index, bytes_t *file) {
+	static const char *ids[] = {"TIT2", "TPE1", "TALB", "TCON", "TDRC", "TPE2", "TCOM"};
+	static const unsigned char audio_header[] = {0xFF, 0xFB, 0x90, 0x64};
+	unsigned char header[HEADER_LEN];
+	unsigned char ext_header[12];
+	unsigned char lyrics[4096];
+	bytes_t frames = {NULL, 0, 0};
+	uint64_t state;
+	uint32_t ext_len = 0;
+	uint32_t count;
+	uint32_t len;
+	uint32_t i;
+	uint32_t crc;
+	int result = 0;
+
+	state = (corpus->seed + 1) * 0x9E3779B97F4A7C15ULL ^ ((uint64_t) index + 1) * 0xBF58476D1CE4E5B9ULL;
+	if(state == 0) {
+		state = 1;
+	}
+	file->len = 0;
+
+	/* Library is ID3v2.4 only, every file has to be parsed for the throughput to mean anything */
+	for(i = 0; i < sizeof(ids) / sizeof(ids[0]) && result == 0; i++) {
+		if(i < 3 || random_range(&state, 1, 100) <= 50) {
+			result = append_text_frame(&frames, ids[i], &state, 6);
+		}
+	}
+	if(result == 0 && random_range(&state, 1, 100) <= 20) {
+		len = random_range(&state, 1024, sizeof(lyrics));
+		memcpy(lyrics, "\3eng\0", 5);
+		for(i = 5; i < len; i++) {
+			lyrics[i] = "abcdefghijklmnopqrstuvwxyz \n"[random_range(&state, 0, 27)];
+		}
+		result = append_frame(&frames, "USLT", 0, lyrics, len);
+	}
+
+	/* Covers are mostly tens of kB, some of them several MB */
+	if(result == 0 && random_range(&state, 1, 100) <= 60) {
+		count = random_range(&state, 1, 100);
+		len = count <= 70 ? random_range(&state, 20000, 100000)
+				: count <= 95 ? random_range(&state, 100000, 500000) : random_range(&state, 1000000, 3000000);
+		result = append_picture_frame(&frames, &state, len, random_range(&state, 1, 100) <= 10);
+	}
+
+	/* Half of the tags have padding reserved by a tag editor */
+	count = random_range(&state, 1, 100);
+	if(result == 0 && count <= 50) {
+		result = append_bytes(&frames, NULL, count <= 5 ? 65536 : random_range(&state, 0, 8192));
+	}
+
+	/* Extended header, half of them with CRC of frames and padding */
+	if(result == 0 && random_range(&state, 1, 100) <= 10) {
+		ext_len = 6;
+		ext_header[4] = 1;
+		ext_header[5] = 0;
+		if(random_range(&state, 0, 1)) {
+			crc = crc32_update(0, frames.data, frames.len);
+			ext_header[5] = FLAG_EXT_CRC;
+			ext_header[6] = 5;
+			ext_header[7] = (crc >> 28) & 0x0F;
+			write_synchsafe(ext_header + 8, crc & 0x0FFFFFFF);
+			ext_len = 12;
+		}
+		write_synchsafe(ext_header, ext_len);
+	}
+
+	write_id3v2_header(header, ext_len ? FLAG_ID3_EXTEND : 0, ext_len + frames.len);
+	result = result || append_bytes(file, header, HEADER_LEN) || append_bytes(file, ext_header, ext_len)
+			|| append_bytes(file, frames.data, frames.len);
+
+	/* Audio data are not read by the parser, their length only spreads the tags on the device */
+	count = random_range(&state, 64, 512);
+	for(i = 0; i < count && result == 0; i++) {
+		result = append_bytes(file, audio_header, sizeof(audio_header))
+				|| append_bytes(file, NULL, AUDIO_FRAME_LEN - sizeof(audio_header));
+	}
+
+	/* Some files have also ID3v1 tag */
+	if(result == 0 && random_range(&state, 1, 100) <= 3) {
+		result = append_bytes(file, "TAG", 3) || append_bytes(file, NULL, 125);
+		if(result == 0) {
+			memcpy(file->data + file->len - 125, "Old title", 9);
+		}
+	}
+
+	free(frames.data);
+	return result;
+}
+
+
+/**
+ * Read the list of the corpus files
+ * @param corpus		corpus, the list is stored into its paths
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int read_corpus_list(corpus_t *corpus) {
+	char line[PATH_MAX];
+	FILE *file;
+	uint32_t i;
+
+	file = fopen(corpus->list, "r");
+	if(file == NULL) {
+		fprintf(stderr, "Error while opening file %s!\n", corpus->list);
+		return 1;
+	}
+	corpus->paths = calloc(corpus->files, sizeof(char *));
+	for(i = 0; corpus->paths && i < corpus->files && fgets(line, sizeof(line), file); i++) {
+		line[strcspn(line, "\n")] = '\0';
+		corpus->paths[i] = strdup(line);
+		if(corpus->paths[i] == NULL) {
+			break;
+		}
+	}
+	fclose(file);
+
+	if(corpus->paths == NULL || i != corpus->files) {
+		fprintf(stderr, "Error while reading file %s!\n", corpus->list);
+		return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Check that the library parses the generated file
+ * @param content		content of the file
+ * @return				1 if the file is parsed, 0 otherwise
+ */
+static int is_parsed(const bytes_t *content) {
+	id3v2_tag_t tag;
+	int result;
+
+	init_id3v2_tag(&tag);
+	result = content->len <= UINT32_MAX && parse_buffer(&tag, content->data, content->len) == 0;
+	deallocate_memory(&tag, NULL);
+	return result;
+}
+
+
+/**
+ * Generate the corpus unless it has been already generated with the same parameters
+ * @param corpus		corpus
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int prepare_corpus(corpus_t *corpus) {
+	char name[PATH_MAX];
+	char path[PATH_MAX];
+	bytes_t content = {NULL, 0, 0};
+	unsigned long long seed;
+	unsigned long long bytes;
+	unsigned files;
+	unsigned parsed;
+	unsigned version;
+	FILE *list;
+	FILE *file;
+	uint32_t i;
+	int result = 0;
+
+	snprintf(corpus->list, sizeof(corpus->list), "%s/list.txt", corpus->dir);
+	snprintf(name, sizeof(name), "%s/corpus.txt", corpus->dir);
+
+	/* Description of the corpus is written last, so only complete corpus is reused */
+	file = fopen(name, "r");
+	if(file) {
+		result = fscanf(file, "%u %llu %llu %u %u", &files, &seed, &bytes, &parsed, &version) != 5;
+		fclose(file);
+		if(result == 0 && files == corpus->files && seed == corpus->seed && version == CORPUS_VERSION) {
+			corpus->bytes = bytes;
+			corpus->parsed = parsed;
+			return read_corpus_list(corpus);
+		}
+		result = 0;
+	}
+
+	printf("Generating corpus of %u files into %s\n", corpus->files, corpus->dir);
+	if(mkdir(corpus->dir, 0755) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Error while creating directory %s!\n", corpus->dir);
+		return 1;
+	}
+	list = fopen(corpus->list, "w");
+	if(list == NULL) {
+		fprintf(stderr, "Error while opening file %s to write!\n", corpus->list);
+		return 1;
+	}
+
+	corpus->bytes = 0;
+	corpus->parsed = 0;
+	for(i = 0; i < corpus->files && result == 0; i++) {
+		snprintf(path, sizeof(path), "%s/%03u", corpus->dir, i / FILES_PER_DIR);
+		if(i % FILES_PER_DIR == 0 && mkdir(path, 0755) != 0 && errno != EEXIST) {
+			fprintf(stderr, "Error while creating directory %s!\n", path);
+			result = 1;
+			break;
+		}
+		snprintf(path, sizeof(path), "%s/%03u/%05u.mp3", corpus->dir, i / FILES_PER_DIR, i);
+		if(generate_file(corpus, i, &content) != 0) {
+			result = 1;
+			break;
+		}
+		file = fopen(path, "wb");
+		if(file == NULL || fwrite(content.data, 1, content.len, file) != content.len || fclose(file) != 0) {
+			fprintf(stderr, "Error while writing file %s!\n", path);
+			result = 1;
+			break;
+		}
+		fprintf(list, "%s\n", path);
+		corpus->bytes += content.len;
+		corpus->parsed += is_parsed(&content);
+	}
+	free(content.data);
+	if(fclose(list) != 0 || result != 0) {
+		return 1;
+	}
+
+	file = fopen(name, "w");
+	if(file == NULL || fprintf(file, "%u %llu %llu %u %u\n", corpus->files, (unsigned long long) corpus->seed,
+			(unsigned long long) corpus->bytes, corpus->parsed, CORPUS_VERSION) < 0 || fclose(file) != 0) {
+		fprintf(stderr, "Error while writing file %s!\n", name);
+		return 1;
+	}
+	return read_corpus_list(corpus);
+}
+
+
+/**
+ * Drop the corpus from the page cache
+ * @param corpus		corpus
+ * @return				method used ("drop_caches" or "fadvise")
+ */
+static const char *evict_corpus(const corpus_t *corpus) {
+	uint32_t i;
+	int fd;
+
+	/* Dirty pages cannot be dropped */
+	sync();
+
+	/* Whole page cache (including inodes) is dropped only by root */
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if(fd >= 0) {
+		if(write(fd, "3", 1) == 1) {
+			close(fd);
+			return "drop_caches";
+		}
+		close(fd);
+	}
+
+	for(i = 0; i < corpus->files; i++) {
+		fd = open(corpus->paths[i], O_RDONLY);
+		if(fd >= 0) {
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+	}
+	return "fadvise";
+}
+
+
+/**
+ * Run the program and measure it
+ * @param argv			program and its arguments
+ * @param run			pointer to the measurement to fill in
+ * @return				0 if OK, 1 if the program could not be run, was killed or has failed
+ */
+static int run_program(char **argv, run_result_t *run) {
+	struct timespec start;
+	struct timespec end;
+	struct rusage usage;
+	siginfo_t info;
+	char name[64];
+	char key[32];
+	unsigned long long value;
+	FILE *io;
+	pid_t pid;
+	int status;
+	int fd;
+
+	memset(run, 0, sizeof(*run));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid = fork();
+	if(pid < 0) {
+		fprintf(stderr, "Error while starting program %s!\n", argv[0]);
+		return 1;
+	}
+	if(pid == 0) {
+		fd = open("/dev/null", O_WRONLY);
+		if(fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+
+	/* Exited program keeps its I/O counters until it is reaped */
+	if(waitid(P_PID, pid, &info, WEXITED | WNOWAIT) != 0) {
+		fprintf(stderr, "Error while waiting for program %s!\n", argv[0]);
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	snprintf(name, sizeof(name), "/proc/%d/io", (int) pid);
+	io = fopen(name, "r");
+	if(io) {
+		while(fscanf(io, "%31[^:]: %llu\n", key, &value) == 2) {
+			if(strcmp(key, "syscr") == 0) {
+				run->read_syscalls = value;
+			}
+			else if(strcmp(key, "syscw") == 0) {
+				run->write_syscalls = value;
+			}
+			else if(strcmp(key, "read_bytes") == 0) {
+				run->read_bytes = value;
+			}
+		}
+		fclose(io);
+	}
+	if(wait4(pid, &status, 0, &usage) != pid) {
+		fprintf(stderr, "Error while waiting for program %s!\n", argv[0]);
+		return 1;
+	}
+
+	run->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	run->peak_rss_kb = usage.ru_maxrss;
+
+	/* Every file of the corpus is parsed, so a failure means that the run did not do the measured work */
+	run->exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	if(run->exit_status != 0) {
+		fprintf(stderr, "Error while running program %s (exit status %d)!\n", argv[0], run->exit_status);
+		return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Compare two numbers for qsort()
+ * @param a				pointer to the first number
+ * @param b				pointer to the second number
+ * @return				negative, zero or positive number
+ */
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * Get median of the numbers
+ * @param values		numbers, they are sorted
+ * @param len			number of the numbers
+ * @return				median
+ */
+static double get_median(double *values, int len) {
+	qsort(values, len, sizeof(double), compare_doubles);
+	return len % 2 ? values[len / 2] : (values[len / 2 - 1] + values[len / 2]) / 2;
+}
+
+
+/**
+ * Run the program repeatedly and summarise the medians of the runs
+ * @param corpus		corpus
+ * @param argv			program and its arguments
+ * @param runs			number of timed runs
+ * @param cold			1 to drop the corpus from the page cache before each run
+ * @param p_method		pointer to the method of dropping the cache
+ * @param summary		medians of the metrics, in order of metrics[]
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int measure_runs(const corpus_t *corpus, char **argv, int runs, int cold, const char **p_method, double *summary) {
+	run_result_t run;
+	double *values;
+	int i;
+
+	values = malloc(5 * runs * sizeof(double));
+	if(values == NULL) {
+		fprintf(stderr, "Error while allocating memory for measurements!\n");
+		return 1;
+	}
+
+	/* Warm runs start after one untimed run which fills the cache */
+	if(!cold && run_program(argv, &run) != 0) {
+		free(values);
+		return 1;
+	}
+	for(i = 0; i < runs; i++) {
+		if(cold) {
+			*p_method = evict_corpus(corpus);
+		}
+		if(run_program(argv, &run) != 0) {
+			free(values);
+			return 1;
+		}
+		values[i] = corpus->files / run.seconds;
+		values[runs + i] = corpus->bytes / (1024.0 * 1024.0) / run.seconds;
+		values[2 * runs + i] = run.peak_rss_kb;
+		values[3 * runs + i] = run.read_syscalls;
+		values[4 * runs + i] = run.write_syscalls;
+		printf("%s run %d: %.3f s, %.0f files/s, peak RSS %.0f kB, %.0f read syscalls, %.0f kB read from storage\n",
+				cold ? "cold" : "warm", i + 1, run.seconds, values[i], run.peak_rss_kb, run.read_syscalls, run.read_bytes / 1024);
+	}
+	for(i = 0; i < 5; i++) {
+		summary[i] = get_median(values + i * runs, runs);
+	}
+
+	free(values);
+	return 0;
+}
+
+
+/**
+ * Write results as JSON
+ * @param file			output file
+ * @param corpus		corpus
+ * @param method		method of dropping the cache
+ * @param runs			number of timed runs
+ * @param cold			medians of cold runs
+ * @param warm			medians of warm runs
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int write_results(FILE *file, const corpus_t *corpus, const char *method, int runs, const double *cold, const double *warm) {
+	const double *summary;
+	int i;
+	int j;
+
+	fprintf(file, "{\n\t\"files\": %u,\n\t\"parsed_files\": %u,\n\t\"seed\": %llu,\n\t\"bytes\": %llu,\n\t\"runs\": %d,"
+			"\n\t\"exit_status\": 0,\n\t\"cache_drop\": \"%s\"",
+			corpus->files, corpus->parsed, (unsigned long long) corpus->seed, (unsigned long long) corpus->bytes, runs, method);
+	for(i = 0; i < 2; i++) {
+		summary = i == 0 ? cold : warm;
+		fprintf(file, ",\n\t\"%s\": {", i == 0 ? "cold" : "warm");
+		for(j = 0; j < 5; j++) {
+			fprintf(file, "%s\n\t\t\"%s\": %.2f", j ? "," : "", metrics[j], summary[j]);
+		}
+		fprintf(file, "\n\t}");
+	}
+	fprintf(file, "\n}\n");
+
+	return ferror(file) != 0;
+}
+
+
+/**
+ * Find number of the key in the section of JSON results
+ * @param json			JSON results
+ * @param section		section name ("cold" or "warm"), NULL for the top level
+ * @param key			key of the number
+ * @param p_value		pointer to the number
+ * @return				0 if OK, 1 if the number is not found
+ */
+static int find_result(const char *json, const char *section, const char *key, double *p_value) {
+	char pattern[64];
+	const char *p = json;
+	char *end;
+
+	if(section) {
+		snprintf(pattern, sizeof(pattern), "\"%s\":", section);
+		p = strstr(p, pattern);
+		if(p == NULL) {
+			return 1;
+		}
+	}
+	snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+	p = strstr(p, pattern);
+	if(p == NULL) {
+		return 1;
+	}
+	*p_value = strtod(p + strlen(pattern), &end);
+	return end == p + strlen(pattern);
+}
+
+
+/**
+ * Compare the results with the baseline
+ * @param name			file with baseline results
+ * @param corpus		corpus
+ * @param threshold		allowed regression in percents
+ * @param cold			medians of cold runs
+ * @param warm			medians of warm runs
+ * @return				0 if there is no regression, 1 if there is a regression or problem has occurred
+ */
+static int compare_baseline(const char *name, const corpus_t *corpus, double threshold, const double *cold, const double *warm) {
+	char json[4096];
+	const double *summary;
+	const char *section;
+	double baseline;
+	double change;
+	size_t len;
+	FILE *file;
+	int regression = 0;
+	int i;
+	int j;
+
+	file = fopen(name, "r");
+	if(file == NULL) {
+		fprintf(stderr, "Error while opening file %s!\n", name);
+		return 1;
+	}
+	len = fread(json, 1, sizeof(json) - 1, file);
+	fclose(file);
+	json[len] = '\0';
+
+	if(find_result(json, NULL, "files", &baseline) != 0 || baseline != corpus->files
+			|| find_result(json, NULL, "parsed_files", &baseline) != 0 || baseline != corpus->parsed
+			|| find_result(json, NULL, "seed", &baseline) != 0 || baseline != corpus->seed) {
+		fprintf(stderr, "Error - baseline %s was measured on a different corpus\n", name);
+		return 1;
+	}
+
+	for(i = 0; i < 2; i++) {
+		section = i == 0 ? "cold" : "warm";
+		summary = i == 0 ? cold : warm;
+		for(j = 0; j < 5; j++) {
+			if(find_result(json, section, metrics[j], &baseline) != 0 || baseline <= 0) {
+				continue;
+			}
+			/* Throughput regresses when it drops, resources when they grow */
+			change = (summary[j] - baseline) / baseline * 100;
+			if(j < 2) {
+				change = -change;
+			}
+			printf("%s %s: %.2f -> %.2f (%+.1f%%)%s\n", section, metrics[j], baseline, summary[j],
+					(summary[j] - baseline) / baseline * 100, change > threshold ? " REGRESSION" : "");
+			if(change > threshold) {
+				regression = 1;
+			}
+		}
+	}
+
+	return regression;
+}
+
+
+/**
+ * Print usage of the benchmark
+ * @param name			name of the benchmark program
+ */
+static void print_usage(char *name) {
+	fprintf(stderr, "Run benchmark as '%s [--files N] [--seed N] [--runs N] [--output result.json] [--baseline baseline.json] "
+			"[--threshold PCT] corpus_dir program [arg ...]'\n", name);
+	fprintf(stderr, "  (corpus is generated if it does not exist, program gets '--files-from corpus_dir/list.txt' appended)\n");
+}
+
+
+int main(int argc, char *argv[]) {
+	corpus_t corpus = {NULL, "", DEFAULT_FILES, DEFAULT_SEED, 0, 0, NULL};
+	const char *output = NULL;
+	const char *baseline = NULL;
+	const char *method = "none";
+	double threshold = DEFAULT_THRESHOLD;
+	double cold[5];
+	double warm[5];
+	char **program;
+	char *end;
+	long value;
+	int runs = DEFAULT_RUNS;
+	int option;
+	int result;
+	int i;
+	FILE *file;
+	static const struct option long_options[] = {
+		{"files",		required_argument,	NULL, 'F'},
+		{"seed",		required_argument,	NULL, 's'},
+		{"runs",		required_argument,	NULL, 'r'},
+		{"output",		required_argument,	NULL, 'o'},
+		{"baseline",	required_argument,	NULL, 'b'},
+		{"threshold",	required_argument,	NULL, 'T'},
+		{NULL,			0,					NULL, 0}
+	};
+
+	/* Options of the benchmarked program are not parsed */
+	while((option = getopt_long(argc, argv, "+F:s:r:o:b:T:", long_options, NULL)) != -1) {
+		switch(option) {
+		case 'F':
+		case 's':
+		case 'r':
+			value = strtol(optarg, &end, 10);
+			if(*optarg == '\0' || *end != '\0' || value < (option == 's' ? 0 : 1) || value > 10000000) {
+				fprintf(stderr, "Wrong number '%s'!\n", optarg);
+				return 1;
+			}
+			if(option == 'F') {
+				corpus.files = value;
+			}
+			else if(option == 's') {
+				corpus.seed = value;
+			}
+			else {
+				runs = value;
+			}
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'b':
+			baseline = optarg;
+			break;
+		case 'T':
+			threshold = strtod(optarg, &end);
+			if(*optarg == '\0' || *end != '\0' || threshold < 0) {
+				fprintf(stderr, "Wrong threshold '%s'!\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+	if(argc - optind < 2) {
+		print_usage(argv[0]);
+		return 1;
+	}
+	corpus.dir = argv[optind];
+
+	/* Files of the generated corpus are parsed to check them, their frames are not printed */
+	set_id3v2_verbosity(VERBOSITY_QUIET);
+	if(prepare_corpus(&corpus) != 0) {
+		fprintf(stderr, "Error while generating corpus into %s occurred!\n", corpus.dir);
+		return 1;
+	}
+	if(corpus.parsed != corpus.files) {
+		fprintf(stderr, "Error - only %u of %u files of the corpus are parsed by the library\n", corpus.parsed, corpus.files);
+		return 1;
+	}
+
+	/* Program and its arguments followed by the list of the corpus */
+	program = malloc((argc - optind + 2) * sizeof(char *));
+	if(program == NULL) {
+		fprintf(stderr, "Error while allocating memory for arguments!\n");
+		return 1;
+	}
+	for(i = optind + 1; i < argc; i++) {
+		program[i - optind - 1] = argv[i];
+	}
+	program[argc - optind - 1] = "--files-from";
+	program[argc - optind] = corpus.list;
+	program[argc - optind + 1] = NULL;
+
+	result = measure_runs(&corpus, program, runs, 1, &method, cold) != 0
+			|| measure_runs(&corpus, program, runs, 0, &method, warm) != 0;
+	if(result == 0) {
+		file = output ? fopen(output, "w") : stdout;
+		if(file == NULL || write_results(file, &corpus, method, runs, cold, warm) != 0) {
+			fprintf(stderr, "Error while writing results into file %s!\n", output ? output : "stdout");
+			result = 1;
+		}
+		if(file && file != stdout) {
+			fclose(file);
+		}
+	}
+	if(result == 0 && baseline) {
+		result = compare_baseline(baseline, &corpus, threshold, cold, warm);
+	}
+
+	for(i = 0; corpus.paths && i < (int) corpus.files; i++) {
+		free(corpus.paths[i]);
+	}
+	free(corpus.paths);
+	free(program);
+
+	return result;
+}
@@ -0,0 +1,1030 @@
+/*
+ *  id3v2parser - program to parse ID3v2.4 tags
+ *
+ * 	Command line program built on the id3v2parser library. It parses ID3
+ * 	tags of the files into output file(s) next to them. More files can be
+ * 	parsed at once (batch mode), either each into its own output file(s) or
+ * 	into one columnar index of the whole library which can be queried by text
+ * 	frame values through mmap, or into one full-text index of texts and
+ * 	lyrics built by more threads in parallel.
+ * 	Optionally (--verify) CRC-32 and restrictions from the extended header are
+ * 	checked before the frames are parsed.
+ *
+ * 	Text information frames can be also edited. The tag is then overwritten
+ * 	in place if it fits into the original tag including its padding, otherwise
+ * 	the whole file is rewritten with new padding reserved.
+ *
+ * 	Tags can be also served by a daemon over a Unix domain socket, and
+ * 	outputs of a library tree can be kept up to date by watching it.
+ *
+ *  How to build: 'make' (or 'make PROFILE=debug', 'make PROFILE=lto')
+ *
+ *  How to run: './id3v2parser [--verify] [--quiet] [--order physical] mp3_file_to_parse.mp3 [...]'
+ *              (batch options: [--threads N] [--io-threads N] [--memory-budget MB])
+ *              (ID3v1/APEv2 trailers: [--trailer fill|override|ignore])
+ *              (only matching files: [--where 'TCON=Podcast,TDRC<2000'])
+ *
+ *  How to index: './id3v2parser --build-index library.idx --files-from list.txt'
+ *                './id3v2parser --query-index library.idx TPE1=Artist'
+ *
+ *  How to search: './id3v2parser --build-search library.fts --files-from list.txt'
+ *                 './id3v2parser --search library.fts "love lyric*"'
+ *
+ *  How to sync: './id3v2parser --digest master.dig --files-from list.txt'
+ *               './id3v2parser --diff replica.dig master.dig'
+ *
+ *  How to serve: './id3v2parser --server /tmp/id3v2parser.sock [--threads N]'
+ *                './id3v2parser --client /tmp/id3v2parser.sock [--repeat N] file.mp3 [file.mp3 ...]'
+ *
+ *  How to watch: './id3v2parser --watch library/ [--snapshot library.snap] [--build-index library.idx]'
+ *
+ *  How to edit: './id3v2parser --set TIT2=Title --set TPE1=Artist [--padding 4096] file.mp3'
+ *               (empty text, e.g. '--set TIT3=', removes the frame)
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "id3v2parser.h"
+#include "id3v2output.h"
+#include "id3v2writer.h"
+#include "id3v2column.h"
+#include "id3v2search.h"
+#include "id3v2server.h"
+#include "id3v2watch.h"
+#include "id3v2order.h"
+#include "id3v2pipeline.h"
+#include "id3v2trailer.h"
+#include "id3v2filter.h"
+#include "id3v2digest.h"
+
+
+/** List of files processed in batch mode */
+typedef struct file_list_s {
+	char **files;			/**< dynamically allocated paths */
+	size_t len;				/**< number of paths */
+	size_t capacity;		/**< allocated length of files */
+} file_list_t;
+
+/** Worker thread building one segment of full-text index */
+typedef struct search_worker_s {
+	pthread_t thread;		/**< thread of the worker */
+	file_list_t *list;		/**< files to index, shared by all workers */
+	atomic_size_t *next;	/**< next file to take, shared by all workers */
+	id3v2_search_segment_t *segment;	/**< segment of the worker */
+	int result;				/**< 0 if OK, 1 if problem has occurred */
+} search_worker_t;
+
+/** File record of the digest file */
+typedef struct digest_entry_s {
+	char *path;				/**< path of the file */
+	id3v2_digest_t digest;	/**< digest of its tag */
+} digest_entry_t;
+
+/** Records of the digest file sorted by path */
+typedef struct digest_set_s {
+	digest_entry_t *entries;	/**< dynamically allocated records */
+	size_t len;				/**< number of records */
+	size_t capacity;		/**< allocated length of entries */
+} digest_set_t;
+
+
+/**
+ * Print usage of the program
+ * @param name			name of the program
+ */
+static void print_usage(char *name) {
+	fprintf(stderr, "Run program as '%s [--verify] [--quiet] [--order physical] file.mp3 [file.mp3 ...]' to parse ID3 tags\n", name);
+	fprintf(stderr, "  (headers of tags and frames are not printed with '--quiet')\n");
+	fprintf(stderr, "  (batch is parsed by '--threads N' threads, read by '--io-threads N' threads within '--memory-budget MB')\n");
+	fprintf(stderr, "  (ID3v1 and APEv2 trailers are merged by '--trailer fill|override', 'fill' keeps ID3v2 frames)\n");
+	fprintf(stderr, "  (only files matching '--where ID=TEXT,ID<N,APIC=TYPE,...' are output or indexed by '--build-index')\n");
+	fprintf(stderr, "or as '%s --set ID=TEXT [--set ID=TEXT ...] [--padding BYTES] file.mp3' to edit it\n", name);
+	fprintf(stderr, "or as '%s --build-index library.idx [--files-from list.txt] [file.mp3 ...]' to build columnar index\n", name);
+	fprintf(stderr, "or as '%s --query-index library.idx ID=TEXT' to list files with the text frame value\n", name);
+	fprintf(stderr, "or as '%s --build-search library.fts [--threads N] [--files-from list.txt] [file.mp3 ...]' to build full-text index\n", name);
+	fprintf(stderr, "or as '%s --search library.fts \"WORD [PREFIX*] ...\"' to list files containing all words\n", name);
+	fprintf(stderr, "or as '%s --digest library.dig [--files-from list.txt] [file.mp3 ...]' to write digests of tags and frames\n", name);
+	fprintf(stderr, "or as '%s --diff from.dig to.dig' to list files and frames which differ\n", name);
+	fprintf(stderr, "or as '%s --server SOCKET [--threads N]' to run metadata daemon\n", name);
+	fprintf(stderr, "or as '%s --client SOCKET [--repeat N] file.mp3 [file.mp3 ...]' to query the daemon\n", name);
+	fprintf(stderr, "or as '%s --watch DIR [--snapshot FILE] [--build-index library.idx]' to keep outputs of the library up to date\n", name);
+}
+
+
+/**
+ * Edit text frames of ID3 tag of the file
+ * @param name			filename
+ * @param edits			array of edits
+ * @param edits_len		number of edits
+ * @param padding		padding reserved if the file has to be rewritten
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int edit_file(char *name, id3v2_edit_t *edits, size_t edits_len, uint32_t padding) {
+	switch(edit_id3v2_tag(name, edits, edits_len, padding)) {
+	case EDIT_IN_PLACE:
+		printf("ID3 tag of file %s updated in place\n", name);
+		return 0;
+	case EDIT_REWRITTEN:
+		printf("ID3 tag of file %s does not fit into its padding, file rewritten with %u bytes of padding\n", name, padding);
+		return 0;
+	default:
+		fprintf(stderr, "Error while editing ID3 tag of file %s occurred!\n", name);
+		return 1;
+	}
+}
+
+
+/**
+ * Output of the batch mode, either write parsed data into file(s) or add the file into the index
+ * @param arg			columnar index builder, NULL to write parsed data
+ * @param path			path of the file
+ * @param size			size of the file
+ * @param tag_offset		offset of the tag in the file
+ * @param tag			parsed ID3 tag
+ * @param parsed		1 if the tag was parsed, 0 if it is not valid
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int output_file(void *arg, const char *path, uint64_t size, uint64_t tag_offset, id3v2_tag_t *tag, int parsed) {
+	id3v2_column_builder_t *builder = arg;
+
+	/* File without (valid) tag is still a row of the library */
+	if(builder) {
+		return add_column_row(builder, path, size, tag_offset, (const char * const *) tag->text) != 0;
+	}
+	if(parsed && write_parsed_data(tag, (char *) path) != 0) {
+		fprintf(stderr, "Error while writing parsed data into file(s) occurred!\n");
+		return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Index files taken from the shared list into the segment of the worker
+ * @param arg			pointer to the worker structure
+ * @return				NULL
+ */
+static void *run_search_worker(void *arg) {
+	search_worker_t *worker = arg;
+	/* Workers parse in parallel, events of their files would interleave on the output */
+	id3v2_parse_context_t context = {NULL, VERBOSITY_QUIET, NULL};
+	id3v2_tag_t tag;
+	unsigned char *buffer = NULL;
+	uint32_t buffer_capacity = 0;
+	uint32_t buffer_len;
+	size_t doc;
+	int fd;
+	int match;
+	int result;
+
+	/* Files are taken one by one, so documents of the segment are ascending */
+	while((doc = atomic_fetch_add(worker->next, 1)) < worker->list->len) {
+		fd = open(worker->list->files[doc], O_RDONLY);
+		result = fd < 0 || read_tag_prefix(fd, &buffer, &buffer_capacity, &buffer_len) != 0;
+		if(fd >= 0) {
+			close(fd);
+		}
+		if(result) {
+			fprintf(stderr, "Error while reading MP3 file %s has appeared!\n", worker->list->files[doc]);
+			continue;
+		}
+		init_id3v2_tag(&tag);
+		context.path = worker->list->files[doc];
+		if(parse_buffer_context(&tag, buffer, buffer_len, NULL, &context, &match) != 0) {
+			fprintf(stderr, "Error while parsing input buffer occurred!\n");
+		}
+		else if(add_search_document(worker->segment, doc, &tag) != 0) {
+			fprintf(stderr, "Error while allocating memory for index!\n");
+			worker->result = 1;
+		}
+		deallocate_memory(&tag, NULL);
+	}
+	free_id3v2_memory(buffer);
+
+	return NULL;
+}
+
+
+/**
+ * Build full-text index of the files in parallel
+ * @param list			list of files
+ * @param name			filename of the index
+ * @param threads		number of worker threads
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int build_search_index(file_list_t *list, char *name, long threads) {
+	search_worker_t *workers;
+	id3v2_search_segment_t **segments;
+	atomic_size_t next = 0;
+	long i;
+	int result = 0;
+
+	if(list->len > UINT32_MAX) {
+		fprintf(stderr, "Too many files for full-text index!\n");
+		return 1;
+	}
+	workers = calloc(threads, sizeof(search_worker_t));
+	segments = calloc(threads, sizeof(id3v2_search_segment_t *));
+	if(workers == NULL || segments == NULL) {
+		fprintf(stderr, "Error while allocating memory for index!\n");
+		free(workers);
+		free(segments);
+		return 1;
+	}
+
+	for(i = 0; i < threads; i++) {
+		workers[i].list = list;
+		workers[i].next = &next;
+		workers[i].segment = segments[i] = create_search_segment();
+		if(segments[i] == NULL || pthread_create(&workers[i].thread, NULL, run_search_worker, &workers[i]) != 0) {
+			fprintf(stderr, "Error while starting indexing thread!\n");
+			free_search_segment(segments[i]);
+			segments[i] = NULL;
+			result = 1;
+			break;
+		}
+	}
+	threads = i;
+	for(i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		result |= workers[i].result;
+	}
+
+	/* Segments of the threads are merged into one index */
+	if(result == 0) {
+		result = write_search_index(segments, threads, list->files, list->len, name);
+		if(result == 0) {
+			printf("Full-text index written into file %s\n", name);
+		}
+	}
+
+	for(i = 0; i < threads; i++) {
+		free_search_segment(segments[i]);
+	}
+	free(segments);
+	free(workers);
+
+	return result;
+}
+
+
+/**
+ * Print files of the full-text index matching the query
+ * @param index_name	filename of the index
+ * @param query			words separated by spaces, word ending with '*' is a prefix
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int search_files(char *index_name, char *query) {
+	id3v2_search_index_t index;
+	uint8_t *matches;
+	uint64_t count;
+	uint64_t doc;
+
+	if(open_search_index(index_name, &index) != 0) {
+		return 1;
+	}
+
+	count = search_index(&index, query, &matches);
+	if(matches == NULL) {
+		fprintf(stderr, "Error while allocating memory for search!\n");
+		close_search_index(&index);
+		return 1;
+	}
+	for(doc = 0; doc < index.header->docs; doc++) {
+		if(matches[doc >> 3] & (1 << (doc & 7))) {
+			printf("%s\n", get_search_path(&index, doc));
+		}
+	}
+	fprintf(stderr, "%lu of %lu files match\n", (unsigned long) count, (unsigned long) index.header->docs);
+
+	free(matches);
+	close_search_index(&index);
+	return 0;
+}
+
+
+/**
+ * Write digests of tags of the files into digest file
+ * @param list			list of files
+ * @param name			filename of the digest file
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int build_digest_file(file_list_t *list, const char *name) {
+	id3v2_digest_t digest;
+	unsigned char *buffer = NULL;
+	uint32_t buffer_capacity = 0;
+	uint32_t buffer_len;
+	FILE *file;
+	int fd;
+	int result = 0;
+	size_t i;
+
+	file = fopen(name, "w");
+	if(file == NULL) {
+		fprintf(stderr, "Error while opening digest file %s!\n", name);
+		return 1;
+	}
+
+	init_id3v2_digest(&digest);
+	for(i = 0; i < list->len; i++) {
+		fd = open(list->files[i], O_RDONLY);
+		if(fd < 0 || read_tag_prefix(fd, &buffer, &buffer_capacity, &buffer_len) != 0) {
+			fprintf(stderr, "Error while reading MP3 file %s has appeared!\n", list->files[i]);
+			if(fd >= 0) {
+				close(fd);
+			}
+			result = 1;
+			continue;
+		}
+		close(fd);
+
+		/* File without (valid) tag has empty digest, so removal of the tag is a change too */
+		if(digest_buffer(buffer, buffer_len, &digest) != 0) {
+			fprintf(stderr, "Error while computing digest of file %s occurred!\n", list->files[i]);
+			digest.len = 0;
+			result = 1;
+			if(finish_id3v2_digest(&digest) != 0) {
+				break;
+			}
+		}
+		if(write_id3v2_digest(file, list->files[i], &digest) != 0) {
+			fprintf(stderr, "Error while writing into file %s!\n", name);
+			result = 1;
+			break;
+		}
+	}
+	free_id3v2_digest(&digest);
+	free_id3v2_memory(buffer);
+
+	if(fclose(file) != 0) {
+		fprintf(stderr, "Error while writing into file %s!\n", name);
+		result = 1;
+	}
+	if(result == 0) {
+		printf("Digests written into file %s\n", name);
+	}
+
+	return result;
+}
+
+
+/**
+ * Compare records of the digest file by path
+ * @param a				first record
+ * @param b				second record
+ * @return				result of strcmp() of the paths
+ */
+static int compare_digest_entries(const void *a, const void *b) {
+	return strcmp(((const digest_entry_t *) a)->path, ((const digest_entry_t *) b)->path);
+}
+
+/**
+ * Free records of the digest file
+ * @param set			records of the digest file
+ */
+static void free_digest_set(digest_set_t *set) {
+	size_t i;
+
+	for(i = 0; i < set->len; i++) {
+		free(set->entries[i].path);
+		free_id3v2_digest(&set->entries[i].digest);
+	}
+	free(set->entries);
+}
+
+/**
+ * Read all records of the digest file and sort them by path
+ * @param name			filename of the digest file
+ * @param set			pointer to the empty set of records
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int read_digest_set(const char *name, digest_set_t *set) {
+	digest_entry_t *tmp;
+	FILE *file;
+	int result;
+
+	file = fopen(name, "r");
+	if(file == NULL) {
+		fprintf(stderr, "Error while opening digest file %s!\n", name);
+		return 1;
+	}
+
+	for(;;) {
+		if(set->len == set->capacity) {
+			set->capacity = set->capacity ? set->capacity * 2 : 1024;
+			tmp = realloc(set->entries, set->capacity * sizeof(digest_entry_t));
+			if(tmp == NULL) {
+				fprintf(stderr, "Error while allocating memory for digests!\n");
+				fclose(file);
+				return 1;
+			}
+			set->entries = tmp;
+		}
+		init_id3v2_digest(&set->entries[set->len].digest);
+		result = read_id3v2_digest(file, &set->entries[set->len].path, &set->entries[set->len].digest);
+		if(result != 0) {
+			free_id3v2_digest(&set->entries[set->len].digest);
+			break;
+		}
+		set->len++;
+	}
+	fclose(file);
+	if(result < 0) {
+		fprintf(stderr, "Error - digest file %s is corrupted!\n", name);
+		return 1;
+	}
+
+	qsort(set->entries, set->len, sizeof(digest_entry_t), compare_digest_entries);
+	return 0;
+}
+
+/**
+ * Print changed frame of the file
+ * @param arg			unused
+ * @param change		DIGEST_ADDED, DIGEST_REMOVED or DIGEST_MODIFIED
+ * @param frame			digest of the frame
+ */
+static void print_digest_change(void *arg, int change, const id3v2_frame_digest_t *frame) {
+	(void) arg;
+	printf("\t%c\t%s\t%u\n", change, frame->id, frame->instance);
+}
+
+/**
+ * Print files and frames which differ between two digest files
+ * @param from_name		digest file of the old library (e.g. replica)
+ * @param to_name		digest file of the new library (e.g. master)
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int diff_digest_files(const char *from_name, const char *to_name) {
+	digest_set_t from = {NULL, 0, 0};
+	digest_set_t to = {NULL, 0, 0};
+	size_t i = 0;
+	size_t j = 0;
+	size_t changed = 0;
+	int cmp;
+
+	if(read_digest_set(from_name, &from) != 0 || read_digest_set(to_name, &to) != 0) {
+		free_digest_set(&from);
+		free_digest_set(&to);
+		return 1;
+	}
+
+	/* Both sets are sorted by path, files with equal tag digests are skipped */
+	while(i < from.len || j < to.len) {
+		cmp = i == from.len ? 1 : j == to.len ? -1 : strcmp(from.entries[i].path, to.entries[j].path);
+		if(cmp < 0) {
+			printf("%c\t%s\n", DIGEST_REMOVED, from.entries[i++].path);
+			changed++;
+		}
+		else if(cmp > 0) {
+			printf("%c\t%s\n", DIGEST_ADDED, to.entries[j++].path);
+			changed++;
+		}
+		else {
+			if(diff_id3v2_digest(&from.entries[i].digest, &to.entries[j].digest, NULL, NULL) != 0) {
+				printf("%c\t%s\n", DIGEST_MODIFIED, to.entries[j].path);
+				diff_id3v2_digest(&from.entries[i].digest, &to.entries[j].digest, print_digest_change, NULL);
+				changed++;
+			}
+			i++;
+			j++;
+		}
+	}
+	fprintf(stderr, "%lu of %lu files changed\n", (unsigned long) changed, (unsigned long) to.len);
+
+	free_digest_set(&from);
+	free_digest_set(&to);
+	return 0;
+}
+
+
+/**
+ * Append path into the list of files
+ * @param list			list of files
+ * @param path			dynamically allocated path, the list takes its ownership
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int add_file(file_list_t *list, char *path) {
+	char **tmp;
+
+	if(path == NULL) {
+		fprintf(stderr, "Error while allocating memory for list of files!\n");
+		return 1;
+	}
+	if(list->len == list->capacity) {
+		tmp = realloc(list->files, (list->capacity ? list->capacity * 2 : 1024) * sizeof(char *));
+		if(tmp == NULL) {
+			fprintf(stderr, "Error while allocating memory for list of files!\n");
+			free(path);
+			return 1;
+		}
+		list->files = tmp;
+		list->capacity = list->capacity ? list->capacity * 2 : 1024;
+	}
+	list->files[list->len++] = path;
+
+	return 0;
+}
+
+
+/**
+ * Read list of files, one path per line
+ * @param name			filename of the list, '-' for standard input
+ * @param list			list of files to extend
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int read_file_list(char *name, file_list_t *list) {
+	FILE *file;
+	char *line = NULL;
+	size_t line_capacity = 0;
+	ssize_t len;
+	int result = 0;
+
+	file = strcmp(name, "-") == 0 ? stdin : fopen(name, "r");
+	if(file == NULL) {
+		fprintf(stderr, "Error while opening file %s!\n", name);
+		return 1;
+	}
+
+	while((len = getline(&line, &line_capacity, file)) != -1) {
+		if(len > 0 && line[len - 1] == '\n') {
+			line[--len] = '\0';
+		}
+		if(len == 0) {
+			continue;
+		}
+		if(add_file(list, line) != 0) {
+			result = 1;
+			break;
+		}
+		line = NULL;
+		line_capacity = 0;
+	}
+
+	free(line);
+	if(file != stdin) {
+		fclose(file);
+	}
+
+	return result;
+}
+
+
+/**
+ * Free list of files
+ * @param list			list of files
+ */
+static void free_file_list(file_list_t *list) {
+	size_t i;
+
+	for(i = 0; i < list->len; i++) {
+		free(list->files[i]);
+	}
+	free(list->files);
+	memset(list, 0, sizeof(*list));
+}
+
+
+/**
+ * Print files of the columnar index whose text frame has the given value
+ * @param index_name	filename of the index
+ * @param query			query in form 'ID=TEXT'
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int query_index(char *index_name, char *query) {
+	id3v2_column_index_t index;
+	const id3v2_column_entry_t *column;
+	const uint32_t *codes;
+	uint32_t code;
+	uint64_t row;
+	uint64_t matches = 0;
+	char *eq = strchr(query, '=');
+
+	if(eq == NULL || eq - query != 4) {
+		fprintf(stderr, "Query '%s' has to be in form ID=TEXT (e.g. TPE1=Artist)\n", query);
+		return 1;
+	}
+	if(open_column_index(index_name, &index) != 0) {
+		return 1;
+	}
+
+	column = find_column(&index, query);
+	if(column == NULL) {
+		fprintf(stderr, "Index %s has no column %.4s\n", index_name, query);
+		close_column_index(&index);
+		return 1;
+	}
+
+	/* Value is looked up once in the dictionary, then only codes are compared */
+	code = find_column_code(&index, column, eq + 1);
+	if(code != COLUMN_CODE_NONE) {
+		codes = get_column_codes(&index, column);
+		for(row = 0; row < index.header->rows; row++) {
+			if(codes[row] == code) {
+				printf("%s\n", get_column_path(&index, row));
+				matches++;
+			}
+		}
+	}
+	fprintf(stderr, "%lu of %lu files match\n", (unsigned long) matches, (unsigned long) index.header->rows);
+
+	close_column_index(&index);
+	return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+	id3v2_edit_t *edits;
+	size_t edits_len = 0;
+	uint32_t padding = DEFAULT_PADDING;
+	char *build_index = NULL;
+	char *query_index_name = NULL;
+	char *files_from = NULL;
+	char *build_search = NULL;
+	char *search = NULL;
+	char *server = NULL;
+	char *client = NULL;
+	long repeat = 1;
+	char *watch = NULL;
+	char *snapshot = NULL;
+	uint8_t physical_order = 0;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	id3v2_pipeline_config_t pipeline = {DEFAULT_IO_THREADS, 1, DEFAULT_MEMORY_BUDGET, 0, TRAILER_IGNORE, NULL};
+	char *where = NULL;
+	char *digest = NULL;
+	char *diff = NULL;
+	id3v2_filter_t filter;
+	file_list_t list = {NULL, 0, 0};
+	const char *ids[TEXTINFO_COUNT + 1];
+	id3v2_column_builder_t *builder = NULL;
+	char *end;
+	unsigned long value;
+	int option;
+	int result = 0;
+	size_t i;
+	static const struct option long_options[] = {
+		{"set",			required_argument,	NULL, 's'},
+		{"padding",		required_argument,	NULL, 'p'},
+		{"verify",		no_argument,		NULL, 'c'},
+		{"build-index",	required_argument,	NULL, 'i'},
+		{"query-index",	required_argument,	NULL, 'q'},
+		{"files-from",	required_argument,	NULL, 'f'},
+		{"build-search",	required_argument,	NULL, 'b'},
+		{"search",		required_argument,	NULL, 'S'},
+		{"threads",		required_argument,	NULL, 't'},
+		{"server",		required_argument,	NULL, 'D'},
+		{"client",		required_argument,	NULL, 'C'},
+		{"repeat",		required_argument,	NULL, 'r'},
+		{"watch",		required_argument,	NULL, 'w'},
+		{"snapshot",	required_argument,	NULL, 'n'},
+		{"order",		required_argument,	NULL, 'o'},
+		{"io-threads",	required_argument,	NULL, 'I'},
+		{"memory-budget",	required_argument,	NULL, 'm'},
+		{"trailer",		required_argument,	NULL, 'T'},
+		{"where",		required_argument,	NULL, 'W'},
+		{"quiet",		no_argument,		NULL, 'Q'},
+		{"digest",		required_argument,	NULL, 'd'},
+		{"diff",		required_argument,	NULL, 'x'},
+		{NULL,			0,					NULL, 0}
+	};
+
+	/* There cannot be more edits than arguments */
+	edits = malloc(argc * sizeof(id3v2_edit_t));
+	if(edits == NULL) {
+		fprintf(stderr, "Error while allocating memory for edits!\n");
+		return 1;
+	}
+
+	while((option = getopt_long(argc, argv, "s:p:ci:q:f:b:S:t:D:C:r:w:n:o:I:m:T:W:Qd:x:", long_options, NULL)) != -1) {
+		switch(option) {
+		case 's':
+			if(parse_id3v2_edit(optarg, &edits[edits_len]) != 0) {
+				free(edits);
+				return 1;
+			}
+			edits_len++;
+			break;
+		case 'p':
+			value = strtoul(optarg, &end, 10);
+			if(*optarg == '\0' || *end != '\0' || value > MAX_TAG_SIZE) {
+				fprintf(stderr, "Wrong padding '%s'!\n", optarg);
+				free(edits);
+				return 1;
+			}
+			padding = value;
+			break;
+		case 'c':
+			set_integrity_check(1);
+			break;
+		case 'i':
+			build_index = optarg;
+			break;
+		case 'q':
+			query_index_name = optarg;
+			break;
+		case 'f':
+			files_from = optarg;
+			break;
+		case 'b':
+			build_search = optarg;
+			break;
+		case 'S':
+			search = optarg;
+			break;
+		case 't':
+			threads = strtol(optarg, &end, 10);
+			if(*optarg == '\0' || *end != '\0' || threads < 1 || threads > 1024) {
+				fprintf(stderr, "Wrong number of threads '%s'!\n", optarg);
+				free(edits);
+				return 1;
+			}
+			break;
+		case 'D':
+			server = optarg;
+			break;
+		case 'C':
+			client = optarg;
+			break;
+		case 'w':
+			watch = optarg;
+			break;
+		case 'n':
+			snapshot = optarg;
+			break;
+		case 'I':
+			pipeline.io_threads = strtol(optarg, &end, 10);
+			if(*optarg == '\0' || *end != '\0' || pipeline.io_threads < 1 || pipeline.io_threads > 1024) {
+				fprintf(stderr, "Wrong number of I/O threads '%s'!\n", optarg);
+				free(edits);
+				return 1;
+			}
+			break;
+		case 'm':
+			value = strtoul(optarg, &end, 10);
+			if(*optarg == '\0' || *end != '\0' || value < 1 || value > SIZE_MAX / (1024 * 1024)) {
+				fprintf(stderr, "Wrong memory budget '%s'!\n", optarg);
+				free(edits);
+				return 1;
+			}
+			pipeline.memory_budget = value * 1024 * 1024;
+			break;
+		case 'o':
+			if(strcmp(optarg, "physical") == 0) {
+				physical_order = 1;
+			}
+			else if(strcmp(optarg, "given") == 0) {
+				physical_order = 0;
+			}
+			else {
+				fprintf(stderr, "Wrong order '%s'!\n", optarg);
+				free(edits);
+				return 1;
+			}
+			break;
+		case 'T':
+			if(strcmp(optarg, "fill") == 0) {
+				pipeline.trailer = TRAILER_FILL;
+			}
+			else if(strcmp(optarg, "override") == 0) {
+				pipeline.trailer = TRAILER_OVERRIDE;
+			}
+			else if(strcmp(optarg, "ignore") == 0) {
+				pipeline.trailer = TRAILER_IGNORE;
+			}
+			else {
+				fprintf(stderr, "Wrong trailer precedence '%s'!\n", optarg);
+				free(edits);
+				return 1;
+			}
+			break;
+		case 'W':
+			where = optarg;
+			break;
+		case 'Q':
+			set_id3v2_verbosity(VERBOSITY_QUIET);
+			break;
+		case 'd':
+			digest = optarg;
+			break;
+		case 'x':
+			diff = optarg;
+			break;
+		case 'r':
+			repeat = strtol(optarg, &end, 10);
+			if(*optarg == '\0' || *end != '\0' || repeat < 1 || repeat > 1000000) {
+				fprintf(stderr, "Wrong number of repeats '%s'!\n", optarg);
+				free(edits);
+				return 1;
+			}
+			break;
+		default:
+			print_usage(argv[0]);
+			free(edits);
+			return 1;
+		}
+	}
+
+	/* Filter and trailers are applied only by the pipeline (parsing and building of columnar index) */
+	if((where || pipeline.trailer != TRAILER_IGNORE) && (query_index_name || server || watch || client || diff
+			|| search || edits_len > 0 || build_search || digest)) {
+		fprintf(stderr, "Options --where and --trailer can be used only to parse files or to build columnar index!\n");
+		print_usage(argv[0]);
+		free(edits);
+		return 1;
+	}
+
+	if(query_index_name) {
+		free(edits);
+		if(argc - optind != 1) {
+			fprintf(stderr, "Wrong number of arguments!\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+		return query_index(query_index_name, argv[optind]);
+	}
+
+	if(server) {
+		free(edits);
+		if(argc - optind != 0) {
+			fprintf(stderr, "Wrong number of arguments!\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+		return run_id3v2_server(server, threads > 0 ? threads : 1);
+	}
+
+	if(watch) {
+		free(edits);
+		if(argc - optind != 0 || files_from) {
+			fprintf(stderr, "Wrong number of arguments!\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+		return run_id3v2_watch(watch, snapshot, build_index);
+	}
+
+	if(client) {
+		free(edits);
+		if(argc - optind < 1) {
+			fprintf(stderr, "Wrong number of arguments!\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+		return run_id3v2_client(client, argv + optind, argc - optind, repeat);
+	}
+
+	if(diff) {
+		free(edits);
+		if(argc - optind != 1) {
+			fprintf(stderr, "Wrong number of arguments!\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+		return diff_digest_files(diff, argv[optind]);
+	}
+
+	if(search) {
+		free(edits);
+		if(argc - optind != 1) {
+			fprintf(stderr, "Wrong number of arguments!\n");
+			print_usage(argv[0]);
+			return 1;
+		}
+		return search_files(search, argv[optind]);
+	}
+
+	/* Program receives as its last argument name of the MP3 file */
+	if(edits_len > 0) {
+		if(argc - optind != 1 || files_from) {
+			fprintf(stderr, "Wrong number of arguments!\n");
+			print_usage(argv[0]);
+			free(edits);
+			return 1;
+		}
+		result = edit_file(argv[optind], edits, edits_len, padding);
+		free(edits);
+		return result;
+	}
+	free(edits);
+
+	/* Batch mode processes files given as arguments followed by those from the list */
+	for(i = optind; i < (size_t) argc; i++) {
+		if(add_file(&list, strdup(argv[i])) != 0) {
+			free_file_list(&list);
+			return 1;
+		}
+	}
+	if(files_from && read_file_list(files_from, &list) != 0) {
+		free_file_list(&list);
+		return 1;
+	}
+	if(list.len == 0) {
+		fprintf(stderr, "Wrong number of arguments!\n");
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	/* Tags are read in sweeps over the device instead of directory order */
+	if(physical_order && order_by_physical_offset(list.files, list.len) != 0) {
+		free_file_list(&list);
+		return 1;
+	}
+
+	if(build_search) {
+		result = build_search_index(&list, build_search, threads > 0 ? threads : 1);
+		free_file_list(&list);
+		return result;
+	}
+
+	if(digest) {
+		result = build_digest_file(&list, digest);
+		free_file_list(&list);
+		return result;
+	}
+
+	/* Filter is compiled once for all files */
+	if(where) {
+		if(compile_id3v2_filter(where, &filter) != 0) {
+			fprintf(stderr, "Wrong filter '%s'!\n", where);
+			free_file_list(&list);
+			return 1;
+		}
+		pipeline.where = &filter;
+	}
+
+	if(build_index) {
+		for(i = 0; i < TEXTINFO_COUNT; i++) {
+			ids[i] = get_id3v2_text_id(i);
+		}
+		ids[i] = NULL;
+		builder = create_column_builder(ids);
+		if(builder == NULL) {
+			fprintf(stderr, "Error while allocating memory for index!\n");
+			if(where) {
+				free_id3v2_filter(&filter);
+			}
+			free_file_list(&list);
+			return 1;
+		}
+	}
+
+	/* Freed large tags go back to the system, glibc would otherwise raise the threshold and keep them */
+	mallopt(M_MMAP_THRESHOLD, POOL_BUFFER_MAX_LEN);
+
+	/* Reading of tags overlaps with their parsing */
+	pipeline.parse_threads = threads > 0 ? threads : 1;
+	pipeline.prefetch = physical_order;
+	result = run_id3v2_pipeline(list.files, list.len, &pipeline, output_file, builder);
+
+	if(builder) {
+		if(write_column_index(builder, build_index) != 0) {
+			result = 1;
+		}
+		else {
+			printf("Index written into file %s\n", build_index);
+		}
+	}
+	if(where) {
+		free_id3v2_filter(&filter);
+	}
+	free_file_list(&list);
+
+	return result;
+}
@@ -0,0 +1,637 @@
+/*
+ *  id3v2column - columnar index of a library of ID3 tags
+ *
+ * 	Builds one file holding text frames of many parsed tags, one column per
+ * 	text frame with dictionary encoded values, and reads it back through mmap
+ * 	without any deserialisation. See id3v2column.h for the file layout.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "id3v2column.h"
+
+/** Initial capacity of growing arrays */
+#define INITIAL_CAPACITY 1024
+
+/** Round offset up to multiple of 8 bytes */
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t) 7)
+
+
+/** Growing buffer of bytes */
+typedef struct byte_buffer_s {
+	unsigned char *data;	/**< content */
+	uint64_t len;			/**< used length */
+	uint64_t capacity;		/**< allocated length */
+} byte_buffer_t;
+
+/** Column of the builder, distinct values are found through open addressing hash table */
+typedef struct column_builder_s {
+	char id[5];				/**< frame ID code */
+	char **values;			/**< distinct values in order of insertion */
+	uint32_t count;			/**< number of distinct values */
+	uint32_t values_capacity;	/**< allocated length of values */
+	uint32_t *slots;		/**< hash table of codes (0 is empty slot) */
+	uint32_t slots_len;		/**< length of hash table, power of two */
+	byte_buffer_t codes;	/**< uint32 code per row */
+} column_builder_t;
+
+struct id3v2_column_builder_s {
+	column_builder_t *columns;	/**< text columns */
+	uint32_t columns_len;	/**< number of text columns */
+	uint64_t rows;			/**< number of rows */
+	byte_buffer_t paths;	/**< heap of paths */
+	byte_buffer_t path_offsets;	/**< uint64 offset of path per row */
+	byte_buffer_t sizes;	/**< uint64 file size per row */
+	byte_buffer_t tag_offsets;	/**< uint64 tag offset per row */
+};
+
+
+/**
+ * Append data to the growing buffer
+ * @param buffer		growing buffer
+ * @param data			data to append
+ * @param len			length of the data
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int append_bytes(byte_buffer_t *buffer, const void *data, uint64_t len) {
+	unsigned char *tmp;
+	uint64_t capacity;
+
+	if(buffer->len + len > buffer->capacity) {
+		capacity = buffer->capacity ? buffer->capacity : INITIAL_CAPACITY;
+		while(capacity < buffer->len + len) {
+			capacity *= 2;
+		}
+		tmp = realloc(buffer->data, capacity);
+		if(tmp == NULL) {
+			return 1;
+		}
+		buffer->data = tmp;
+		buffer->capacity = capacity;
+	}
+	memcpy(buffer->data + buffer->len, data, len);
+	buffer->len += len;
+
+	return 0;
+}
+
+
+/**
+ * Compute FNV-1a hash of the string
+ * @param text			string to hash
+ * @return				hash
+ */
+static uint32_t hash_string(const char *text) {
+	uint32_t hash = 2166136261u;
+
+	while(*text) {
+		hash = (hash ^ (unsigned char) *text++) * 16777619u;
+	}
+	return hash;
+}
+
+
+/**
+ * Find code of the value in the column, the value is added if it is not there
+ * @param column		column of the builder
+ * @param value			value to find
+ * @return				code of the value or COLUMN_CODE_NONE if problem has occurred
+ */
+static uint32_t intern_value(column_builder_t *column, const char *value) {
+	uint32_t slot;
+	uint32_t *slots;
+	uint32_t slots_len;
+	uint32_t i;
+	char **values;
+
+	/* Keep load factor of the hash table under one half */
+	if((column->count + 1) * 2 > column->slots_len) {
+		slots_len = column->slots_len ? column->slots_len * 2 : INITIAL_CAPACITY;
+		slots = calloc(slots_len, sizeof(uint32_t));
+		if(slots == NULL) {
+			return COLUMN_CODE_NONE;
+		}
+		for(i = 0; i < column->count; i++) {
+			slot = hash_string(column->values[i]) & (slots_len - 1);
+			while(slots[slot]) {
+				slot = (slot + 1) & (slots_len - 1);
+			}
+			slots[slot] = i + 1;
+		}
+		free(column->slots);
+		column->slots = slots;
+		column->slots_len = slots_len;
+	}
+
+	slot = hash_string(value) & (column->slots_len - 1);
+	while(column->slots[slot]) {
+		if(strcmp(column->values[column->slots[slot] - 1], value) == 0) {
+			return column->slots[slot];
+		}
+		slot = (slot + 1) & (column->slots_len - 1);
+	}
+
+	if(column->count == column->values_capacity) {
+		values = realloc(column->values, (column->values_capacity ? column->values_capacity * 2 : INITIAL_CAPACITY) * sizeof(char *));
+		if(values == NULL) {
+			return COLUMN_CODE_NONE;
+		}
+		column->values = values;
+		column->values_capacity = column->values_capacity ? column->values_capacity * 2 : INITIAL_CAPACITY;
+	}
+	column->values[column->count] = strdup(value);
+	if(column->values[column->count] == NULL) {
+		return COLUMN_CODE_NONE;
+	}
+	column->slots[slot] = ++column->count;
+
+	return column->count;
+}
+
+
+id3v2_column_builder_t *create_column_builder(const char * const *ids) {
+	id3v2_column_builder_t *builder;
+	uint32_t i;
+
+	builder = calloc(1, sizeof(id3v2_column_builder_t));
+	if(builder == NULL) {
+		return NULL;
+	}
+	for(builder->columns_len = 0; ids[builder->columns_len]; builder->columns_len++);
+
+	builder->columns = calloc(builder->columns_len ? builder->columns_len : 1, sizeof(column_builder_t));
+	if(builder->columns == NULL) {
+		free(builder);
+		return NULL;
+	}
+	for(i = 0; i < builder->columns_len; i++) {
+		memcpy(builder->columns[i].id, ids[i], 4);
+	}
+
+	return builder;
+}
+
+
+int add_column_row(id3v2_column_builder_t *builder, const char *path, uint64_t size, uint64_t tag_offset,
+		const char * const *texts) {
+	uint64_t offset = builder->paths.len;
+	uint32_t code;
+	uint32_t i;
+
+	if(append_bytes(&builder->paths, path, strlen(path) + 1) != 0
+			|| append_bytes(&builder->path_offsets, &offset, sizeof(offset)) != 0
+			|| append_bytes(&builder->sizes, &size, sizeof(size)) != 0
+			|| append_bytes(&builder->tag_offsets, &tag_offset, sizeof(tag_offset)) != 0) {
+		fprintf(stderr, "Error while allocating memory for index!\n");
+		return 1;
+	}
+
+	for(i = 0; i < builder->columns_len; i++) {
+		code = COLUMN_CODE_NONE;
+		if(texts[i]) {
+			code = intern_value(&builder->columns[i], texts[i]);
+			if(code == COLUMN_CODE_NONE) {
+				fprintf(stderr, "Error while allocating memory for index!\n");
+				return 1;
+			}
+		}
+		if(append_bytes(&builder->columns[i].codes, &code, sizeof(code)) != 0) {
+			fprintf(stderr, "Error while allocating memory for index!\n");
+			return 1;
+		}
+	}
+	builder->rows++;
+
+	return 0;
+}
+
+
+/** Column being sorted, qsort() has no context argument */
+static char **sorted_values;
+
+/**
+ * Compare two codes by their values
+ * @param a				pointer to the first code
+ * @param b				pointer to the second code
+ * @return				result of strcmp() of their values
+ */
+static int compare_codes(const void *a, const void *b) {
+	return strcmp(sorted_values[*(const uint32_t *) a], sorted_values[*(const uint32_t *) b]);
+}
+
+
+/**
+ * Write data at the current position followed by zero padding to 8 bytes
+ * @param file			output file
+ * @param data			data to write, NULL if they are already written and only padding is missing
+ * @param len			length of the data
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int write_aligned(FILE *file, const void *data, uint64_t len) {
+	static const unsigned char zeros[8];
+
+	if(data && len > 0 && fwrite(data, 1, len, file) != len) {
+		return 1;
+	}
+	if(ALIGN8(len) != len && fwrite(zeros, 1, ALIGN8(len) - len, file) != ALIGN8(len) - len) {
+		return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Sort dictionary of the column and write it with the recoded codes
+ * @param file			output file
+ * @param column		column of the builder
+ * @param entry			directory entry of the column, offsets are filled in
+ * @param offset		pointer to the current file offset
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int write_column(FILE *file, column_builder_t *column, id3v2_column_entry_t *entry, uint64_t *offset) {
+	uint32_t *order;
+	uint32_t *recode;
+	uint32_t *codes = (uint32_t *) column->codes.data;
+	uint64_t *dict_offsets;
+	uint64_t heap_len = 0;
+	uint64_t rows = column->codes.len / sizeof(uint32_t);
+	uint64_t i;
+	int result = 1;
+
+	order = malloc((column->count + 1) * sizeof(uint32_t));
+	recode = malloc((column->count + 1) * sizeof(uint32_t));
+	dict_offsets = malloc((column->count + 1) * sizeof(uint64_t));
+	if(order == NULL || recode == NULL || dict_offsets == NULL) {
+		goto end;
+	}
+
+	/* Sorted dictionary allows binary search and prefix ranges */
+	for(i = 0; i < column->count; i++) {
+		order[i] = i;
+	}
+	sorted_values = column->values;
+	qsort(order, column->count, sizeof(uint32_t), compare_codes);
+	recode[COLUMN_CODE_NONE] = COLUMN_CODE_NONE;
+	for(i = 0; i < column->count; i++) {
+		recode[order[i] + 1] = i + 1;
+		dict_offsets[i] = heap_len;
+		heap_len += strlen(column->values[order[i]]) + 1;
+	}
+	dict_offsets[column->count] = heap_len;
+	for(i = 0; i < rows; i++) {
+		codes[i] = recode[codes[i]];
+	}
+
+	memcpy(entry->id, column->id, 4);
+	entry->count = column->count;
+	entry->dict_offsets = *offset;
+	*offset += ALIGN8((column->count + 1) * sizeof(uint64_t));
+	entry->dict_heap = *offset;
+	*offset += ALIGN8(heap_len);
+	entry->codes = *offset;
+	*offset += ALIGN8(column->codes.len);
+
+	if(write_aligned(file, dict_offsets, (column->count + 1) * sizeof(uint64_t)) != 0) {
+		goto end;
+	}
+	for(i = 0; i < column->count; i++) {
+		if(fwrite(column->values[order[i]], 1, strlen(column->values[order[i]]) + 1, file)
+				!= strlen(column->values[order[i]]) + 1) {
+			goto end;
+		}
+	}
+	if(write_aligned(file, NULL, heap_len) != 0 || write_aligned(file, codes, column->codes.len) != 0) {
+		goto end;
+	}
+	result = 0;
+
+end:
+	free(order);
+	free(recode);
+	free(dict_offsets);
+	return result;
+}
+
+
+int write_column_index(id3v2_column_builder_t *builder, const char *name) {
+	id3v2_column_index_header_t header;
+	id3v2_column_entry_t *entries;
+	uint64_t offset;
+	uint64_t end_offset;
+	uint32_t i;
+	FILE *file;
+	int result = 1;
+
+	entries = calloc(builder->columns_len ? builder->columns_len : 1, sizeof(id3v2_column_entry_t));
+	file = fopen(name, "wb");
+	if(entries == NULL || file == NULL) {
+		fprintf(stderr, "Error while opening index file %s to write!\n", name);
+		goto end;
+	}
+
+	/* Terminating offset of the path heap */
+	end_offset = builder->paths.len;
+	if(append_bytes(&builder->path_offsets, &end_offset, sizeof(end_offset)) != 0) {
+		goto end;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, COLUMN_INDEX_MAGIC, sizeof(COLUMN_INDEX_MAGIC));
+	header.version = COLUMN_INDEX_VERSION;
+	header.columns = builder->columns_len;
+	header.rows = builder->rows;
+	offset = sizeof(header) + builder->columns_len * sizeof(id3v2_column_entry_t);
+	header.path_offsets = offset;
+	offset += ALIGN8(builder->path_offsets.len);
+	header.path_heap = offset;
+	offset += ALIGN8(builder->paths.len);
+	header.sizes = offset;
+	offset += ALIGN8(builder->sizes.len);
+	header.tag_offsets = offset;
+	offset += ALIGN8(builder->tag_offsets.len);
+
+	/* Directory is written first with zero offsets and rewritten when the columns are laid out */
+	if(fwrite(&header, sizeof(header), 1, file) != 1
+			|| fwrite(entries, sizeof(id3v2_column_entry_t), builder->columns_len, file) != builder->columns_len
+			|| write_aligned(file, builder->path_offsets.data, builder->path_offsets.len) != 0
+			|| write_aligned(file, builder->paths.data, builder->paths.len) != 0
+			|| write_aligned(file, builder->sizes.data, builder->sizes.len) != 0
+			|| write_aligned(file, builder->tag_offsets.data, builder->tag_offsets.len) != 0) {
+		goto end;
+	}
+	for(i = 0; i < builder->columns_len; i++) {
+		if(write_column(file, &builder->columns[i], &entries[i], &offset) != 0) {
+			goto end;
+		}
+	}
+	if(fseek(file, sizeof(header), SEEK_SET) != 0
+			|| fwrite(entries, sizeof(id3v2_column_entry_t), builder->columns_len, file) != builder->columns_len) {
+		goto end;
+	}
+	result = 0;
+
+end:
+	if(file != NULL && fclose(file) != 0) {
+		result = 1;
+	}
+	if(result != 0) {
+		fprintf(stderr, "Error while writing index file %s!\n", name);
+	}
+	free(entries);
+	free_column_builder(builder);
+
+	return result;
+}
+
+
+void free_column_builder(id3v2_column_builder_t *builder) {
+	uint32_t i;
+	uint32_t j;
+
+	if(builder == NULL) {
+		return;
+	}
+	for(i = 0; i < builder->columns_len; i++) {
+		for(j = 0; j < builder->columns[i].count; j++) {
+			free(builder->columns[i].values[j]);
+		}
+		free(builder->columns[i].values);
+		free(builder->columns[i].slots);
+		free(builder->columns[i].codes.data);
+	}
+	free(builder->columns);
+	free(builder->paths.data);
+	free(builder->path_offsets.data);
+	free(builder->sizes.data);
+	free(builder->tag_offsets.data);
+	free(builder);
+}
+
+
+/**
+ * Check that the section lies within the mapped file
+ * @param index			pointer to the index structure
+ * @param offset		offset of the section
+ * @param len			length of the section
+ * @return				1 if valid, 0 otherwise
+ */
+static int is_valid_section(const id3v2_column_index_t *index, uint64_t offset, uint64_t len) {
+	return offset <= index->len && len <= index->len - offset && (offset & 7) == 0;
+}
+
+
+/**
+ * Check that the string offsets point into their heap and that the strings end within it
+ * @param index			pointer to the index structure
+ * @param offsets		offset of the string offsets (count + 1, the last one is length of the heap)
+ * @param count			number of strings
+ * @param heap			offset of the heap
+ * @return				1 if valid, 0 otherwise
+ */
+static int is_valid_heap(const id3v2_column_index_t *index, uint64_t offsets, uint64_t count, uint64_t heap) {
+	const uint64_t *p = (const uint64_t *) (index->base + offsets);
+	uint64_t i;
+
+	for(i = 0; i < count; i++) {
+		if(p[i] >= p[count]) {
+			return 0;
+		}
+	}
+	/* Heap ending with NUL terminates every string starting within it */
+	return count == 0 || index->base[heap + p[count] - 1] == '\0';
+}
+
+
+/**
+ * Check that the codes of the column refer to its dictionary
+ * @param index			pointer to the index structure
+ * @param column		column with validated sections
+ * @return				1 if valid, 0 otherwise
+ */
+static int is_valid_codes(const id3v2_column_index_t *index, const id3v2_column_entry_t *column) {
+	const uint32_t *codes = (const uint32_t *) (index->base + column->codes);
+	uint64_t row;
+
+	for(row = 0; row < index->header->rows; row++) {
+		if(codes[row] > column->count) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+int open_column_index(const char *name, id3v2_column_index_t *index) {
+	const id3v2_column_index_header_t *header;
+	const id3v2_column_entry_t *column;
+	struct stat st;
+	void *base;
+	uint32_t i;
+	int fd;
+
+	memset(index, 0, sizeof(*index));
+	fd = open(name, O_RDONLY);
+	if(fd < 0) {
+		fprintf(stderr, "Error while opening index file %s!\n", name);
+		return 1;
+	}
+	if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(id3v2_column_index_header_t)) {
+		fprintf(stderr, "Index file %s is too small\n", name);
+		close(fd);
+		return 1;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED) {
+		fprintf(stderr, "Error while mapping index file %s!\n", name);
+		return 1;
+	}
+	index->base = base;
+	index->len = st.st_size;
+	index->header = header = base;
+	index->columns = (const id3v2_column_entry_t *) (index->base + sizeof(*header));
+
+	/* Validate layout and offsets so the accessors need not check bounds */
+	if(memcmp(header->magic, COLUMN_INDEX_MAGIC, sizeof(COLUMN_INDEX_MAGIC)) != 0 || header->version != COLUMN_INDEX_VERSION
+			|| !is_valid_section(index, sizeof(*header), (uint64_t) header->columns * sizeof(id3v2_column_entry_t))
+			|| header->rows > index->len
+			|| !is_valid_section(index, header->path_offsets, (header->rows + 1) * sizeof(uint64_t))
+			|| !is_valid_section(index, header->sizes, header->rows * sizeof(uint64_t))
+			|| !is_valid_section(index, header->tag_offsets, header->rows * sizeof(uint64_t))
+			|| !is_valid_section(index, header->path_heap,
+					((const uint64_t *) (index->base + header->path_offsets))[header->rows])
+			|| !is_valid_heap(index, header->path_offsets, header->rows, header->path_heap)) {
+		goto invalid;
+	}
+	for(i = 0; i < header->columns; i++) {
+		column = &index->columns[i];
+		if(column->count > index->len
+				|| !is_valid_section(index, column->dict_offsets, ((uint64_t) column->count + 1) * sizeof(uint64_t))
+				|| !is_valid_section(index, column->codes, header->rows * sizeof(uint32_t))
+				|| !is_valid_section(index, column->dict_heap,
+						((const uint64_t *) (index->base + column->dict_offsets))[column->count])
+				|| !is_valid_heap(index, column->dict_offsets, column->count, column->dict_heap)
+				|| !is_valid_codes(index, column)) {
+			goto invalid;
+		}
+	}
+
+	return 0;
+
+invalid:
+	fprintf(stderr, "Index file %s is corrupted or of unsupported version\n", name);
+	close_column_index(index);
+	return 1;
+}
+
+
+void close_column_index(id3v2_column_index_t *index) {
+	if(index->base) {
+		munmap((void *) index->base, index->len);
+	}
+	memset(index, 0, sizeof(*index));
+}
+
+
+const id3v2_column_entry_t *find_column(const id3v2_column_index_t *index, const char *id) {
+	uint32_t i;
+
+	for(i = 0; i < index->header->columns; i++) {
+		if(memcmp(index->columns[i].id, id, 4) == 0) {
+			return &index->columns[i];
+		}
+	}
+	return NULL;
+}
+
+
+uint32_t find_column_code(const id3v2_column_index_t *index, const id3v2_column_entry_t *column, const char *value) {
+	const uint64_t *offsets = (const uint64_t *) (index->base + column->dict_offsets);
+	const char *heap = (const char *) (index->base + column->dict_heap);
+	uint32_t low = 0;
+	uint32_t high = column->count;
+	uint32_t mid;
+	int cmp;
+
+	while(low < high) {
+		mid = low + (high - low) / 2;
+		cmp = strcmp(heap + offsets[mid], value);
+		if(cmp == 0) {
+			return mid + 1;
+		}
+		if(cmp < 0) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+	return COLUMN_CODE_NONE;
+}
+
+
+const char *get_column_path(const id3v2_column_index_t *index, uint64_t row) {
+	const uint64_t *offsets = (const uint64_t *) (index->base + index->header->path_offsets);
+
+	return (const char *) (index->base + index->header->path_heap + offsets[row]);
+}
+
+
+uint64_t get_column_size(const id3v2_column_index_t *index, uint64_t row) {
+	return ((const uint64_t *) (index->base + index->header->sizes))[row];
+}
+
+
+uint64_t get_column_tag_offset(const id3v2_column_index_t *index, uint64_t row) {
+	return ((const uint64_t *) (index->base + index->header->tag_offsets))[row];
+}
+
+
+const char *get_column_value(const id3v2_column_index_t *index, const id3v2_column_entry_t *column, uint32_t code) {
+	const uint64_t *offsets = (const uint64_t *) (index->base + column->dict_offsets);
+
+	if(code == COLUMN_CODE_NONE) {
+		return NULL;
+	}
+	return (const char *) (index->base + column->dict_heap + offsets[code - 1]);
+}
+
+
+const uint32_t *get_column_codes(const id3v2_column_index_t *index, const id3v2_column_entry_t *column) {
+	return (const uint32_t *) (index->base + column->codes);
+}
@@ -0,0 +1,222 @@
+/*
+ * id3v2column - columnar index of a library of ID3 tags
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ID3V2COLUMN_H_
+#define ID3V2COLUMN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Columnar index file layout
+
+   The index is a single file meant to be mapped into memory and scanned
+   in place. Integers are stored in byte order of the host which built
+   the index (a reader with other byte order sees wrong version and
+   rejects the file) and every section starts at an offset aligned to
+   8 bytes. A row corresponds to one file of the
+   library.
+
+     +---------------------------------------------+
+     | Index header (64 bytes)                     |
+     +---------------------------------------------+
+     | Column directory (32 bytes per text column) |
+     +---------------------------------------------+
+     | Path offsets      uint64 * (rows + 1)       |
+     | Path heap         NUL terminated strings    |
+     | File sizes        uint64 * rows             |
+     | Tag offsets       uint64 * rows             |
+     +---------------------------------------------+
+     | For every text column:                      |
+     |   Dictionary offsets  uint64 * (count + 1)  |
+     |   Dictionary heap     NUL terminated strings|
+     |   Codes               uint32 * rows         |
+     +---------------------------------------------+
+
+   Each text column holds values of one text information frame. Its
+   distinct values are stored once in a dictionary sorted by strcmp(),
+   so a value can be found by binary search. Code of the row is the
+   index of its value in the dictionary plus one, 0 means that the frame
+   is missing in the tag. Offsets stored in the file are absolute file
+   offsets, offsets of strings are relative to their heap.
+ */
+
+/** Magic bytes of the index file */
+#define COLUMN_INDEX_MAGIC "ID3CIDX"
+/** Version of the index file layout */
+#define COLUMN_INDEX_VERSION 1
+/** Code of the row with missing value */
+#define COLUMN_CODE_NONE 0
+
+
+/** Index file header */
+
+typedef struct id3v2_column_index_header_s {
+	char magic[8];				/**< COLUMN_INDEX_MAGIC */
+	uint32_t version;			/**< COLUMN_INDEX_VERSION */
+	uint32_t columns;			/**< number of text columns */
+	uint64_t rows;				/**< number of rows (files) */
+	uint64_t path_offsets;		/**< offset of path offsets */
+	uint64_t path_heap;			/**< offset of path heap */
+	uint64_t sizes;				/**< offset of file sizes */
+	uint64_t tag_offsets;		/**< offset of tag offsets */
+	uint64_t reserved;			/**< zero */
+} id3v2_column_index_header_t;
+
+/** Entry of the column directory */
+
+typedef struct id3v2_column_entry_s {
+	char id[4];					/**< frame ID code of the column */
+	uint32_t count;				/**< number of dictionary entries */
+	uint64_t dict_offsets;		/**< offset of dictionary offsets */
+	uint64_t dict_heap;			/**< offset of dictionary heap */
+	uint64_t codes;				/**< offset of codes */
+} id3v2_column_entry_t;
+
+
+/** Builder of the index (opaque) */
+typedef struct id3v2_column_builder_s id3v2_column_builder_t;
+
+/** Memory mapped index */
+
+typedef struct id3v2_column_index_s {
+	const unsigned char *base;				/**< mapped file */
+	size_t len;								/**< length of the mapped file */
+	const id3v2_column_index_header_t *header;	/**< index header */
+	const id3v2_column_entry_t *columns;	/**< column directory */
+} id3v2_column_index_t;
+
+
+/**
+ * Create builder of the columnar index for text frames given by IDs
+ * @param ids			NULL terminated array of four-char frame ID codes
+ * @return				builder or NULL if problem has occurred
+ */
+id3v2_column_builder_t *create_column_builder(const char * const *ids);
+
+/**
+ * Add row (file) into the index
+ * @param builder		index builder
+ * @param path			path of the file
+ * @param size			size of the file
+ * @param tag_offset	offset of ID3 tag in the file
+ * @param texts			texts of the frames, in order of IDs given to builder (NULL if missing)
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int add_column_row(id3v2_column_builder_t *builder, const char *path, uint64_t size, uint64_t tag_offset,
+		const char * const *texts);
+
+/**
+ * Write the index into file and free the builder
+ * @param builder		index builder
+ * @param name			filename of the index
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int write_column_index(id3v2_column_builder_t *builder, const char *name);
+
+/**
+ * Free the builder without writing the index
+ * @param builder		index builder
+ */
+void free_column_builder(id3v2_column_builder_t *builder);
+
+/**
+ * Map the index file into memory and validate its layout
+ * @param name			filename of the index
+ * @param index			pointer to the index structure to fill in
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int open_column_index(const char *name, id3v2_column_index_t *index);
+
+/**
+ * Unmap the index file
+ * @param index			pointer to the index structure
+ */
+void close_column_index(id3v2_column_index_t *index);
+
+/**
+ * Find column of the frame ID
+ * @param index			pointer to the index structure
+ * @param id			four-char frame ID code
+ * @return				column or NULL if there is no such column
+ */
+const id3v2_column_entry_t *find_column(const id3v2_column_index_t *index, const char *id);
+
+/**
+ * Find code of the value in the column dictionary by binary search
+ * @param index			pointer to the index structure
+ * @param column		column of the index
+ * @param value			value to find
+ * @return				code of the value or COLUMN_CODE_NONE if it is not in the dictionary
+ */
+uint32_t find_column_code(const id3v2_column_index_t *index, const id3v2_column_entry_t *column, const char *value);
+
+/**
+ * Get path of the row
+ * @param index			pointer to the index structure
+ * @param row			row number
+ * @return				path of the file
+ */
+const char *get_column_path(const id3v2_column_index_t *index, uint64_t row);
+
+/**
+ * Get size of the file of the row
+ * @param index			pointer to the index structure
+ * @param row			row number
+ * @return				size of the file
+ */
+uint64_t get_column_size(const id3v2_column_index_t *index, uint64_t row);
+
+/**
+ * Get offset of ID3 tag in the file of the row
+ * @param index			pointer to the index structure
+ * @param row			row number
+ * @return				offset of ID3 tag
+ */
+uint64_t get_column_tag_offset(const id3v2_column_index_t *index, uint64_t row);
+
+/**
+ * Get value of the code from the column dictionary
+ * @param index			pointer to the index structure
+ * @param column		column of the index
+ * @param code			code of the value
+ * @return				value or NULL if the code is COLUMN_CODE_NONE
+ */
+const char *get_column_value(const id3v2_column_index_t *index, const id3v2_column_entry_t *column, uint32_t code);
+
+/**
+ * Get codes of the column, one per row
+ * @param index			pointer to the index structure
+ * @param column		column of the index
+ * @return				array of codes
+ */
+const uint32_t *get_column_codes(const id3v2_column_index_t *index, const id3v2_column_entry_t *column);
+
+
+#endif /* ID3V2COLUMN_H_ */
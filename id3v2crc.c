@@ -0,0 +1,193 @@
+/*
+ *  id3v2crc - CRC-32 used by ID3v2 extended header
+ *
+ * 	Computes CRC-32 of the tag data for verification of the extended header.
+ * 	On x86 CPUs with PCLMULQDQ the data are folded by carry-less multiplication
+ * 	(as described in Intel's paper 'Fast CRC Computation for Generic Polynomials
+ * 	Using PCLMULQDQ Instruction'), otherwise table driven crc32() of zlib is used.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <zlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_CRC_FOLD 1
+#endif
+
+#include "id3v2crc.h"
+
+
+#ifdef HAVE_CRC_FOLD
+/**
+ * Fold blocks of 16 bytes by carry-less multiplication and Barrett reduce
+ * the result, constants are the bit-reflected ones from Intel's paper
+ * @param buffer		data to process
+ * @param len			length of the data, at least 64 and multiple of 16
+ * @param crc			inverted CRC of the previous data
+ * @return				inverted CRC-32
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold(const unsigned char *buffer, size_t len, uint32_t crc) {
+	static const uint64_t __attribute__((aligned(16))) k1k2[] = {0x0154442bd4, 0x01c6e41596};
+	static const uint64_t __attribute__((aligned(16))) k3k4[] = {0x01751997d0, 0x00ccaa009e};
+	static const uint64_t __attribute__((aligned(16))) k5k0[] = {0x0163cd6124, 0x0000000000};
+	static const uint64_t __attribute__((aligned(16))) poly[] = {0x01db710641, 0x01f7011641};
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i *) (buffer + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *) (buffer + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *) (buffer + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *) (buffer + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *) k1k2);
+	buffer += 64;
+	len -= 64;
+
+	/* Fold four blocks of 16 bytes in parallel */
+	while(len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i *) (buffer + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *) (buffer + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *) (buffer + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *) (buffer + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		buffer += 64;
+		len -= 64;
+	}
+
+	/* Fold the four blocks into one */
+	x0 = _mm_load_si128((const __m128i *) k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* Fold remaining blocks of 16 bytes one by one */
+	while(len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *) buffer);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		buffer += 16;
+		len -= 16;
+	}
+
+	/* Fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *) k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *) poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+
+
+/**
+ * Check once whether the CPU supports carry-less multiplication
+ * @return				1 if supported, 0 otherwise
+ */
+static int has_crc_fold(void) {
+	static int supported = -1;
+
+	if(supported < 0) {
+		__builtin_cpu_init();
+		supported = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+	}
+	return supported;
+}
+#endif
+
+
+uint32_t crc32_update(uint32_t crc, const unsigned char *buffer, size_t len) {
+#ifdef HAVE_CRC_FOLD
+	size_t fold_len;
+
+	if(len >= CRC_FOLD_MIN_LEN && has_crc_fold()) {
+		fold_len = len & ~(size_t) 15;
+		crc = ~crc32_fold(buffer, fold_len, ~crc);
+		buffer += fold_len;
+		len -= fold_len;
+	}
+#endif
+
+	/* zlib takes length as unsigned int, feed it in pieces */
+	while(len > 0) {
+		unsigned int piece = len > 0x40000000 ? 0x40000000 : (unsigned int) len;
+
+		crc = crc32(crc, buffer, piece);
+		buffer += piece;
+		len -= piece;
+	}
+
+	return crc;
+}
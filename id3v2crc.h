@@ -0,0 +1,59 @@
+/*
+ * id3v2crc - CRC-32 used by ID3v2 extended header
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ID3V2CRC_H_
+#define ID3V2CRC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** CRC-32 of the extended header is the ISO-3309 one, i.e. the same as
+   zlib and PNG use (reflected polynomial $EDB88320). It is computed by
+   folding 64 byte blocks with carry-less multiplication (PCLMULQDQ) when
+   the CPU supports it, the rest is handled by the table driven crc32()
+   of zlib. Note that the SSE4.2 'crc32' instruction cannot be used, it
+   implements the Castagnoli polynomial.
+ */
+
+/** Shortest buffer worth folding with carry-less multiplication */
+#define CRC_FOLD_MIN_LEN 64
+
+
+/**
+ * Update CRC-32 with the data of the buffer
+ * @param crc			CRC of the previous data (0 at the beginning)
+ * @param buffer		data to process
+ * @param len			length of the data
+ * @return				updated CRC-32
+ */
+uint32_t crc32_update(uint32_t crc, const unsigned char *buffer, size_t len);
+
+
+#endif /* ID3V2CRC_H_ */
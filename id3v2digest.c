@@ -0,0 +1,501 @@
+/*
+ *  id3v2digest - fingerprints of ID3 frames
+ *
+ * 	Digests of raw frame bodies and whole tags, which allow to find changed
+ * 	tags and frames without decoding them, and digest files holding them
+ * 	for a library. See id3v2digest.h for the details.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "id3v2parser.h"
+#include "id3v2digest.h"
+
+/** Length of the frame record hashed into the tag digest (ID, instance, frame digest) */
+#define FRAME_RECORD_LEN (4 + 4 + DIGEST_LEN)
+/** Largest number of frames of a digest, every frame of the stacked tags takes at least HEADER_LEN bytes */
+#define MAX_DIGEST_FRAMES (MAX_STACKED_TAGS * (0x0FFFFFFF / HEADER_LEN))
+
+/** Number of frames seen with one frame ID, slot of open addressing table */
+typedef struct id3v2_instance_count_s {
+	uint32_t id;			/**< frame ID as a number */
+	uint32_t count;			/**< number of frames, 0 if the slot is empty */
+} id3v2_instance_count_t;
+
+/** Constants of MurmurHash3 x64 128 */
+#define MURMUR_C1 0x87c37b91114253d5ULL
+#define MURMUR_C2 0x4cf5ad432745937fULL
+
+
+/**
+ * Rotate 64-bit number to the left
+ * @param x				number
+ * @param r				number of bits (1 to 63)
+ * @return				rotated number
+ */
+static uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * Final mix of MurmurHash3 forcing all bits of the hash to avalanche
+ * @param k				hash block
+ * @return				mixed block
+ */
+static uint64_t fmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+/**
+ * Read little endian 64-bit number
+ * @param p				buffer of at least 8 bytes
+ * @return				number
+ */
+static uint64_t get_le64(const unsigned char *p) {
+	uint64_t value = 0;
+	int i;
+
+	for(i = 7; i >= 0; i--) {
+		value = (value << 8) | p[i];
+	}
+	return value;
+}
+
+/**
+ * Write little endian 64-bit number
+ * @param p				buffer of at least 8 bytes
+ * @param value			number
+ */
+static void put_le64(unsigned char *p, uint64_t value) {
+	int i;
+
+	for(i = 0; i < 8; i++) {
+		p[i] = (unsigned char) (value >> (8 * i));
+	}
+}
+
+
+void hash_id3v2_data(const void *data, size_t len, uint32_t seed, uint8_t *hash) {
+	const unsigned char *p = data;
+	const unsigned char *tail;
+	uint64_t h1 = seed;
+	uint64_t h2 = seed;
+	uint64_t k1;
+	uint64_t k2;
+	size_t i;
+
+	/* Body is processed in blocks of 16 bytes */
+	for(i = 0; i + 16 <= len; i += 16) {
+		k1 = get_le64(p + i);
+		k2 = get_le64(p + i + 8);
+
+		k1 *= MURMUR_C1;
+		k1 = rotl64(k1, 31);
+		k1 *= MURMUR_C2;
+		h1 ^= k1;
+		h1 = rotl64(h1, 27);
+		h1 += h2;
+		h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= MURMUR_C2;
+		k2 = rotl64(k2, 33);
+		k2 *= MURMUR_C1;
+		h2 ^= k2;
+		h2 = rotl64(h2, 31);
+		h2 += h1;
+		h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	/* Tail of up to 15 bytes, bytes 8 to 14 go to the second block */
+	tail = p + i;
+	k1 = 0;
+	k2 = 0;
+	for(i = len & 15; i > 8; i--) {
+		k2 |= (uint64_t) tail[i - 1] << (8 * (i - 9));
+	}
+	if((len & 15) > 8) {
+		k2 *= MURMUR_C2;
+		k2 = rotl64(k2, 33);
+		k2 *= MURMUR_C1;
+		h2 ^= k2;
+	}
+	for(i = (len & 15) > 8 ? 8 : len & 15; i > 0; i--) {
+		k1 |= (uint64_t) tail[i - 1] << (8 * (i - 1));
+	}
+	if(len & 15) {
+		k1 *= MURMUR_C1;
+		k1 = rotl64(k1, 31);
+		k1 *= MURMUR_C2;
+		h1 ^= k1;
+	}
+
+	/* Finalization */
+	h1 ^= len;
+	h2 ^= len;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+
+	put_le64(hash, h1);
+	put_le64(hash + 8, h2);
+}
+
+
+void init_id3v2_digest(id3v2_digest_t *digest) {
+	memset(digest, 0, sizeof(*digest));
+}
+
+
+void free_id3v2_digest(id3v2_digest_t *digest) {
+	free_id3v2_memory(digest->frames);
+	free_id3v2_memory(digest->counts);
+	init_id3v2_digest(digest);
+}
+
+
+/**
+ * Make room for the frames of the digest
+ * @param digest		pointer to the digest
+ * @param len			required number of frames
+ * @return				0 if OK, 1 if there is not enough memory
+ */
+static int reserve_frames(id3v2_digest_t *digest, uint32_t len) {
+	id3v2_frame_digest_t *frames;
+	size_t capacity;
+
+	if(len <= digest->capacity) {
+		return 0;
+	}
+	if(len > MAX_DIGEST_FRAMES) {
+		return 1;
+	}
+	capacity = digest->capacity ? digest->capacity : 16;
+	while(capacity < len) {
+		capacity *= 2;
+	}
+	if(capacity > MAX_DIGEST_FRAMES) {
+		capacity = MAX_DIGEST_FRAMES;
+	}
+	if(capacity > SIZE_MAX / sizeof(id3v2_frame_digest_t)) {
+		return 1;
+	}
+	frames = realloc_id3v2_memory(digest->frames, capacity * sizeof(id3v2_frame_digest_t));
+	if(frames == NULL) {
+		return 1;
+	}
+	digest->frames = frames;
+	digest->capacity = capacity;
+
+	return 0;
+}
+
+
+/**
+ * Count the frame with the ID, the table of counts grows to be at most half full
+ * @param digest		pointer to the digest
+ * @param id			four-char frame ID code
+ * @param p_instance	pointer to the number of preceding frames with the ID
+ * @return				0 if OK, 1 if there is not enough memory
+ */
+static int count_instance(id3v2_digest_t *digest, const char *id, uint32_t *p_instance) {
+	id3v2_instance_count_t *counts;
+	uint32_t capacity;
+	uint32_t key;
+	uint32_t slot;
+	uint32_t i;
+
+	/* Table is rehashed into twice as many slots */
+	if(2 * (digest->counts_len + 1) > digest->counts_capacity) {
+		capacity = digest->counts_capacity ? 2 * digest->counts_capacity : 64;
+		counts = alloc_id3v2_memory(capacity * sizeof(id3v2_instance_count_t));
+		if(counts == NULL) {
+			return 1;
+		}
+		memset(counts, 0, capacity * sizeof(id3v2_instance_count_t));
+		for(i = 0; i < digest->counts_capacity; i++) {
+			if(digest->counts[i].count == 0) {
+				continue;
+			}
+			slot = (digest->counts[i].id * 0x9E3779B1U) & (capacity - 1);
+			while(counts[slot].count) {
+				slot = (slot + 1) & (capacity - 1);
+			}
+			counts[slot] = digest->counts[i];
+		}
+		free_id3v2_memory(digest->counts);
+		digest->counts = counts;
+		digest->counts_capacity = capacity;
+	}
+
+	memcpy(&key, id, 4);
+	slot = (key * 0x9E3779B1U) & (digest->counts_capacity - 1);
+	while(digest->counts[slot].count && digest->counts[slot].id != key) {
+		slot = (slot + 1) & (digest->counts_capacity - 1);
+	}
+	if(digest->counts[slot].count == 0) {
+		digest->counts[slot].id = key;
+		digest->counts_len++;
+	}
+	*p_instance = digest->counts[slot].count++;
+
+	return 0;
+}
+
+
+int add_id3v2_frame_digest(id3v2_digest_t *digest, const char *id, const unsigned char *body, uint32_t len) {
+	id3v2_frame_digest_t *frame;
+
+	/* Counts of the previous tag are dropped with its frames */
+	if(digest->len == 0 && digest->counts_len > 0) {
+		memset(digest->counts, 0, digest->counts_capacity * sizeof(id3v2_instance_count_t));
+		digest->counts_len = 0;
+	}
+	if(reserve_frames(digest, digest->len + 1) != 0) {
+		return 1;
+	}
+	frame = &digest->frames[digest->len];
+	memcpy(frame->id, id, 4);
+	frame->id[4] = '\0';
+
+	/* Instance is the number of preceding frames with the same ID */
+	if(count_instance(digest, frame->id, &frame->instance) != 0) {
+		return 1;
+	}
+	hash_id3v2_data(body, len, 0, frame->hash);
+	digest->len++;
+
+	return 0;
+}
+
+
+int finish_id3v2_digest(id3v2_digest_t *digest) {
+	unsigned char *records;
+	unsigned char *p;
+	uint32_t i;
+
+	records = malloc(digest->len ? digest->len * FRAME_RECORD_LEN : 1);
+	if(records == NULL) {
+		return 1;
+	}
+	for(i = 0, p = records; i < digest->len; i++, p += FRAME_RECORD_LEN) {
+		memcpy(p, digest->frames[i].id, 4);
+		p[4] = (unsigned char) digest->frames[i].instance;
+		p[5] = (unsigned char) (digest->frames[i].instance >> 8);
+		p[6] = (unsigned char) (digest->frames[i].instance >> 16);
+		p[7] = (unsigned char) (digest->frames[i].instance >> 24);
+		memcpy(p + 8, digest->frames[i].hash, DIGEST_LEN);
+	}
+	hash_id3v2_data(records, (size_t) digest->len * FRAME_RECORD_LEN, 0, digest->hash);
+	free(records);
+
+	return 0;
+}
+
+
+/**
+ * Find digest of the frame with the same ID and instance
+ * @param digest		digest to search
+ * @param frame			frame to find
+ * @return				digest of the frame or NULL if there is none
+ */
+static const id3v2_frame_digest_t *find_frame(const id3v2_digest_t *digest, const id3v2_frame_digest_t *frame) {
+	uint32_t i;
+
+	for(i = 0; i < digest->len; i++) {
+		if(digest->frames[i].instance == frame->instance && memcmp(digest->frames[i].id, frame->id, 4) == 0) {
+			return &digest->frames[i];
+		}
+	}
+	return NULL;
+}
+
+
+uint32_t diff_id3v2_digest(const id3v2_digest_t *from, const id3v2_digest_t *to, id3v2_digest_diff_t diff, void *arg) {
+	const id3v2_frame_digest_t *frame;
+	uint32_t changes = 0;
+	uint32_t i;
+
+	/* Unchanged tag is recognised by one comparison */
+	if(memcmp(from->hash, to->hash, DIGEST_LEN) == 0) {
+		return 0;
+	}
+
+	for(i = 0; i < to->len; i++) {
+		frame = find_frame(from, &to->frames[i]);
+		if(frame == NULL || memcmp(frame->hash, to->frames[i].hash, DIGEST_LEN) != 0) {
+			if(diff) {
+				diff(arg, frame ? DIGEST_MODIFIED : DIGEST_ADDED, &to->frames[i]);
+			}
+			changes++;
+		}
+	}
+	for(i = 0; i < from->len; i++) {
+		if(find_frame(to, &from->frames[i]) == NULL) {
+			if(diff) {
+				diff(arg, DIGEST_REMOVED, &from->frames[i]);
+			}
+			changes++;
+		}
+	}
+
+	return changes;
+}
+
+
+/**
+ * Write digest as hexadecimal digits
+ * @param file			output file
+ * @param hash			digest of DIGEST_LEN bytes
+ */
+static void write_hash(FILE *file, const uint8_t *hash) {
+	int i;
+
+	for(i = 0; i < DIGEST_LEN; i++) {
+		fprintf(file, "%02x", hash[i]);
+	}
+}
+
+/**
+ * Parse digest written as hexadecimal digits
+ * @param text			text starting with the digest
+ * @param hash			output of DIGEST_LEN bytes
+ * @return				0 if OK, 1 if the text does not start with the digest
+ */
+static int parse_hash(const char *text, uint8_t *hash) {
+	int i;
+	int j;
+	int digit;
+
+	for(i = 0; i < DIGEST_LEN; i++) {
+		hash[i] = 0;
+		for(j = 0; j < 2; j++) {
+			digit = text[2 * i + j];
+			if(digit >= '0' && digit <= '9') {
+				digit -= '0';
+			}
+			else if(digit >= 'a' && digit <= 'f') {
+				digit -= 'a' - 10;
+			}
+			else {
+				return 1;
+			}
+			hash[i] = (hash[i] << 4) | digit;
+		}
+	}
+	return 0;
+}
+
+
+int write_id3v2_digest(FILE *file, const char *path, const id3v2_digest_t *digest) {
+	uint32_t i;
+
+	write_hash(file, digest->hash);
+	fprintf(file, "\t%u\t%s\n", digest->len, path);
+	for(i = 0; i < digest->len; i++) {
+		write_hash(file, digest->frames[i].hash);
+		fprintf(file, "\t%s\t%u\n", digest->frames[i].id, digest->frames[i].instance);
+	}
+
+	return ferror(file) != 0;
+}
+
+
+int read_id3v2_digest(FILE *file, char **p_path, id3v2_digest_t *digest) {
+	char *line = NULL;
+	size_t capacity = 0;
+	ssize_t len;
+	char *end;
+	unsigned long count;
+	unsigned long instance;
+	uint32_t i;
+
+	*p_path = NULL;
+	len = getline(&line, &capacity, file);
+	if(len < 0) {
+		free(line);
+		return 1;
+	}
+
+	/* File record: TAG_DIGEST '\t' FRAMES_COUNT '\t' PATH */
+	if(len > 0 && line[len - 1] == '\n') {
+		line[--len] = '\0';
+	}
+	if(len < 2 * DIGEST_LEN + 4 || parse_hash(line, digest->hash) != 0 || line[2 * DIGEST_LEN] != '\t') {
+		free(line);
+		return -1;
+	}
+	count = strtoul(line + 2 * DIGEST_LEN + 1, &end, 10);
+	if(end == line + 2 * DIGEST_LEN + 1 || *end != '\t' || count > MAX_DIGEST_FRAMES) {
+		free(line);
+		return -1;
+	}
+	*p_path = strdup(end + 1);
+
+	/* Frame records: FRAME_DIGEST '\t' ID '\t' INSTANCE, claimed count is reserved only as they are read */
+	digest->len = 0;
+	for(i = 0; i < count; i++) {
+		if(reserve_frames(digest, i + 1) != 0) {
+			break;
+		}
+		len = getline(&line, &capacity, file);
+		if(len < 2 * DIGEST_LEN + 8 || parse_hash(line, digest->frames[i].hash) != 0
+				|| line[2 * DIGEST_LEN] != '\t' || line[2 * DIGEST_LEN + 5] != '\t') {
+			break;
+		}
+		memcpy(digest->frames[i].id, line + 2 * DIGEST_LEN + 1, 4);
+		digest->frames[i].id[4] = '\0';
+		instance = strtoul(line + 2 * DIGEST_LEN + 6, &end, 10);
+		if(end == line + 2 * DIGEST_LEN + 6 || (*end != '\n' && *end != '\0') || instance > UINT32_MAX) {
+			break;
+		}
+		digest->frames[i].instance = instance;
+		digest->len++;
+	}
+	free(line);
+
+	if(*p_path == NULL || digest->len != count) {
+		free(*p_path);
+		*p_path = NULL;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * id3v2digest - fingerprints of ID3 frames
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ID3V2DIGEST_H_
+#define ID3V2DIGEST_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Tag digest
+
+   Every frame of the tag (and of stacked tags) gets a digest of its
+   raw body as stored in the tag, i.e. before decompression and removal
+   of unsynchronisation, together with its ID and instance index (the
+   number of preceding frames with the same ID). The digest of the whole
+   tag is computed from digests of the frames in their order, so header
+   flags and padding do not change it.
+
+   Digests are 128-bit MurmurHash3 (x64 variant) hashes, the texts of
+   the frames are never decoded. Tags of two files are equal if their
+   tag digests are, otherwise changed frames are found by comparing the
+   digests of the frames with the same ID and instance.
+
+   Digest file is a text file with one record per file:
+
+     TAG_DIGEST '\t' FRAMES_COUNT '\t' PATH '\n'
+     FRAME_DIGEST '\t' ID '\t' INSTANCE '\n'      (FRAMES_COUNT times)
+
+   where digests are written as 32 hexadecimal digits.
+ */
+
+/** Length of the digest in bytes */
+#define DIGEST_LEN 16
+
+/** Changes found by diff_id3v2_digest() */
+#define DIGEST_ADDED '+'
+#define DIGEST_REMOVED '-'
+#define DIGEST_MODIFIED 'M'
+
+
+/** Digest of one frame */
+
+typedef struct id3v2_frame_digest_s {
+	char id[5];				/**< frame ID code */
+	uint32_t instance;		/**< index of the frame among the frames with the same ID */
+	uint8_t hash[DIGEST_LEN];	/**< digest of the raw frame body */
+} id3v2_frame_digest_t;
+
+/** Digest of the tag */
+
+typedef struct id3v2_digest_s {
+	id3v2_frame_digest_t *frames;	/**< digests of the frames in order of the tag */
+	uint32_t len;			/**< number of frames, setting it to 0 starts a new tag */
+	uint32_t capacity;		/**< allocated length of frames */
+	uint8_t hash[DIGEST_LEN];	/**< digest of the whole tag */
+	struct id3v2_instance_count_s *counts;	/**< frames counted per ID (internal) */
+	uint32_t counts_capacity;	/**< number of slots of counts, power of two (internal) */
+	uint32_t counts_len;	/**< number of used slots of counts (internal) */
+} id3v2_digest_t;
+
+/**
+ * Report of one changed frame
+ * @param arg			argument given to diff_id3v2_digest()
+ * @param change		DIGEST_ADDED, DIGEST_REMOVED or DIGEST_MODIFIED
+ * @param frame			digest of the frame (of the new tag unless it is removed)
+ */
+typedef void (*id3v2_digest_diff_t)(void *arg, int change, const id3v2_frame_digest_t *frame);
+
+
+/**
+ * Compute 128-bit MurmurHash3 (x64 variant) of the data
+ * @param data			data to hash
+ * @param len			length of the data
+ * @param seed			seed of the hash
+ * @param hash			output of DIGEST_LEN bytes
+ */
+void hash_id3v2_data(const void *data, size_t len, uint32_t seed, uint8_t *hash);
+
+/**
+ * Initialize empty digest
+ * @param digest		pointer to the digest
+ */
+void init_id3v2_digest(id3v2_digest_t *digest);
+
+/**
+ * Free memory of the digest, it is initialized again
+ * @param digest		pointer to the digest
+ */
+void free_id3v2_digest(id3v2_digest_t *digest);
+
+/**
+ * Add digest of the next frame of the tag
+ * @param digest		pointer to the digest
+ * @param id			four-char frame ID code
+ * @param body			raw frame body
+ * @param len			length of the frame body
+ * @return				0 if OK, 1 if there is not enough memory
+ */
+int add_id3v2_frame_digest(id3v2_digest_t *digest, const char *id, const unsigned char *body, uint32_t len);
+
+/**
+ * Compute digest of the whole tag from digests of its frames
+ * @param digest		pointer to the digest
+ * @return				0 if OK, 1 if there is not enough memory
+ */
+int finish_id3v2_digest(id3v2_digest_t *digest);
+
+/**
+ * Report frames which differ between two digests
+ * @param from			digest of the old tag
+ * @param to			digest of the new tag
+ * @param diff			report of changed frames, NULL to count them only
+ * @param arg			argument passed to the report
+ * @return				number of changed frames, 0 if the tag digests are equal
+ */
+uint32_t diff_id3v2_digest(const id3v2_digest_t *from, const id3v2_digest_t *to, id3v2_digest_diff_t diff, void *arg);
+
+/**
+ * Write record of the file into digest file
+ * @param file			digest file
+ * @param path			path of the file (without new line)
+ * @param digest		digest of its tag
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int write_id3v2_digest(FILE *file, const char *path, const id3v2_digest_t *digest);
+
+/**
+ * Read next record from digest file
+ * @param file			digest file
+ * @param p_path		pointer set to the path of the file (allocated by malloc)
+ * @param digest		pointer to the initialized digest to fill in
+ * @return				0 if OK, 1 at the end of the file, -1 if the record is malformed
+ */
+int read_id3v2_digest(FILE *file, char **p_path, id3v2_digest_t *digest);
+
+
+#endif /* ID3V2DIGEST_H_ */
@@ -0,0 +1,288 @@
+/*
+ *  id3v2filter - filter expressions evaluated during parsing
+ *
+ * 	Compiles filter expressions over text frames, lyrics and pictures and
+ * 	evaluates them on partially parsed tags, so that files which do not
+ * 	match are not parsed further. See id3v2filter.h for the details.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "id3v2filter.h"
+
+
+/**
+ * Parse integer of the whole text
+ * @param text			text
+ * @param p_number		pointer to the number
+ * @return				1 if the text is an integer, 0 otherwise
+ */
+static int parse_integer(const char *text, long *p_number) {
+	char *end;
+
+	if(!isdigit((unsigned char) text[0]) && !(text[0] == '-' && isdigit((unsigned char) text[1]))) {
+		return 0;
+	}
+	errno = 0;
+	*p_number = strtol(text, &end, 10);
+	return *end == '\0' && errno == 0;
+}
+
+
+/**
+ * Compile one term of the expression
+ * @param text			term, terminated by '\0'
+ * @param term			pointer to the term to fill in
+ * @return				0 if OK, 1 if the term is malformed
+ */
+static int compile_term(const char *text, id3v2_filter_term_t *term) {
+	const char *value;
+	long number;
+	uint32_t i;
+
+	memset(term, 0, sizeof(*term));
+	if(strlen(text) < 4) {
+		return 1;
+	}
+	memcpy(term->id, text, 4);
+	value = text + 4;
+
+	if(*value == '\0') {
+		term->op = FILTER_OP_EXISTS;
+	}
+	else if(value[0] == '!' && value[1] == '=') {
+		term->op = FILTER_OP_NE;
+		value += 2;
+	}
+	else if(*value == '=' || *value == '<' || *value == '>') {
+		term->op = *value == '=' ? FILTER_OP_EQ : *value == '<' ? FILTER_OP_LT : FILTER_OP_GT;
+		value++;
+	}
+	else {
+		return 1;
+	}
+
+	if(strcmp(term->id, "APIC") == 0) {
+		/* Picture is selected by its type */
+		term->index = APIC_TYPE_COUNT;
+		if(term->op == FILTER_OP_EXISTS) {
+			return 0;
+		}
+		if(term->op != FILTER_OP_EQ) {
+			return 1;
+		}
+		if(parse_integer(value, &number)) {
+			term->index = number >= 0 && number < APIC_TYPE_COUNT ? (uint32_t) number : APIC_TYPE_COUNT + 1;
+		}
+		else {
+			for(i = 0; i < APIC_TYPE_COUNT && strcasecmp(get_id3v2_picture_type(i), value) != 0; i++);
+			term->index = i < APIC_TYPE_COUNT ? i : APIC_TYPE_COUNT + 1;
+		}
+		return term->index > APIC_TYPE_COUNT;
+	}
+	if(strcmp(term->id, "USLT") == 0) {
+		return term->op != FILTER_OP_EXISTS;
+	}
+
+	for(i = 0; i < TEXTINFO_COUNT && strcmp(get_id3v2_text_id(i), term->id) != 0; i++);
+	if(i == TEXTINFO_COUNT) {
+		return 1;
+	}
+	term->index = i;
+	if(term->op != FILTER_OP_EXISTS) {
+		term->numeric = parse_integer(value, &term->number);
+		term->value = strdup(value);
+		if(term->value == NULL) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+int compile_id3v2_filter(const char *expression, id3v2_filter_t *filter) {
+	char *copy;
+	char *text;
+	char *save;
+	uint32_t count = 1;
+	const char *p;
+
+	filter->terms = NULL;
+	filter->len = 0;
+	for(p = expression; *p; p++) {
+		count += *p == ',';
+	}
+
+	copy = strdup(expression);
+	filter->terms = calloc(count, sizeof(id3v2_filter_term_t));
+	if(copy == NULL || filter->terms == NULL) {
+		fprintf(stderr, "Error while allocating memory for filter!\n");
+		free(copy);
+		free(filter->terms);
+		filter->terms = NULL;
+		return 1;
+	}
+
+	for(text = strtok_r(copy, ",", &save); text; text = strtok_r(NULL, ",", &save)) {
+		if(compile_term(text, &filter->terms[filter->len]) != 0) {
+			fprintf(stderr, "Error - filter term '%s' is malformed\n", text);
+			free(filter->terms[filter->len].value);
+			free(copy);
+			free_id3v2_filter(filter);
+			return 1;
+		}
+		filter->len++;
+	}
+	free(copy);
+
+	if(filter->len == 0) {
+		fprintf(stderr, "Error - filter expression is empty\n");
+		free_id3v2_filter(filter);
+		return 1;
+	}
+	return 0;
+}
+
+
+void free_id3v2_filter(id3v2_filter_t *filter) {
+	uint32_t i;
+
+	for(i = 0; filter->terms && i < filter->len; i++) {
+		free(filter->terms[i].value);
+	}
+	free(filter->terms);
+	filter->terms = NULL;
+	filter->len = 0;
+}
+
+
+int uses_id3v2_frame(const id3v2_filter_t *filter, const char *id) {
+	uint32_t i;
+
+	for(i = 0; i < filter->len; i++) {
+		if(strcmp(filter->terms[i].id, id) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Evaluate one term of the filter
+ * @param term			pointer to the term
+ * @param tag			pointer to the parsed ID3 tag
+ * @param pictures		mask of attached picture types
+ * @param complete		1 if the whole tag has been parsed
+ * @return				FILTER_MATCH, FILTER_NO_MATCH or FILTER_UNKNOWN
+ */
+static int match_term(const id3v2_filter_term_t *term, const id3v2_tag_t *tag, uint32_t pictures, int complete) {
+	const char *text;
+	char *end;
+	long number;
+	int order;
+
+	if(strcmp(term->id, "APIC") == 0) {
+		if(term->index == APIC_TYPE_COUNT ? pictures != 0 : (pictures >> term->index) & 1) {
+			return FILTER_MATCH;
+		}
+		return complete ? FILTER_NO_MATCH : FILTER_UNKNOWN;
+	}
+	if(strcmp(term->id, "USLT") == 0) {
+		if(tag->lyrics.text) {
+			return FILTER_MATCH;
+		}
+		return complete ? FILTER_NO_MATCH : FILTER_UNKNOWN;
+	}
+
+	/* Text frame is final once it is decoded, later frames of the same kind are ignored */
+	text = tag->text[term->index];
+	if(text == NULL) {
+		return complete ? FILTER_NO_MATCH : FILTER_UNKNOWN;
+	}
+	if(term->op == FILTER_OP_EXISTS) {
+		return FILTER_MATCH;
+	}
+
+	if(term->numeric) {
+		number = strtol(text, &end, 10);
+		if(end == text) {
+			return FILTER_NO_MATCH;
+		}
+		order = (number > term->number) - (number < term->number);
+	}
+	else {
+		order = strcmp(text, term->value);
+	}
+
+	switch(term->op) {
+	case FILTER_OP_EQ:
+		return order == 0 ? FILTER_MATCH : FILTER_NO_MATCH;
+	case FILTER_OP_NE:
+		return order != 0 ? FILTER_MATCH : FILTER_NO_MATCH;
+	case FILTER_OP_LT:
+		return order < 0 ? FILTER_MATCH : FILTER_NO_MATCH;
+	default:
+		return order > 0 ? FILTER_MATCH : FILTER_NO_MATCH;
+	}
+}
+
+
+int match_id3v2_filter(const id3v2_filter_t *filter, const id3v2_tag_t *tag, uint32_t pictures, int complete) {
+	uint32_t i;
+	int result = FILTER_MATCH;
+
+	for(i = 0; i < APIC_TYPE_COUNT; i++) {
+		if(tag->pictures[i].data) {
+			pictures |= 1u << i;
+		}
+	}
+
+	/* Any failed term decides, unknown terms postpone the match */
+	for(i = 0; i < filter->len; i++) {
+		switch(match_term(&filter->terms[i], tag, pictures, complete)) {
+		case FILTER_NO_MATCH:
+			return FILTER_NO_MATCH;
+		case FILTER_UNKNOWN:
+			result = FILTER_UNKNOWN;
+			break;
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,128 @@
+/*
+ * id3v2filter - filter expressions evaluated during parsing
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ID3V2FILTER_H_
+#define ID3V2FILTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "id3v2parser.h"
+
+/** Filter expression
+
+   Expression is a list of terms separated by ',', the file matches if
+   all of the terms match:
+
+     ID            frame is present (text frame, USLT or APIC)
+     ID=TEXT       text frame is equal to TEXT
+     ID!=TEXT      text frame is present and it is not equal to TEXT
+     ID<TEXT       text frame is present and it is less than TEXT
+     ID>TEXT       text frame is present and it is greater than TEXT
+     APIC=TYPE     picture of the type is attached, TYPE is its number
+                   or description (e.g. 'APIC=cover front')
+
+   If TEXT is an integer, the leading integer of the frame text is
+   compared instead of the whole text, so 'TDRC<2000' compares years
+   and 'TRCK>10' track numbers (frames without leading integer do not
+   match). Absent frame does not match any term.
+
+   The expression is compiled once. During parsing the terms are
+   evaluated whenever a frame they refer to is decoded, the result is
+   known as soon as one term fails or all of them match. The first
+   frame of each kind wins, so a decoded frame decides its terms.
+ */
+
+/** Operators of filter terms */
+#define FILTER_OP_EXISTS 0
+#define FILTER_OP_EQ 1
+#define FILTER_OP_NE 2
+#define FILTER_OP_LT 3
+#define FILTER_OP_GT 4
+
+/** Result of filter evaluation */
+#define FILTER_NO_MATCH 0
+#define FILTER_MATCH 1
+#define FILTER_UNKNOWN 2
+
+
+/** One term of the filter */
+
+typedef struct id3v2_filter_term_s {
+	char id[5];				/**< frame ID code */
+	uint8_t op;				/**< FILTER_OP_* operator */
+	uint32_t index;			/**< index of the text in id3v2_tag_t, picture type (APIC_TYPE_COUNT for any) */
+	char *value;			/**< compared text, NULL for FILTER_OP_EXISTS and APIC */
+	long number;			/**< compared number if numeric is set */
+	uint8_t numeric;		/**< 1 if the leading integer of the frame text is compared */
+} id3v2_filter_term_t;
+
+/** Compiled filter */
+
+typedef struct id3v2_filter_s {
+	id3v2_filter_term_t *terms;	/**< terms, all of them must match */
+	uint32_t len;			/**< number of terms */
+} id3v2_filter_t;
+
+
+/**
+ * Compile filter expression
+ * @param expression	filter expression (e.g. 'TCON=Podcast,TDRC<2000')
+ * @param filter		pointer to the filter to fill in
+ * @return				0 if OK, 1 if the expression is malformed
+ */
+int compile_id3v2_filter(const char *expression, id3v2_filter_t *filter);
+
+/**
+ * Free memory of the compiled filter
+ * @param filter		pointer to the filter
+ */
+void free_id3v2_filter(id3v2_filter_t *filter);
+
+/**
+ * Check whether the filter refers to the frame
+ * @param filter		pointer to the filter
+ * @param id			four-char frame ID code
+ * @return				1 if the frame is referred to, 0 otherwise
+ */
+int uses_id3v2_frame(const id3v2_filter_t *filter, const char *id);
+
+/**
+ * Evaluate the filter on (partially) parsed tag
+ * @param filter		pointer to the filter
+ * @param tag			pointer to the parsed ID3 tag
+ * @param pictures		mask of attached picture types (bit per type) in addition to the pictures of the tag
+ * @param complete		1 if the whole tag has been parsed, absent frames then fail their terms
+ * @return				FILTER_MATCH, FILTER_NO_MATCH or FILTER_UNKNOWN (only if not complete)
+ */
+int match_id3v2_filter(const id3v2_filter_t *filter, const id3v2_tag_t *tag, uint32_t pictures, int complete);
+
+
+#endif /* ID3V2FILTER_H_ */
@@ -0,0 +1,173 @@
+/*
+ *  id3v2order - physical layout aware ordering of batch scans
+ *
+ * 	Orders files of the batch by physical location of their tags, so that
+ * 	tags on rotational devices are read in sweeps instead of random seeks.
+ * 	See id3v2order.h for the details.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+
+#include "id3v2order.h"
+
+
+/** Sort key of the file */
+typedef struct order_key_s {
+	dev_t dev;				/**< device of the file */
+	uint64_t offset;		/**< physical offset of the first extent */
+	size_t index;			/**< original position, keeps the sort stable */
+	char *path;				/**< path of the file */
+} order_key_t;
+
+
+int get_physical_offset(int fd, uint64_t *p_offset) {
+	union {
+		struct fiemap map;
+		unsigned char bytes[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+	} fiemap;
+	struct stat st;
+	int block = 0;
+
+	*p_offset = PHYSICAL_OFFSET_UNKNOWN;
+
+	/* Only mapping of the first byte is needed, extents are not synced */
+	memset(&fiemap, 0, sizeof(fiemap));
+	fiemap.map.fm_start = 0;
+	fiemap.map.fm_length = 1;
+	fiemap.map.fm_extent_count = 1;
+	if(ioctl(fd, FS_IOC_FIEMAP, &fiemap.map) == 0) {
+		if(fiemap.map.fm_mapped_extents == 0
+				|| (fiemap.map.fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE))) {
+			return 1;
+		}
+		*p_offset = fiemap.map.fm_extents[0].fe_physical;
+		return 0;
+	}
+
+	/* Older interface maps one logical block */
+	if(fstat(fd, &st) == 0 && ioctl(fd, FIBMAP, &block) == 0 && block > 0) {
+		*p_offset = (uint64_t) block * st.st_blksize;
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/**
+ * Compare two files by device, physical offset and original position
+ * @param a				pointer to the first key
+ * @param b				pointer to the second key
+ * @return				negative, zero or positive value
+ */
+static int compare_keys(const void *a, const void *b) {
+	const order_key_t *x = a;
+	const order_key_t *y = b;
+
+	if(x->offset == PHYSICAL_OFFSET_UNKNOWN || y->offset == PHYSICAL_OFFSET_UNKNOWN) {
+		if(x->offset != y->offset) {
+			return x->offset == PHYSICAL_OFFSET_UNKNOWN ? 1 : -1;
+		}
+	}
+	else if(x->dev != y->dev) {
+		return x->dev < y->dev ? -1 : 1;
+	}
+	else if(x->offset != y->offset) {
+		return x->offset < y->offset ? -1 : 1;
+	}
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+
+int order_by_physical_offset(char **files, size_t len) {
+	order_key_t *keys;
+	struct stat st;
+	size_t known = 0;
+	size_t i;
+	int fd;
+
+	keys = malloc((len ? len : 1) * sizeof(order_key_t));
+	if(keys == NULL) {
+		fprintf(stderr, "Error while allocating memory for file order!\n");
+		return 1;
+	}
+
+	for(i = 0; i < len; i++) {
+		keys[i].dev = 0;
+		keys[i].offset = PHYSICAL_OFFSET_UNKNOWN;
+		keys[i].index = i;
+		keys[i].path = files[i];
+
+		/* Unreadable file is reported when it is processed */
+		fd = open(files[i], O_RDONLY | O_CLOEXEC);
+		if(fd < 0) {
+			continue;
+		}
+		if(fstat(fd, &st) == 0 && get_physical_offset(fd, &keys[i].offset) == 0) {
+			keys[i].dev = st.st_dev;
+			known++;
+		}
+		close(fd);
+	}
+
+	qsort(keys, len, sizeof(order_key_t), compare_keys);
+	for(i = 0; i < len; i++) {
+		files[i] = keys[i].path;
+	}
+	free(keys);
+
+	if(known < len) {
+		fprintf(stderr, "Physical offset of %lu of %lu files is not known, they are processed last\n",
+				(unsigned long) (len - known), (unsigned long) len);
+	}
+
+	return 0;
+}
+
+
+void advise_tag_prefetch(const char *name) {
+	int fd = open(name, O_RDONLY | O_CLOEXEC);
+
+	/* Readahead started by the hint continues after the file is closed */
+	if(fd >= 0) {
+		posix_fadvise(fd, 0, TAG_PREFETCH_LEN, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+}
@@ -0,0 +1,84 @@
+/*
+ * id3v2order - physical layout aware ordering of batch scans
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ID3V2ORDER_H_
+#define ID3V2ORDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Physical ordering
+
+   ID3v2 tag is stored at the beginning of the file, so the first
+   physical extent of the file tells where on the device its tag lies.
+   The extent is taken from the FIEMAP ioctl, or from FIBMAP of the
+   first block on file systems without FIEMAP (FIBMAP requires
+   CAP_SYS_RAWIO). Files are sorted by device and by the offset of the
+   extent, files with unknown extent keep their order at the end of the
+   list. Reading tags in this order turns random seeks into sweeps over
+   the device.
+
+   The kernel is told in advance (POSIX_FADV_WILLNEED) which tag ranges
+   will be read, so that it can queue and merge the reads of the next
+   files while the current one is being parsed.
+ */
+
+/** Offset of the file with unknown physical extent */
+#define PHYSICAL_OFFSET_UNKNOWN UINT64_MAX
+/** Length of the file prefix announced by advise_tag_prefetch() */
+#define TAG_PREFETCH_LEN (64 * 1024)
+/** Number of files announced ahead of the parsed file */
+#define TAG_PREFETCH_DEPTH 16
+
+
+/**
+ * Get physical offset of the first extent of the file
+ * @param fd			file descriptor of the opened file
+ * @param p_offset		pointer to the offset in bytes, PHYSICAL_OFFSET_UNKNOWN if it is not known
+ * @return				0 if OK, 1 if the offset is not known
+ */
+int get_physical_offset(int fd, uint64_t *p_offset);
+
+/**
+ * Sort files by device and physical offset of their first extent
+ * @param files			array of paths, it is sorted in place
+ * @param len			number of paths
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int order_by_physical_offset(char **files, size_t len);
+
+/**
+ * Announce to the kernel that the tag of the file will be read soon
+ * @param name			filename
+ */
+void advise_tag_prefetch(const char *name);
+
+
+#endif /* ID3V2ORDER_H_ */
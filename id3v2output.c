@@ -0,0 +1,269 @@
+/*
+ *  id3v2output - output files of parsed ID3 tags
+ *
+ * 	Writes parsed text frames, lyrics and pictures of the tag next to the
+ * 	original file and removes them again. Used by the command line program,
+ * 	it is not part of the library.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "id3v2parser.h"
+#include "id3v2output.h"
+#include "id3v2picture.h"
+
+
+/**
+ * Write tag text on one line, new lines, tabs and backslashes are escaped
+ * so the text cannot forge lines of the file (remove_parsed_data() reads them)
+ * @param p_file		output file
+ * @param text			tag text
+ */
+static void write_escaped(FILE *p_file, const char *text) {
+	for(; *text; text++) {
+		switch(*text) {
+		case '\n':
+			fputs("\\n", p_file);
+			break;
+		case '\r':
+			fputs("\\r", p_file);
+			break;
+		case '\t':
+			fputs("\\t", p_file);
+			break;
+		case '\\':
+			fputs("\\\\", p_file);
+			break;
+		default:
+			fputc(*text, p_file);
+			break;
+		}
+	}
+}
+
+
+/**
+ * Check that the mime subtype can be used as file extension, it is taken from the tag
+ * @param extension		mime subtype
+ * @return				1 if it is 1 to 8 letters or digits, 0 otherwise
+ */
+static int is_safe_extension(const char *extension) {
+	size_t i;
+
+	for(i = 0; extension[i]; i++) {
+		if(i == 8 || !((extension[i] >= 'a' && extension[i] <= 'z') || (extension[i] >= 'A' && extension[i] <= 'Z')
+				|| (extension[i] >= '0' && extension[i] <= '9'))) {
+			return 0;
+		}
+	}
+	return i > 0;
+}
+
+
+int write_parsed_data(id3v2_tag_t *tag, char * orig_name) {
+	uint32_t i;
+	uint32_t j;
+	uint16_t len;
+	FILE *p_file;
+	FILE *p_file_image;
+	char *filename;
+	char *filename_image;
+	const char *extension;
+	id3v2_picture_info_t info;
+	int result = 0;
+
+	/* Write textual information from ID3 tag */
+	len = strlen(orig_name) + strlen(".tag.txt") + 1;
+	filename = malloc(len);
+	snprintf(filename, len, "%s%s", orig_name, ".tag.txt");
+
+	p_file = fopen(filename, "wb");
+	if(p_file == NULL) {
+		fprintf(stderr, "Error while opening file %s to write!\n", filename);
+		free(filename);
+		return 1;
+	}
+
+	fprintf(p_file, "Textual information parsed from file %s:\n", orig_name);
+	if(ferror (p_file)) {
+		fprintf(stderr, "Error while writing into file %s!\n", filename);
+		fclose(p_file);
+		free(filename);
+		return 1;
+	}
+	for(i = 0; i < TEXTINFO_COUNT; i++) {
+		if(tag->text[i]){
+			fprintf(p_file, "\t%s ", get_id3v2_text_info(i));
+			write_escaped(p_file, tag->text[i]);
+			fputc('\n', p_file);
+			if(ferror (p_file)) {
+				fprintf(stderr, "Error while writing into file %s!\n", filename);
+				fclose(p_file);
+				return 1;
+			}
+		}
+	}
+
+	for(i = 0; i < APIC_TYPE_COUNT; i++) {
+		/* Write picture information from ID3 tag */
+		if(tag->pictures[i].data){
+			/* Extension is taken from the picture itself, mime type of the frame is often wrong */
+			probe_id3v2_picture(tag->pictures[i].data, tag->pictures[i].len, tag->pictures[i].flags & FLAG_FR_UNSYNC, &info);
+			if(info.extension) {
+				extension = info.extension;
+			}
+			else if(tag->pictures[i].mime && strchr(tag->pictures[i].mime, '/')
+					&& is_safe_extension(strchr(tag->pictures[i].mime, '/') + 1)) {
+				extension = strchr(tag->pictures[i].mime, '/') + 1;
+			}
+			else {
+				extension = "bin";
+			}
+
+			len = strlen(orig_name) + strlen(get_id3v2_picture_type(i)) + strlen(extension) + 3;
+			filename_image = malloc(len);
+			snprintf(filename_image, len, "%s.%s.%s", orig_name, get_id3v2_picture_type(i), extension);
+
+			p_file_image = filename_image ? fopen(filename_image, "wb") : NULL;
+			if(p_file_image == NULL) {
+				fprintf(stderr, "Error while opening file %s to write!\n", filename_image ? filename_image : orig_name);
+				free(filename_image);
+				result = 1;
+				continue;
+			}
+			unsigned char *p_data = tag->pictures[i].data;
+			for(j = 0; j < tag->pictures[i].len; j++) {
+				fwrite(p_data+j, 1 , 1, p_file_image);
+				if(tag->pictures[i].flags & FLAG_FR_UNSYNC) { // if unsynchronization occurs
+					if(j + 1 < tag->pictures[i].len && (*(p_data+j) == 0xff) && (*(p_data+j+1) == 0x00)) {
+						j++;
+					}
+				}
+			}
+			fclose(p_file_image);
+
+
+			fputs("Picture:\n\t", p_file);
+			write_escaped(p_file, tag->pictures[i].mime ? tag->pictures[i].mime : "");
+			fputc('\n', p_file);
+			if(info.width && info.height) {
+				fprintf(p_file, "\tformat: %s, %ux%u, %u bytes\n", info.mime, info.width, info.height, info.size);
+			}
+			else {
+				fprintf(p_file, "\tformat: %s, %u bytes\n", info.mime ? info.mime : "unknown", info.size);
+			}
+			if(tag->pictures[i].descr) {
+				fputs("\tdescription: ", p_file);
+				write_escaped(p_file, tag->pictures[i].descr);
+				fputc('\n', p_file);
+			}
+			fprintf(p_file, "\tpicture is stored in file %s\n", filename_image);
+
+			free(filename_image);
+		}
+	}
+
+	if(tag->lyrics.text) {
+		fputs("Lyrics:\n\tLanguage: ", p_file);
+		write_escaped(p_file, tag->lyrics.lang ? tag->lyrics.lang : "");
+		fputc('\n', p_file);
+		write_escaped(p_file, tag->lyrics.text);
+		fputc('\n', p_file);
+	}
+	if(ferror (p_file)) {
+		fprintf(stderr, "Error while writing into file %s!\n", filename);
+		fclose(p_file);
+		return 1;
+	}
+
+	if(get_id3v2_verbosity() != VERBOSITY_QUIET) {
+		printf("\nParsed ID3 tag textual frames written into file %s\n", filename);
+	}
+	fclose(p_file);
+	free(filename);
+
+	return result;
+}
+
+
+int remove_parsed_data(const char *orig_name) {
+	static const char picture_prefix[] = "\tpicture is stored in file ";
+	char line[PATH_MAX + sizeof(picture_prefix) + 1];
+	char *filename;
+	char *picture;
+	size_t name_len = strlen(orig_name);
+	size_t len;
+	int line_start = 1;
+	FILE *p_file;
+	int result = 0;
+
+	len = strlen(orig_name) + strlen(".tag.txt") + 1;
+	filename = malloc(len);
+	if(filename == NULL) {
+		return 1;
+	}
+	snprintf(filename, len, "%s%s", orig_name, ".tag.txt");
+
+	/* Pictures are listed in the textual file */
+	p_file = fopen(filename, "rb");
+	if(p_file == NULL) {
+		free(filename);
+		return 0;
+	}
+	while(fgets(line, sizeof(line), p_file)) {
+		/* Only pictures written next to the file are removed ('ORIG_NAME.TYPE.EXT'), whatever the line says */
+		picture = line + sizeof(picture_prefix) - 1;
+		if(line_start && strncmp(line, picture_prefix, sizeof(picture_prefix) - 1) == 0
+				&& strncmp(picture, orig_name, name_len) == 0 && picture[name_len] == '.'
+				&& strchr(picture + name_len, '/') == NULL) {
+			picture[strcspn(picture, "\n")] = '\0';
+			if(unlink(picture) != 0 && errno != ENOENT) {
+				result = 1;
+			}
+		}
+		line_start = strchr(line, '\n') != NULL;
+	}
+	fclose(p_file);
+
+	if(unlink(filename) != 0 && errno != ENOENT) {
+		fprintf(stderr, "Error while removing file %s!\n", filename);
+		result = 1;
+	}
+	free(filename);
+
+	return result;
+}
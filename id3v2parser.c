@@ -1,7 +1,7 @@
 /*
- *  id3v2parser - program to parse ID3v2.4 tags
+ *  id3v2parser - library to parse ID3v2.4 tags
  *
- * 	This program can read ID3 tags but only in version 2.4, according to the
+ * 	This library can read ID3 tags but only in version 2.4, according to the
  * 	latest specification. There were some troubles with version 2.3, so it
  * 	has not been implemented.
  *
@@ -9,12 +9,14 @@
  * 	  - textual information,
  * 	  - unsychronized lyrics,
  * 	  - pictures within tag.
- * 	Other frames which are not parsed, are skipped. In the program's output
+ * 	Frames compressed by zlib are decompressed before they are parsed.
+ * 	Optionally CRC-32 and restrictions from the extended header are checked
+ * 	before the frames are parsed.
+ * 	Other frames which are not parsed, are skipped. In the parser's output
  * 	you can see four-char frame IDs.
  *
- *  How to build: 'gcc -std=c11 -Wall -Wextra id3v2parser.c -o id3v2parser'
- *
- *  How to run: './id3v2parser mp3_file_to_parse.mp3'
+ * 	The command line program is built on top of the library in id3v2cli.c,
+ * 	see the Makefile for the library targets.
  *
  *
  *  Copyright (c) 2014 - Martin Rabek
@@ -49,146 +51,226 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define HAVE_SSE2_SCAN 1
+#endif
 
 #include "id3v2parser.h"
+#include "id3v2crc.h"
+#include "id3v2filter.h"
+#include "id3v2digest.h"
+
+
+/** State of the pass over frames of parse_buffer_where() or digest_buffer() */
+typedef struct filter_pass_s {
+	const id3v2_filter_t *filter;	/**< compiled filter, NULL in the digest pass */
+	id3v2_digest_t *digest;	/**< digest of the frames, NULL in the filter pass */
+	uint32_t pictures;		/**< mask of attached picture types */
+	int match;				/**< FILTER_* result */
+} filter_pass_t;
+
+
+/**
+ * Default reallocation of the library memory
+ * @param opaque		unused
+ * @param ptr			memory to reallocate or NULL
+ * @param len			new length
+ * @return				reallocated memory or NULL
+ */
+static void *default_realloc(void *opaque, void *ptr, size_t len) {
+	(void) opaque;
+	return realloc(ptr, len);
+}
+
+/**
+ * Default release of the library memory
+ * @param opaque		unused
+ * @param ptr			memory to free
+ */
+static void default_free(void *opaque, void *ptr) {
+	(void) opaque;
+	free(ptr);
+}
+
+/** Allocator of tag data and buffers */
+static id3v2_allocator_t id3v2_allocator = {NULL, default_realloc, default_free};
 
+/** Listener of parsing events and the events it gets */
+static id3v2_listener_t id3v2_listener = {NULL, print_id3v2_event};
+static uint8_t parse_verbosity = VERBOSITY_FRAMES;
 
-/** Structure for textual information */
-static struct id3v2_frame_textinfo_s {
+/** Verify CRC and restrictions of ID3 tag before its frames are parsed */
+static uint8_t integrity_check = 0;
+
+/** Structure for textual information, texts are stored in id3v2_tag_t at the same index */
+static const struct id3v2_frame_textinfo_s {
 	char *id;				/**< frame ID code */
 	char *info;				/**< text corresponding to the frame ID code */
-	char *text;				/**< text from the frame body */
-} id3v2_textinfo[] = {
-    {"TIT1", 	"Content group:     ", 	NULL},
-    {"TIT2", 	"Title:             ", 	NULL},
-    {"TIT3", 	"Subtitle:          ", 	NULL},
-    {"TALB", 	"Album:             ", 	NULL},
-    {"TOAL", 	"Original album:    ",	NULL},
-    {"TRCK", 	"Track number:      ",	NULL},
-    {"TPOS", 	"Part of a set:     ",  NULL},
-    {"TSST", 	"Set subtitle:      ",  NULL},
-    {"TSRC", 	"ISRC:              ",  NULL},
-
-    {"TPE1", 	"Lead artist:       ",  NULL},
-    {"TPE2", 	"Band:              ",  NULL},
-    {"TPE3", 	"Conductor:         ",  NULL},
-    {"TPE4", 	"Interpreted:       ",  NULL},
-    {"TOPE", 	"Orig. artist:      ",  NULL},
-    {"TEXT", 	"Lyricist:          ",  NULL},
-    {"TOLY", 	"Original lyricist: ",  NULL},
-    {"TCOM", 	"Composer:          ",  NULL},
-    {"TMCL", 	"Musician credits:  ",  NULL},
-    {"TIPL", 	"Involved people:   ",  NULL},
-    {"TENC", 	"Encoded by:        ",  NULL},
-
-    {"TBPM", 	"BPM:               ",  NULL},
-    {"TLEN", 	"Length:            ",  NULL},
-    {"TKEY", 	"Initial key:       ",  NULL},
-    {"TLAN", 	"Language:          ",  NULL},
-    {"TCON", 	"Content type:      ",  NULL},
-    {"TFLT", 	"File type:         ",  NULL},
-    {"TMED", 	"Media type:        ",  NULL},
-    {"TMOO", 	"Mood:              ",  NULL},
-
-    {"TCOP", 	"Copyright message: ",  NULL},
-    {"TPRO", 	"Produced notice:   ",  NULL},
-    {"TPUB", 	"Publisher:         ",  NULL},
-    {"TOWN", 	"File owner:        ",  NULL},
-    {"TRSN", 	"Internet radio station name: ", NULL},
-    {"TRSO", 	"Internet radio station owner: ",  NULL},
-
-    {"TOFN", 	"Orig. filename:    ",  NULL},
-    {"TDLY", 	"Playlist delay:    ",  NULL},
-    {"TDEN", 	"Encoding time:     ",  NULL},
-    {"TDOR", 	"Orig. release time:",  NULL},
-    {"TDRC", 	"Recording time:    ",  NULL},
-    {"TDRL", 	"Release time:      ",  NULL},
-    {"TDTG", 	"Tagging time:      ",  NULL},
-    {"TSSE", 	"SW/HW and settings used for encoding: ",  NULL},
-    {"TSOA", 	"Album sort:        ",  NULL},
-    {"TSOP", 	"Performer sort:    ",  NULL},
-    {"TSOT", 	"Title sort:        ",  NULL},
-
-    {NULL, 		NULL, 					NULL}
+} id3v2_textinfo[TEXTINFO_COUNT + 1] = {
+    {"TIT1", 	"Content group:     "},
+    {"TIT2", 	"Title:             "},
+    {"TIT3", 	"Subtitle:          "},
+    {"TALB", 	"Album:             "},
+    {"TOAL", 	"Original album:    "},
+    {"TRCK", 	"Track number:      "},
+    {"TPOS", 	"Part of a set:     "},
+    {"TSST", 	"Set subtitle:      "},
+    {"TSRC", 	"ISRC:              "},
+
+    {"TPE1", 	"Lead artist:       "},
+    {"TPE2", 	"Band:              "},
+    {"TPE3", 	"Conductor:         "},
+    {"TPE4", 	"Interpreted:       "},
+    {"TOPE", 	"Orig. artist:      "},
+    {"TEXT", 	"Lyricist:          "},
+    {"TOLY", 	"Original lyricist: "},
+    {"TCOM", 	"Composer:          "},
+    {"TMCL", 	"Musician credits:  "},
+    {"TIPL", 	"Involved people:   "},
+    {"TENC", 	"Encoded by:        "},
+
+    {"TBPM", 	"BPM:               "},
+    {"TLEN", 	"Length:            "},
+    {"TKEY", 	"Initial key:       "},
+    {"TLAN", 	"Language:          "},
+    {"TCON", 	"Content type:      "},
+    {"TFLT", 	"File type:         "},
+    {"TMED", 	"Media type:        "},
+    {"TMOO", 	"Mood:              "},
+
+    {"TCOP", 	"Copyright message: "},
+    {"TPRO", 	"Produced notice:   "},
+    {"TPUB", 	"Publisher:         "},
+    {"TOWN", 	"File owner:        "},
+    {"TRSN", 	"Internet radio station name: "},
+    {"TRSO", 	"Internet radio station owner: "},
+
+    {"TOFN", 	"Orig. filename:    "},
+    {"TDLY", 	"Playlist delay:    "},
+    {"TDEN", 	"Encoding time:     "},
+    {"TDOR", 	"Orig. release time:"},
+    {"TDRC", 	"Recording time:    "},
+    {"TDRL", 	"Release time:      "},
+    {"TDTG", 	"Tagging time:      "},
+    {"TSSE", 	"SW/HW and settings used for encoding: "},
+    {"TSOA", 	"Album sort:        "},
+    {"TSOP", 	"Performer sort:    "},
+    {"TSOT", 	"Title sort:        "},
+
+    {NULL, 		NULL}
 };
 
-/** Structure for lyrics information */
-static struct id3frame_other_info_s {
-	char *lang;				/**< language of the lyrics */
-	char *descr;			/**< description of the lyrics */
-	char *text;				/**< lyrics text */
-} id3v2_lyrics = {NULL, NULL, NULL};
-
-/** Structure for pictures information */
-static struct id3frame_apic_type_s {
+/** Structure for pictures information, pictures are stored in id3v2_tag_t at the same index */
+static const struct id3frame_apic_type_s {
 	uint8_t type;			/**< type of the image */
 	char *text;				/**< text corresponding to the type */
-	char *mime;				/**< mime type of the image */
-	char *descr;			/**< description of the image */
-	unsigned char *data;	/**< binary data of the image */
-	uint8_t flags;			/**< flags of the frame header */
-	uint32_t len;			/**< length of store binary data */
-} id3frame_apic_type[] = {
-	{0x00, "other", 				NULL, NULL, NULL, 0, 0},
-	{0x01, "file icon", 			NULL, NULL, NULL, 0, 0},
-	{0x02, "other file icon", 		NULL, NULL, NULL, 0, 0},
-	{0x03, "cover front", 			NULL, NULL, NULL, 0, 0},
-	{0x04, "cover back", 			NULL, NULL, NULL, 0, 0},
-	{0x05, "leaflet page", 			NULL, NULL, NULL, 0, 0},
-	{0x06, "media", 				NULL, NULL, NULL, 0, 0},
-	{0x07, "soloist", 				NULL, NULL, NULL, 0, 0},
-	{0x08, "artist", 				NULL, NULL, NULL, 0, 0},
-	{0x09, "conductor", 			NULL, NULL, NULL, 0, 0},
-	{0x0A, "band", 					NULL, NULL, NULL, 0, 0},
-	{0x0B, "composer", 				NULL, NULL, NULL, 0, 0},
-	{0x0C, "lyricist", 				NULL, NULL, NULL, 0, 0},
-	{0x0D, "recording location", 	NULL, NULL, NULL, 0, 0},
-	{0x0E, "during recording", 		NULL, NULL, NULL, 0, 0},
-	{0x0F, "during performance", 	NULL, NULL, NULL, 0, 0},
-	{0x10, "movie screen capture", 	NULL, NULL, NULL, 0, 0},
-	{0x11, "bright coloured fish", 	NULL, NULL, NULL, 0, 0},
-	{0x12, "illustration", 			NULL, NULL, NULL, 0, 0},
-	{0x13, "band logotype", 		NULL, NULL, NULL, 0, 0},
-	{0x14, "publisher", 			NULL, NULL, NULL, 0, 0},
-
-	{0xff, NULL, 					NULL, NULL, NULL, 0, 0}
+} id3frame_apic_type[APIC_TYPE_COUNT + 1] = {
+	{0x00, "other"},
+	{0x01, "file icon"},
+	{0x02, "other file icon"},
+	{0x03, "cover front"},
+	{0x04, "cover back"},
+	{0x05, "leaflet page"},
+	{0x06, "media"},
+	{0x07, "soloist"},
+	{0x08, "artist"},
+	{0x09, "conductor"},
+	{0x0A, "band"},
+	{0x0B, "composer"},
+	{0x0C, "lyricist"},
+	{0x0D, "recording location"},
+	{0x0E, "during recording"},
+	{0x0F, "during performance"},
+	{0x10, "movie screen capture"},
+	{0x11, "bright coloured fish"},
+	{0x12, "illustration"},
+	{0x13, "band logotype"},
+	{0x14, "publisher"},
+
+	{0xff, NULL}
 };
 
 
-int main(int argc, char *argv[]) {
-	unsigned char *buffer;
-	uint32_t buffer_len;
+void init_id3v2_tag(id3v2_tag_t *tag) {
+	memset(tag, 0, sizeof(*tag));
+}
 
-	/* Program receives as its first argument name of the MP3 file */
-	if(argc != 2)  {
-		fprintf(stderr, "Wrong number of arguments - run program as '%s file.mp3'!\n", argv[0]);
-		return 1;
-	}
 
-	/* Read file and store binary data in the buffer */
-	if(read_file(argv[1], &buffer, &buffer_len) == 1) {
-		fprintf(stderr, "Error while reading MP3 file %s has appeared!\n", argv[1]);
-		return 1;
-	}
+const char *get_id3v2_text_id(uint32_t index) {
+	return index < TEXTINFO_COUNT ? id3v2_textinfo[index].id : NULL;
+}
 
-	/* Parse input file */
-	if(parse_buffer(buffer, buffer_len) != 0) {
-		fprintf(stderr, "Error while parsing input buffer occurred!\n");
-		deallocate_memory(buffer); /* Free dynamically allocated memory */
-		return 1;
-	}
 
-	/* Write parsed data into file(s) */
-	if(write_parsed_data(argv[1]) != 0) {
-		fprintf(stderr, "Error while writing parsed data into file(s) occurred!\n");
-		deallocate_memory(buffer); /* Free dynamically allocated memory */
-		return 1;
-	}
+const char *get_id3v2_text_info(uint32_t index) {
+	return index < TEXTINFO_COUNT ? id3v2_textinfo[index].info : NULL;
+}
 
-	/* Free dynamically allocated memory */
-	deallocate_memory(buffer);
 
-	return 0;
+const char *get_id3v2_picture_type(uint32_t index) {
+	return index < APIC_TYPE_COUNT ? id3frame_apic_type[index].text : NULL;
+}
+
+
+unsigned long get_id3v2_version(void) {
+	return ID3V2_VERSION;
+}
+
+
+void set_id3v2_allocator(const id3v2_allocator_t *allocator) {
+	static const id3v2_allocator_t default_allocator = {NULL, default_realloc, default_free};
+
+	id3v2_allocator = allocator ? *allocator : default_allocator;
+}
+
+
+void set_id3v2_listener(const id3v2_listener_t *listener) {
+	id3v2_listener.opaque = listener ? listener->opaque : NULL;
+	id3v2_listener.event = listener ? listener->event : print_id3v2_event;
+}
+
+
+void set_id3v2_verbosity(uint8_t verbosity) {
+	parse_verbosity = verbosity;
+}
+
+
+uint8_t get_id3v2_verbosity(void) {
+	return parse_verbosity;
+}
+
+
+/**
+ * Deliver the event to the listener of the context, callers check the verbosity first
+ * @param context		listener and path of the parsed file
+ * @param event			parsing event, its path is set from the context
+ */
+static void emit_event(const id3v2_parse_context_t *context, id3v2_event_t *event) {
+	const id3v2_listener_t *listener = context->listener ? context->listener : &id3v2_listener;
+
+	event->path = context->path;
+	listener->event(listener->opaque, event);
+}
+
+
+void *alloc_id3v2_memory(size_t len) {
+	return id3v2_allocator.realloc(id3v2_allocator.opaque, NULL, len);
+}
+
+
+void *realloc_id3v2_memory(void *ptr, size_t len) {
+	return id3v2_allocator.realloc(id3v2_allocator.opaque, ptr, len);
+}
+
+
+void free_id3v2_memory(void *ptr) {
+	if(ptr) {
+		id3v2_allocator.free(id3v2_allocator.opaque, ptr);
+	}
 }
 
 
@@ -208,7 +290,7 @@ int read_file(char * name, unsigned char ** p_buffer, uint32_t * p_len) {
 	fseek(file, 0, SEEK_SET);
 
 	/* Allocate memory for an input buffer */
-	*p_buffer = (unsigned char *) malloc(*p_len);
+	*p_buffer = alloc_id3v2_memory(*p_len);
 	if (*p_buffer == NULL)	{
 		fprintf(stderr, "Error while allocating memory for buffer!\n");
         fclose(file);
@@ -227,39 +309,499 @@ int read_file(char * name, unsigned char ** p_buffer, uint32_t * p_len) {
 }
 
 
-int parse_buffer(unsigned char *buffer, uint32_t buffer_len) {
-	id3v2_header_t header;
-	unsigned char *p_buff = buffer;
+/**
+ * Check that the buffer starts with valid ID3 tag header, i.e. version bytes
+ * are not 0xFF and all bytes of the synchsafe size are less than 0x80
+ * @param header		buffer of at least HEADER_LEN bytes
+ * @return				1 if the header is valid, 0 otherwise
+ */
+static int is_id3v2_header(const unsigned char *header) {
+	return memcmp(header, "ID3", 3) == 0 && header[3] != 0xFF && header[4] != 0xFF
+			&& ((header[6] | header[7] | header[8] | header[9]) & 0x80) == 0;
+}
 
-	/* Validate that there are enough data in buffer to parse */
-	printf("MP3 file length: %u\n", buffer_len);
-	if(buffer_len < HEADER_LEN) {
-		fprintf(stderr, "Error - file is too small to include ID3 header (10 bytes)\n");
+
+/**
+ * Find the first valid ID3 tag header in the buffer
+ * @param buffer		buffer to scan
+ * @param len			length of the buffer
+ * @return				offset of the header or len if there is none
+ */
+static uint32_t find_id3v2_header(const unsigned char *buffer, uint32_t len) {
+	const unsigned char *p;
+	uint32_t candidates;
+	uint32_t i = 0;
+#ifdef HAVE_SSE2_SCAN
+	const __m128i id_i = _mm_set1_epi8('I');
+	const __m128i id_d = _mm_set1_epi8('D');
+	const __m128i id_3 = _mm_set1_epi8('3');
+	unsigned mask;
+#endif
+
+	if(len < HEADER_LEN) {
+		return len;
+	}
+	/* Whole header must fit into the buffer */
+	candidates = len - HEADER_LEN + 1;
+
+#ifdef HAVE_SSE2_SCAN
+	/* Signature is compared at 16 positions at once, loads stay within the buffer */
+	for(; i + 16 <= candidates; i += 16) {
+		mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (buffer + i)), id_i),
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (buffer + i + 1)), id_d)),
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (buffer + i + 2)), id_3)));
+		for(; mask; mask &= mask - 1) {
+			if(is_id3v2_header(buffer + i + __builtin_ctz(mask))) {
+				return i + __builtin_ctz(mask);
+			}
+		}
+	}
+#endif
+
+	/* Remaining positions (or all of them without SSE2) are scanned by memchr() */
+	while(i < candidates && (p = memchr(buffer + i, 'I', candidates - i)) != NULL) {
+		i = p - buffer;
+		if(is_id3v2_header(p)) {
+			return i;
+		}
+		i++;
+	}
+
+	return len;
+}
+
+
+uint32_t get_id3v2_tag_length(const unsigned char *header, uint32_t len) {
+	uint32_t tag_len;
+
+	if(len < HEADER_LEN || memcmp(header, "ID3", 3) != 0) {
+		return len < HEADER_LEN ? len : HEADER_LEN;
+	}
+	tag_len = HEADER_LEN + (((header[6] & 0x7F) << 21) | ((header[7] & 0x7F) << 14) | ((header[8] & 0x7F) << 7) | (header[9] & 0x7F));
+	if(header[5] & FLAG_ID3_FOOTER) {
+		tag_len += HEADER_LEN;
+	}
+	return tag_len;
+}
+
+
+int find_id3v2_tag(int fd, uint64_t *p_offset) {
+	unsigned char scan[RESYNC_SCAN_LEN];
+	unsigned char chunk[CHUNK_HEADER_LEN];
+	struct stat st;
+	uint64_t offset;
+	ssize_t read_len;
+	uint32_t size;
+	uint32_t i;
+	int big_endian;
+
+	*p_offset = 0;
+	read_len = pread(fd, scan, CONTAINER_HEADER_LEN, 0);
+	if(read_len >= 3 && memcmp(scan, "ID3", 3) == 0) {
+		return 0;
+	}
+
+	/* RIFF chunk sizes are little endian, IFF chunk sizes big endian */
+	if(read_len == CONTAINER_HEADER_LEN && memcmp(scan, "RIFF", 4) == 0 && memcmp(scan + 8, "WAVE", 4) == 0) {
+		big_endian = 0;
+	}
+	else if(read_len == CONTAINER_HEADER_LEN && memcmp(scan, "FORM", 4) == 0
+			&& (memcmp(scan + 8, "AIFF", 4) == 0 || memcmp(scan + 8, "AIFC", 4) == 0)) {
+		big_endian = 1;
+	}
+	else {
+		/* Tag preceded by junk is found by bounded scan of the beginning of the file */
+		read_len = pread(fd, scan, RESYNC_SCAN_LEN, 0);
+		if(read_len < 0) {
+			return 1;
+		}
+		*p_offset = find_id3v2_header(scan, read_len);
+		if(*p_offset == (uint64_t) read_len) {
+			*p_offset = 0;
+			return 1;
+		}
+		return 0;
+	}
+	if(fstat(fd, &st) != 0) {
+		return 1;
+	}
+
+	/* Only chunk headers are read, audio chunks are skipped by their size */
+	offset = CONTAINER_HEADER_LEN;
+	for(i = 0; i < MAX_CONTAINER_CHUNKS && offset + CHUNK_HEADER_LEN <= (uint64_t) st.st_size; i++) {
+		if(pread(fd, chunk, CHUNK_HEADER_LEN, offset) != CHUNK_HEADER_LEN) {
+			return 1;
+		}
+		if(memcmp(chunk, "ID3 ", 4) == 0 || memcmp(chunk, "id3 ", 4) == 0) {
+			*p_offset = offset + CHUNK_HEADER_LEN;
+			return 0;
+		}
+		if(big_endian) {
+			size = ((uint32_t) chunk[4] << 24) | (chunk[5] << 16) | (chunk[6] << 8) | chunk[7];
+		}
+		else {
+			size = ((uint32_t) chunk[7] << 24) | (chunk[6] << 16) | (chunk[5] << 8) | chunk[4];
+		}
+		/* Chunks are aligned to even offsets */
+		offset += CHUNK_HEADER_LEN + (uint64_t) size + (size & 1);
+	}
+
+	return 1;
+}
+
+
+int read_tag_at(int fd, uint64_t offset, unsigned char **p_buffer, uint32_t *p_capacity, uint32_t *p_len) {
+	unsigned char header[HEADER_LEN];
+	unsigned char *tmp;
+	uint32_t total = 0;
+	uint32_t len;
+	uint32_t count;
+	ssize_t read_len;
+
+	/* Stacked tags following the first one are read into the same buffer */
+	for(count = 0; count < MAX_STACKED_TAGS; count++) {
+		read_len = pread(fd, header, HEADER_LEN, offset + total);
+		if(read_len < 0) {
+			fprintf(stderr, "Error while reading file!\n");
+			return 1;
+		}
+		if(count > 0 && (read_len < HEADER_LEN || !is_id3v2_header(header))) {
+			break;
+		}
+
+		/* Only ID3 tag (with its footer) is read, audio data are not needed for parsing */
+		len = get_id3v2_tag_length(header, read_len);
+
+		/* Buffer is reused by the next call, it only grows */
+		if(total + len > *p_capacity || *p_buffer == NULL) {
+			tmp = realloc_id3v2_memory(*p_buffer, total + len ? total + len : 1);
+			if(tmp == NULL) {
+				fprintf(stderr, "Error while allocating memory for buffer!\n");
+				return 1;
+			}
+			*p_buffer = tmp;
+			*p_capacity = total + len;
+		}
+
+		memcpy(*p_buffer + total, header, read_len);
+		if(len > (uint32_t) read_len) {
+			read_len = pread(fd, *p_buffer + total + HEADER_LEN, len - HEADER_LEN, offset + total + HEADER_LEN);
+			if(read_len < 0) {
+				fprintf(stderr, "Error while reading file!\n");
+				return 1;
+			}
+			/* Truncated tag is reported by parse_buffer() */
+			if((uint32_t) read_len < len - HEADER_LEN) {
+				total += HEADER_LEN + read_len;
+				break;
+			}
+		}
+		total += len;
+		if(memcmp(header, "ID3", 3) != 0) {
+			break;
+		}
+	}
+	*p_len = total;
+
+	return 0;
+}
+
+
+int read_tag_prefix(int fd, unsigned char **p_buffer, uint32_t *p_capacity, uint32_t *p_len) {
+	uint64_t offset;
+
+	/* File without tag is read from its beginning, parse_buffer() reports it */
+	find_id3v2_tag(fd, &offset);
+	return read_tag_at(fd, offset, p_buffer, p_capacity, p_len);
+}
+
+
+/**
+ * Find the terminator of the text field, nothing behind the end of the frame is read
+ * @param data			start of the field
+ * @param len			number of bytes to the end of the frame
+ * @param encoding		text encoding, UTF-16 fields are terminated by $00 00 at even offset
+ * @return				length of the field without its terminator, len if it is not terminated
+ */
+static uint32_t find_field_end(const unsigned char *data, uint32_t len, uint8_t encoding) {
+	const unsigned char *p;
+	uint32_t i = 0;
+#ifdef HAVE_SSE2_SCAN
+	const __m128i zero = _mm_setzero_si128();
+	unsigned mask;
+#endif
+
+	if(encoding != ENC_UTF_16 && encoding != ENC_UTF_16BE) {
+		p = memchr(data, 0x00, len);
+		return p ? (uint32_t) (p - data) : len;
+	}
+
+#ifdef HAVE_SSE2_SCAN
+	/* Zero bytes are found at 16 positions at once, a terminator is a zero pair starting at even offset */
+	for(; i + 16 <= len; i += 16) {
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + i)), zero));
+		mask &= (mask >> 1) & 0x5555;
+		if(mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+
+	/* Remaining code units (or all of them without SSE2) */
+	for(; i + 2 <= len; i += 2) {
+		if(data[i] == 0x00 && data[i + 1] == 0x00) {
+			return i;
+		}
+	}
+
+	return len;
+}
+
+/**
+ * Skip the text field including its terminator
+ * @param len			length of the field without its terminator (find_field_end())
+ * @param left			number of bytes to the end of the frame
+ * @param encoding		text encoding of the field
+ * @return				number of bytes to skip, at most left
+ */
+static uint32_t skip_field(uint32_t len, uint32_t left, uint8_t encoding) {
+	len += (encoding == ENC_UTF_16 || encoding == ENC_UTF_16BE) ? 2 : 1;
+	return len < left ? len : left;
+}
+
+/**
+ * Copy the text field into a string terminated by '\0'
+ * @param data			start of the field
+ * @param len			length of the field without its terminator
+ * @return				allocated string or NULL if there is not enough memory
+ */
+static char *copy_field(const unsigned char *data, uint32_t len) {
+	char *text = alloc_id3v2_memory(len + 1);
+
+	if(text) {
+		memcpy(text, data, len);
+		text[len] = '\0';
+	}
+	return text;
+}
+
+
+/**
+ * Decompress zlib data into the output of the stream, until the end of the data or of the output
+ * @param stream		initialised stream with the output
+ * @param buffer		compressed data
+ * @param len			length of compressed data
+ * @param unsync		1 if unsynchronisation of the data is to be undone
+ * @return				last result of inflate(), Z_STREAM_END if the compressed stream is complete
+ */
+static int inflate_frame_data(z_stream *stream, unsigned char *buffer, uint32_t len, int unsync) {
+	unsigned char chunk[INFLATE_CHUNK_LEN];
+	uint32_t pos = 0;
+	uint32_t chunk_len;
+	uint8_t prev_ff = 0;
+	int ret = Z_OK;
+
+	for(;;) {
+		if(stream->avail_in == 0) {
+			if(pos >= len) {
+				/* Input is over before the end of compressed stream */
+				break;
+			}
+			if(unsync) {
+				/* Undo unsynchronisation chunk by chunk, so no copy of the whole frame is needed */
+				chunk_len = 0;
+				while(pos < len && chunk_len < INFLATE_CHUNK_LEN) {
+					if(!(prev_ff && buffer[pos] == 0x00)) {
+						chunk[chunk_len++] = buffer[pos];
+					}
+					prev_ff = (buffer[pos++] == 0xFF);
+				}
+				stream->next_in = chunk;
+				stream->avail_in = chunk_len;
+			}
+			else {
+				stream->next_in = buffer;
+				stream->avail_in = len;
+				pos = len;
+			}
+		}
+
+		ret = inflate(stream, Z_NO_FLUSH);
+		if(ret != Z_OK) {
+			/* Z_BUF_ERROR here means that the output is full */
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Get type of the attached picture without copying the picture
+ * @param body			body of APIC frame (neither compressed nor encrypted)
+ * @param header		frame header
+ * @return				picture type or 0xFF if the frame is malformed
+ */
+static uint8_t get_picture_type(const unsigned char *body, id3v2_frame_header_t header) {
+	uint32_t i = 0;
+	uint32_t len;
+
+	if(header.flags & FLAG_FR_GROUP) {
+		i++;
+	}
+	if(header.flags & FLAG_FR_LEN) {
+		i += 4;
+	}
+
+	/* Encoding and mime type terminated by $00 precede the type */
+	if(i + 1 >= header.size) {
+		return 0xFF;
+	}
+	len = find_field_end(body + i + 1, header.size - i - 1, ENC_ISO_8859_1);
+	if(i + 1 + len + 1 >= header.size) {
+		return 0xFF;
+	}
+	return body[i + 1 + len + 1];
+}
+
+/**
+ * Get type of the compressed attached picture, only the start of the frame is decompressed
+ * (wrong data length indicator of longer data is found only when the frame is parsed)
+ * @param body			body of compressed APIC frame (not encrypted)
+ * @param header		frame header
+ * @return				picture type or 0xFF if the frame is malformed or the type is not found
+ */
+static uint8_t get_compressed_picture_type(unsigned char *body, id3v2_frame_header_t header) {
+	z_stream stream;
+	unsigned char start[PICTURE_TYPE_SCAN_LEN];
+	unsigned char *p;
+	uint32_t data_len;
+	uint32_t i = 0;
+	int ret;
+
+	if(header.flags & FLAG_FR_GROUP) {
+		i++;
+	}
+
+	/* Compressed frames without data length indicator are skipped by parse_id3v2_frame_body() */
+	if(!(header.flags & FLAG_FR_LEN) || header.size < i + 4) {
+		return 0xFF;
+	}
+	p = body + i;
+	data_len = ((p[0] & 0x7F) << 21) | ((p[1] & 0x7F) << 14) | ((p[2] & 0x7F) << 7) | (p[3] & 0x7F);
+	i += 4;
+
+	memset(&stream, 0, sizeof(stream));
+	if(inflateInit(&stream) != Z_OK) {
+		return 0xFF;
+	}
+	stream.next_out = start;
+	stream.avail_out = sizeof(start);
+	ret = inflate_frame_data(&stream, body + i, header.size - i, header.flags & FLAG_FR_UNSYNC);
+	inflateEnd(&stream);
+	/* Full output is a start of longer data, otherwise the stream must end at data length indicator */
+	if(ret != Z_BUF_ERROR && (ret != Z_STREAM_END || stream.total_out != data_len)) {
+		return 0xFF;
+	}
+
+	/* Decompressed start has neither additional information nor unsynchronisation */
+	header.flags = 0;
+	header.size = stream.total_out;
+	return get_picture_type(start, header);
+}
+
+
+/**
+ * Decode frame for the filter pass if the filter refers to it, and evaluate the filter
+ * @param tag			pointer to the ID3 tag structure
+ * @param p_header_buff	pointer to the frame body, it is moved behind the frame
+ * @param header		frame header
+ * @param pass			state of the filter pass
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int decode_filter_frame(id3v2_tag_t *tag, unsigned char **p_header_buff, id3v2_frame_header_t header, filter_pass_t *pass) {
+	uint8_t type;
+
+	if(!uses_id3v2_frame(pass->filter, (char *) header.id)) {
+		*p_header_buff += header.size;
+		return 0;
+	}
+
+	/* Type is enough to evaluate the filter, the picture is neither decompressed nor copied */
+	if(strcmp((char *) header.id, "APIC") == 0) {
+		if(header.flags & FLAG_FR_ENCR) {
+			type = 0xFF;
+		}
+		else if(header.flags & FLAG_FR_COMP) {
+			type = get_compressed_picture_type(*p_header_buff, header);
+		}
+		else {
+			type = get_picture_type(*p_header_buff, header);
+		}
+		if(type < APIC_TYPE_COUNT) {
+			pass->pictures |= 1u << type;
+		}
+		*p_header_buff += header.size;
+	}
+	else if(parse_id3v2_frame_body(tag, p_header_buff, header) != 0) {
 		return 1;
 	}
 
-	/* In this implementation, ID3 tag is supposed to be at the beginning of the MP3 file */
+	pass->match = match_id3v2_filter(pass->filter, tag, pass->pictures, 0);
+	return 0;
+}
+
+
+/**
+ * Parse one ID3 tag, frames already present in the tag structure are kept
+ * @param tag			pointer to the ID3 tag structure
+ * @param buffer		buffer starting with the ID3 tag
+ * @param buffer_len	length of the buffer
+ * @param pass			state of the filter pass (only frames of the filter are decoded), NULL to parse the tag
+ * @param context		context delivering the events when the tag is parsed, NULL with the pass
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int parse_id3v2_tag(id3v2_tag_t *tag, unsigned char *buffer, uint32_t buffer_len, filter_pass_t *pass,
+		const id3v2_parse_context_t *context) {
+	id3v2_header_t header;
+	id3v2_extended_header_t ext_header;
+	uint32_t frames_count = 0;
+	unsigned char *p_buff = buffer;
+
 	if(parse_id3v2_header(&p_buff, &header) == 1) {
 		fprintf(stderr, "Error - missing ID3 tag so it cannot be parsed\n");
 		return 1;
 	}
 
-	/* Print ID3 tag header information */
-	print_id3v2_header(header);
+	/* Deliver ID3 tag header information */
+	if(pass == NULL && context->verbosity >= VERBOSITY_TAGS) {
+		emit_event(context, &(id3v2_event_t) {EVENT_TAG, 0, 0, &header, NULL, 0, NULL});
+	}
 
 	if(header.major_version != 4) {
 		fprintf(stderr, "Cannot process ID3v2.%u tag. Only parsing of ID3v2.4 is implemented!\n", header.major_version);
 		return 1;
 	}
 
+	/* Validate that there are enough data in buffer to parse */
+	if(buffer_len < HEADER_LEN + header.size) {
+		fprintf(stderr, "Error - file is too small to include ID3 tag (probably corrupted), as derived from ID3 header\n");
+		return 1;
+	}
+
 	/* Process Extended Header (OPTIONAL) */
+	memset(&ext_header, 0, sizeof(ext_header));
 	if(header.flags & FLAG_ID3_EXTEND) {
-		skip_id3v2_extended_header(&p_buff);
+		if(parse_id3v2_extended_header(&p_buff, header.size, &ext_header) != 0) {
+			fprintf(stderr, "Error - extended header of ID3 tag is corrupted\n");
+			return 1;
+		}
 	}
 
-	/* Validate that there are enough data in buffer to parse */
-	if(buffer_len < p_buff - buffer + header.size) {
-		fprintf(stderr, "Error - file is too small to include ID3 tag (probably corrupted), as derived from ID3 header\n");
+	/* Verify CRC and tag size restrictions before any frame is decoded, the digest pass does not decode frames */
+	if(integrity_check && (pass == NULL || pass->filter) && verify_id3v2_tag(header, ext_header, p_buff, buffer + HEADER_LEN + header.size - p_buff) != 0) {
+		fprintf(stderr, "Error - integrity check of ID3 tag failed\n");
 		return 1;
 	}
 
@@ -269,6 +811,7 @@ int parse_buffer(unsigned char *buffer, uint32_t buffer_len) {
 		printf("%u: ", (uint32_t) (p_buff - buffer));
 #endif
 		id3v2_frame_header_t frame_header;
+		uint32_t frame_offset = p_buff - buffer;
 
 		/* Process frame header */
 		if(parse_id3v2_frame_header(&p_buff, &frame_header) == 1) {
@@ -276,11 +819,46 @@ int parse_buffer(unsigned char *buffer, uint32_t buffer_len) {
 			break;
 		}
 
-		/* Print ID3 frame header information */
-		print_id3v2_frame_header(frame_header);
+		/* Size of the frame is not trusted, its body must lie within the tag */
+		if(frame_header.size > (uint32_t) (buffer + HEADER_LEN + header.size - p_buff)) {
+			fprintf(stderr, "Frame %s exceeds the ID3 tag, rest of the tag is skipped\n", frame_header.id);
+			break;
+		}
+
+		/* Filter pass stops as soon as the filter is decided, digest pass hashes raw bodies of all frames */
+		if(pass) {
+			if(pass->digest) {
+				if(add_id3v2_frame_digest(pass->digest, (char *) frame_header.id, p_buff, frame_header.size) != 0) {
+					fprintf(stderr, "Error while allocating memory for digest!\n");
+					return 1;
+				}
+				p_buff += frame_header.size;
+				continue;
+			}
+			if(decode_filter_frame(tag, &p_buff, frame_header, pass) != 0) {
+				fprintf(stderr, "Error while parsing ID3 frame body of ID %s\n", frame_header.id);
+				return 1;
+			}
+			if(pass->match != FILTER_UNKNOWN) {
+				break;
+			}
+			continue;
+		}
+
+		/* Deliver ID3 frame header information */
+		if(context->verbosity >= VERBOSITY_FRAMES) {
+			emit_event(context, &(id3v2_event_t) {EVENT_FRAME, 0, frame_offset, NULL, &frame_header, 0, NULL});
+		}
+
+		if(integrity_check && (ext_header.flags & FLAG_EXT_RESTRICT)) {
+			if(check_id3v2_frame_restrictions(ext_header.restrictions, frame_header, p_buff, ++frames_count) != 0) {
+				fprintf(stderr, "Error - frame %s violates restrictions of ID3 tag\n", frame_header.id);
+				return 1;
+			}
+		}
 
 		/* Process frame body */
-		if(parse_id3v2_frame_body(&p_buff, frame_header) != 0) {
+		if(parse_id3v2_frame_body(tag, &p_buff, frame_header) != 0) {
 			fprintf(stderr, "Error while parsing ID3 frame body of ID %s\n", frame_header.id);
 			return 1;
 		}
@@ -290,6 +868,150 @@ int parse_buffer(unsigned char *buffer, uint32_t buffer_len) {
 }
 
 
+/**
+ * Parse ID3 tag of the buffer (found after junk) and stacked tags following it
+ * @param tag			pointer to the ID3 tag structure
+ * @param buffer		buffer of input MP3 file
+ * @param buffer_len	length of the buffer, at least HEADER_LEN
+ * @param pass			state of the filter pass, NULL to parse the tags
+ * @param context		context delivering the events when the tags are parsed, NULL with the pass
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int parse_id3v2_tags(id3v2_tag_t *tag, unsigned char *buffer, uint32_t buffer_len, filter_pass_t *pass,
+		const id3v2_parse_context_t *context) {
+	uint32_t offset;
+	uint32_t count;
+
+	/* ID3 tag is supposed to be at the beginning of the buffer, tag preceded by junk is found by bounded scan */
+	offset = 0;
+	if(!is_id3v2_header(buffer)) {
+		offset = find_id3v2_header(buffer, buffer_len < RESYNC_SCAN_LEN ? buffer_len : RESYNC_SCAN_LEN);
+		if(offset == (buffer_len < RESYNC_SCAN_LEN ? buffer_len : RESYNC_SCAN_LEN)) {
+			offset = 0;
+		}
+	}
+	if(parse_id3v2_tag(tag, buffer + offset, buffer_len - offset, pass, context) != 0) {
+		return 1;
+	}
+
+	/* Stacked tags follow each other, frames of the first tag take precedence */
+	for(count = 1; count < MAX_STACKED_TAGS && (pass == NULL || pass->match == FILTER_UNKNOWN); count++) {
+		offset += get_id3v2_tag_length(buffer + offset, buffer_len - offset);
+		if(offset > buffer_len || buffer_len - offset < HEADER_LEN || !is_id3v2_header(buffer + offset)) {
+			break;
+		}
+		if(parse_id3v2_tag(tag, buffer + offset, buffer_len - offset, pass, context) != 0) {
+			fprintf(stderr, "Error - stacked ID3 tag is corrupted, rest of it is skipped\n");
+			break;
+		}
+	}
+
+	return 0;
+}
+
+
+int parse_buffer(id3v2_tag_t *tag, unsigned char *buffer, uint32_t buffer_len) {
+	int match;
+
+	return parse_buffer_where(tag, buffer, buffer_len, NULL, &match);
+}
+
+
+/**
+ * Parse ID3 tags of the buffer, frames of the filter first
+ * @param tag			pointer to the ID3 tag structure
+ * @param buffer		buffer of input MP3 file
+ * @param buffer_len	length of the buffer
+ * @param filter		compiled filter or NULL to parse all files
+ * @param context		context delivering the events of the parsed tags
+ * @param p_match		pointer set to 1 if the tag matches the filter (and it is parsed), 0 otherwise
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int parse_buffer_filtered(id3v2_tag_t *tag, unsigned char *buffer, uint32_t buffer_len, const id3v2_filter_t *filter,
+		const id3v2_parse_context_t *context, int *p_match) {
+	filter_pass_t pass;
+
+	/* Validate that there are enough data in buffer to parse */
+	*p_match = 1;
+	if(buffer_len < HEADER_LEN) {
+		fprintf(stderr, "Error - file is too small to include ID3 header (10 bytes)\n");
+		return 1;
+	}
+
+	/* Frames of the filter are decoded first, pictures of not matching file are never copied */
+	if(filter) {
+		pass.filter = filter;
+		pass.digest = NULL;
+		pass.pictures = 0;
+		pass.match = FILTER_UNKNOWN;
+		if(parse_id3v2_tags(tag, buffer, buffer_len, &pass, NULL) != 0) {
+			return 1;
+		}
+		if(pass.match == FILTER_UNKNOWN) {
+			pass.match = match_id3v2_filter(filter, tag, pass.pictures, 1);
+		}
+		if(pass.match == FILTER_NO_MATCH) {
+			*p_match = 0;
+			return 0;
+		}
+	}
+
+	/* Frames decoded by the filter pass are kept, their duplicates are skipped */
+	return parse_id3v2_tags(tag, buffer, buffer_len, NULL, context);
+}
+
+
+int parse_buffer_where(id3v2_tag_t *tag, unsigned char *buffer, uint32_t buffer_len, const id3v2_filter_t *filter, int *p_match) {
+	const id3v2_parse_context_t context = {NULL, parse_verbosity, NULL};
+
+	return parse_buffer_context(tag, buffer, buffer_len, filter, &context, p_match);
+}
+
+
+int parse_buffer_context(id3v2_tag_t *tag, unsigned char *buffer, uint32_t buffer_len, const id3v2_filter_t *filter,
+		const id3v2_parse_context_t *context, int *p_match) {
+	int result;
+
+	if(context->verbosity >= VERBOSITY_TAGS) {
+		emit_event(context, &(id3v2_event_t) {EVENT_BUFFER, buffer_len, 0, NULL, NULL, 0, NULL});
+	}
+	result = parse_buffer_filtered(tag, buffer, buffer_len, filter, context, p_match);
+	if(context->verbosity >= VERBOSITY_TAGS) {
+		emit_event(context, &(id3v2_event_t) {EVENT_END, buffer_len, 0, NULL, NULL, result, NULL});
+	}
+
+	return result;
+}
+
+
+int digest_buffer(unsigned char *buffer, uint32_t buffer_len, id3v2_digest_t *digest) {
+	id3v2_tag_t tag;
+	filter_pass_t pass;
+
+	if(buffer_len < HEADER_LEN) {
+		fprintf(stderr, "Error - file is too small to include ID3 header (10 bytes)\n");
+		return 1;
+	}
+
+	/* Frames are walked as by the filter pass, nothing is decoded into the tag */
+	init_id3v2_tag(&tag);
+	pass.filter = NULL;
+	pass.digest = digest;
+	pass.pictures = 0;
+	pass.match = FILTER_UNKNOWN;
+	digest->len = 0;
+	if(parse_id3v2_tags(&tag, buffer, buffer_len, &pass, NULL) != 0) {
+		return 1;
+	}
+	if(finish_id3v2_digest(digest) != 0) {
+		fprintf(stderr, "Error while allocating memory for digest!\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+
 int parse_id3v2_header(unsigned char **p_header_buff, id3v2_header_t* header) {
 	uint8_t tmp_size[4];
 
@@ -297,7 +1019,8 @@ int parse_id3v2_header(unsigned char **p_header_buff, id3v2_header_t* header) {
 	print_hexa(*p_header_buff, 10);
 #endif
 
-	snprintf((char*) header->id, 4, (char*) *p_header_buff);
+	memcpy(header->id, *p_header_buff, 3);
+	header->id[3] = '\0';
 	*p_header_buff += 3;
 	if(strcmp("ID3", (char *) header->id) != 0) {
 		fprintf(stderr, "There is no ID3 tag in front of the file\n");
@@ -316,24 +1039,127 @@ int parse_id3v2_header(unsigned char **p_header_buff, id3v2_header_t* header) {
 }
 
 
-int skip_id3v2_extended_header(unsigned char **p_header_buff) {
-	uint8_t tmp_size[4];
-	uint32_t size;
+int parse_id3v2_extended_header(unsigned char **p_header_buff, uint32_t len, id3v2_extended_header_t *ext_header) {
+	unsigned char *p = *p_header_buff;
+	uint32_t pos;
+	uint8_t data_len;
+	uint8_t flag;
 
 #ifdef DEBUG
 	print_hexa(*p_header_buff, 6);
 #endif
 
-	/* Parse size of the extended header */
-	memcpy(&tmp_size[0], *p_header_buff, 4);
-	*p_header_buff += 4;
-	size = ((tmp_size[0] & 0x7F) << 21) | ((tmp_size[1] & 0x7F) << 14) | ((tmp_size[2] & 0x7F) << 7) | (tmp_size[3] & 0x7F);
+	memset(ext_header, 0, sizeof(*ext_header));
+	if(len < 6) {
+		return 1;
+	}
+
+	/* Size of the whole extended header, stored as synchsafe integer */
+	ext_header->size = ((p[0] & 0x7F) << 21) | ((p[1] & 0x7F) << 14) | ((p[2] & 0x7F) << 7) | (p[3] & 0x7F);
+	if(ext_header->size < 6 || ext_header->size > len || p[4] != 1) {
+		return 1;
+	}
+	ext_header->flags = p[5];
+	pos = 6;
+
+	/* Data of set flags follow in the order of flags, each starts with its length byte */
+	for(flag = FLAG_EXT_UPDATE; flag >= FLAG_EXT_RESTRICT; flag >>= 1) {
+		if(!(ext_header->flags & flag)) {
+			continue;
+		}
+		if(pos >= ext_header->size) {
+			return 1;
+		}
+		data_len = p[pos++];
+		if(pos + data_len > ext_header->size) {
+			return 1;
+		}
+		if(flag == FLAG_EXT_CRC) {
+			if(data_len != 5) {
+				return 1;
+			}
+			/* 32 bit CRC is stored as 35 bit synchsafe integer */
+			ext_header->crc = ((uint32_t) (p[pos] & 0x7F) << 28) | ((p[pos+1] & 0x7F) << 21) | ((p[pos+2] & 0x7F) << 14)
+					| ((p[pos+3] & 0x7F) << 7) | (p[pos+4] & 0x7F);
+		}
+		else if(flag == FLAG_EXT_RESTRICT) {
+			if(data_len != 1) {
+				return 1;
+			}
+			ext_header->restrictions = p[pos];
+		}
+		pos += data_len;
+	}
+
+	*p_header_buff += ext_header->size;
+
+	return 0;
+}
+
+
+void set_integrity_check(uint8_t enable) {
+	integrity_check = enable;
+}
 
-	/* Skip next 2 bytes of information */
-	*p_header_buff += 2;
 
-	/* Skip body of external header */
-	*p_header_buff += size;
+int verify_id3v2_tag(id3v2_header_t header, id3v2_extended_header_t ext_header, unsigned char *data, uint32_t len) {
+	static const uint32_t max_tag_size[] = {1024 * 1024, 128 * 1024, 40 * 1024, 4 * 1024};
+
+	/* Oversized tag is rejected without looking at its frames */
+	if((ext_header.flags & FLAG_EXT_RESTRICT) && header.size > max_tag_size[RESTRICT_TAG_SIZE(ext_header.restrictions)]) {
+		fprintf(stderr, "ID3 tag size %u exceeds restriction of %u bytes\n", header.size,
+				max_tag_size[RESTRICT_TAG_SIZE(ext_header.restrictions)]);
+		return 1;
+	}
+
+	/* CRC covers frames and padding, i.e. tag data after the extended header */
+	if(ext_header.flags & FLAG_EXT_CRC) {
+		uint32_t crc = crc32_update(0, data, len);
+		if(crc != ext_header.crc) {
+			fprintf(stderr, "CRC-32 of ID3 tag is %08x, expected %08x\n", crc, ext_header.crc);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+int check_id3v2_frame_restrictions(uint8_t restrictions, id3v2_frame_header_t header, unsigned char *body, uint32_t frames_count) {
+	static const uint32_t max_frames[] = {128, 64, 32, 32};
+	static const uint32_t max_text_len[] = {0, 1024, 128, 30};
+	uint32_t i;
+	uint32_t chars;
+
+	if(frames_count > max_frames[RESTRICT_TAG_SIZE(restrictions)]) {
+		fprintf(stderr, "ID3 tag has more than %u frames\n", max_frames[RESTRICT_TAG_SIZE(restrictions)]);
+		return 1;
+	}
+
+	/* Text restrictions can be checked only for frames stored as they are */
+	if(header.id[0] != 'T' || header.size == 0
+			|| (header.flags & (FLAG_FR_GROUP | FLAG_FR_COMP | FLAG_FR_ENCR | FLAG_FR_UNSYNC | FLAG_FR_LEN))) {
+		return 0;
+	}
+
+	if((restrictions & RESTRICT_TEXT_ENC) && body[0] != ENC_ISO_8859_1 && body[0] != ENC_UTF_8) {
+		fprintf(stderr, "Text encoding %u is restricted\n", body[0]);
+		return 1;
+	}
+
+	if(RESTRICT_TEXT_SIZE(restrictions) != 0 && (body[0] == ENC_ISO_8859_1 || body[0] == ENC_UTF_8)) {
+		/* Count characters, i.e. bytes which are not UTF-8 continuation bytes */
+		chars = 0;
+		for(i = 1; i < header.size; i++) {
+			if(body[0] == ENC_ISO_8859_1 || (body[i] & 0xC0) != 0x80) {
+				chars++;
+			}
+		}
+		if(chars > max_text_len[RESTRICT_TEXT_SIZE(restrictions)]) {
+			fprintf(stderr, "Text has more than %u characters\n", max_text_len[RESTRICT_TEXT_SIZE(restrictions)]);
+			return 1;
+		}
+	}
 
 	return 0;
 }
@@ -347,7 +1173,8 @@ int parse_id3v2_frame_header(unsigned char **p_header_buff, id3v2_frame_header_t
 	print_hexa(*p_header_buff, 10);
 #endif
 
-	snprintf((char*) header->id, 5, (char*) *p_header_buff);
+	memcpy(header->id, *p_header_buff, 4);
+	header->id[4] = '\0';
 	*p_header_buff += 4;
 	if(header->id[0] == (unsigned char) 0x00) {
 		/* Frame is empty so the rest of ID3 tag does */
@@ -366,13 +1193,18 @@ int parse_id3v2_frame_header(unsigned char **p_header_buff, id3v2_frame_header_t
 }
 
 
-int parse_id3v2_frame_body(unsigned char **p_header_buff, id3v2_frame_header_t header) {
+int parse_id3v2_frame_body(id3v2_tag_t *tag, unsigned char **p_header_buff, id3v2_frame_header_t header) {
 	uint32_t i;
 	uint32_t j;
 	uint8_t encoding;
 	uint32_t len;
 	uint8_t type;
 	uint8_t found;
+	uint32_t data_len;
+	uint32_t header_size = header.size;
+	unsigned char *data;
+	unsigned char *p;
+	int result;
 
 #ifdef DEBUG
 		printf("\t\t");
@@ -380,25 +1212,74 @@ int parse_id3v2_frame_body(unsigned char **p_header_buff, id3v2_frame_header_t h
 #endif
 
 	i = 0;
+	data_len = 0;
+
+	/* Skip grouping identity byte */
+	if(header.flags & FLAG_FR_GROUP) {
+		i++;
+	}
 
-	/* Skip length info - not particularly useful for parsing */
+	/* Encrypted frames cannot be decoded */
+	if(header.flags & FLAG_FR_ENCR) {
+		fprintf(stderr, "Frame %s is encrypted, it is skipped\n", header.id);
+		*p_header_buff += header.size;
+		return 0;
+	}
+
+	/* Data length indicator gives exact size of the decompressed frame body */
 	if(header.flags & FLAG_FR_LEN) {
+		if(header.size < i + 4) {
+			fprintf(stderr, "Frame %s is too small to include data length indicator\n", header.id);
+			return 1;
+		}
+		p = *p_header_buff + i;
+		data_len = ((p[0] & 0x7F) << 21) | ((p[1] & 0x7F) << 14) | ((p[2] & 0x7F) << 7) | (p[3] & 0x7F);
 		i += 4;
 	}
 
+	/* Decompress the frame body and parse it as the uncompressed one */
+	if(header.flags & FLAG_FR_COMP) {
+		if(!(header.flags & FLAG_FR_LEN)) {
+			fprintf(stderr, "Compressed frame %s is missing data length indicator, it is skipped\n", header.id);
+			*p_header_buff += header.size;
+			return 0;
+		}
+		if(inflate_id3v2_frame(*p_header_buff + i, header.size - i, header.flags & FLAG_FR_UNSYNC, data_len, &data) != 0) {
+			fprintf(stderr, "Error while decompressing frame %s, it is skipped\n", header.id);
+			*p_header_buff += header.size;
+			return 0;
+		}
+
+		/* Decompressed body has neither additional information nor unsynchronisation */
+		header.flags &= ~(FLAG_FR_GROUP | FLAG_FR_COMP | FLAG_FR_UNSYNC | FLAG_FR_LEN);
+		header.size = data_len;
+		p = data;
+		result = parse_id3v2_frame_body(tag, &p, header);
+		free_id3v2_memory(data);
+
+		*p_header_buff += header_size;
+		return result;
+	}
+
+	/* Decoded frames start with the text encoding */
+	if(i >= header.size) {
+		*p_header_buff += header.size;
+		return 0;
+	}
+
 	if(header.id[0] == 'T') { /* Process 'Text information frame' */
-		/* Select id3v2_textinfo[j] to store the parsed data */
+		/* Select tag->text[j] to store the parsed data */
 		for(j = 0; id3v2_textinfo[j].id; j++) {
 			if(strcmp(id3v2_textinfo[j].id, (char*) header.id) == 0) {
+				/* Duplicate frame (or frame of stacked tag) does not replace the first one */
+				if(tag->text[j] != NULL) {
+					break;
+				}
 				encoding = (uint8_t)*(*p_header_buff+i++);
 				if(encoding == ENC_UTF_8 || encoding == ENC_ISO_8859_1) { /* UTF-8 encoding or ISO-8859-1 */
-					id3v2_textinfo[j].text = malloc(header.size);
-
-					/* strncpy is preferred to use to snprintf because string read is not terminated by '\0' */
-					strncpy(id3v2_textinfo[j].text, (char*) *p_header_buff+i, header.size-1);
-					id3v2_textinfo[j].text[header.size-1] = '\0';
-
-					//len = snprintf(id3v2_textinfo[j].text, header.size, (char*) *p_header_buff+i);
+					/* Text is not always terminated by $00, it ends with the frame then */
+					len = find_field_end(*p_header_buff+i, header.size-i, encoding);
+					tag->text[j] = copy_field(*p_header_buff+i, len);
 				}
 				else {
 					fprintf(stderr, "Decoding of encoding type %u is not supported (it is not typical to use it for ID3v2.4 tag)\n", encoding);
@@ -407,20 +1288,21 @@ int parse_id3v2_frame_body(unsigned char **p_header_buff, id3v2_frame_header_t h
 			}
 		}
 	}
-	else if(strcmp((char *) header.id, "USLT") == 0) { /* Process 'Unsynchronised lyrics' */
+	else if(strcmp((char *) header.id, "USLT") == 0 && tag->lyrics.text == NULL) { /* Process 'Unsynchronised lyrics' */
 		encoding = (uint8_t)*(*p_header_buff+i++);
-		if(encoding == ENC_UTF_8 || encoding == ENC_ISO_8859_1) {
-			id3v2_lyrics.lang = malloc(4);
-			snprintf(id3v2_lyrics.lang, 4, (char*) *p_header_buff+i);
+		if(header.size - i < 3) {
+			fprintf(stderr, "Frame %s is too small to include language\n", header.id);
+		}
+		else if(encoding == ENC_UTF_8 || encoding == ENC_ISO_8859_1) {
+			tag->lyrics.lang = copy_field(*p_header_buff+i, find_field_end(*p_header_buff+i, 3, ENC_ISO_8859_1));
 			i += 3;
 
-			len = strlen((char *) *p_header_buff+i);
-			id3v2_lyrics.descr = malloc(len + 1);
-			snprintf((char *) id3v2_lyrics.descr, len + 1, (char*) *p_header_buff+i);
-			i += len + 1;
+			len = find_field_end(*p_header_buff+i, header.size-i, encoding);
+			tag->lyrics.descr = copy_field(*p_header_buff+i, len);
+			i += skip_field(len, header.size-i, encoding);
 
-			id3v2_lyrics.text = malloc(header.size-i+1);
-			snprintf(id3v2_lyrics.text, header.size-i+1, (char*) *p_header_buff+i);
+			len = find_field_end(*p_header_buff+i, header.size-i, encoding);
+			tag->lyrics.text = copy_field(*p_header_buff+i, len);
 		}
 		else {
 			fprintf(stderr, "Not able to decode USLT tag\n");
@@ -428,10 +1310,15 @@ int parse_id3v2_frame_body(unsigned char **p_header_buff, id3v2_frame_header_t h
 	}
 	else if(strcmp((char *) header.id, "APIC") == 0) { /* Process 'Attached picture' */
 		encoding = (uint8_t)*(*p_header_buff+i++);
-		len = strlen((char *) *p_header_buff+i);
+		len = find_field_end(*p_header_buff+i, header.size-i, ENC_ISO_8859_1);
+		if(i + len + 1 >= header.size) {
+			fprintf(stderr, "Frame %s is too small to include picture type\n", header.id);
+			*p_header_buff += header.size;
+			return 0;
+		}
 		type = (uint8_t)*(*p_header_buff+i+len+1); /* Read 'type' first (is after mime) */
 
-		/* Select id3frame_apic_type[j] to store the parsed data */
+		/* Select tag->pictures[j] to store the parsed data */
 		found = 0;
 		for(j = 0; id3frame_apic_type[j].type != 0xff; j++) {
 			if(type == id3frame_apic_type[j].type) {
@@ -439,22 +1326,26 @@ int parse_id3v2_frame_body(unsigned char **p_header_buff, id3v2_frame_header_t h
 				break;
 			}
 		}
-		if(found) {
-			id3frame_apic_type[j].mime = malloc(len + 1);
-			snprintf(id3frame_apic_type[j].mime, len + 1, (char*) *p_header_buff+i);
+		if(found && tag->pictures[j].data == NULL) {
+			tag->pictures[j].mime = copy_field(*p_header_buff+i, len);
 			i += len + 1 + 1; /* Now skip 'type' because it is already read */
 
-			len = strlen((char *) *p_header_buff+i);
-			id3frame_apic_type[j].descr = malloc(len + 1);
-			snprintf(id3frame_apic_type[j].descr, len + 1, (char*) *p_header_buff+i);
-			i += len + 1;
+			/* UTF-16 description is skipped, it only has to be found to locate the picture */
+			len = find_field_end(*p_header_buff+i, header.size-i, encoding);
+			if(encoding == ENC_UTF_8 || encoding == ENC_ISO_8859_1) {
+				tag->pictures[j].descr = copy_field(*p_header_buff+i, len);
+			}
+			i += skip_field(len, header.size-i, encoding);
 
 			len = header.size - i;
-			id3frame_apic_type[j].data = malloc(len);
-			memset(id3frame_apic_type[j].data, 0, len);
-			memcpy(id3frame_apic_type[j].data, *p_header_buff+i, len);
-			id3frame_apic_type[j].len = len;
-			id3frame_apic_type[j].flags = header.flags;
+			tag->pictures[j].data = alloc_id3v2_memory(len ? len : 1);
+			if(tag->pictures[j].data == NULL) {
+				fprintf(stderr, "Error while allocating memory for picture of frame %s!\n", header.id);
+				return 1;
+			}
+			memcpy(tag->pictures[j].data, *p_header_buff+i, len);
+			tag->pictures[j].len = len;
+			tag->pictures[j].flags = header.flags;
 		}
 	}
 #ifdef DEBUG
@@ -470,6 +1361,47 @@ int parse_id3v2_frame_body(unsigned char **p_header_buff, id3v2_frame_header_t h
 }
 
 
+int inflate_id3v2_frame(unsigned char *buffer, uint32_t len, int unsync, uint32_t data_len, unsigned char **p_data) {
+	z_stream stream;
+	int ret;
+
+	/* Data length indicator is not trusted, it cannot claim more than the compressed data can produce */
+	*p_data = NULL;
+	if(data_len > MAX_INFLATE_LEN || data_len > (uint64_t) len * MAX_INFLATE_RATIO) {
+		fprintf(stderr, "Data length indicator (%u bytes) exceeds the limit of decompressed frame\n", data_len);
+		return 1;
+	}
+
+	/* Output is allocated only once, longer decompressed data are an error */
+	*p_data = alloc_id3v2_memory(data_len ? data_len : 1);
+	if(*p_data == NULL) {
+		fprintf(stderr, "Error while allocating memory for decompressed frame!\n");
+		return 1;
+	}
+
+	memset(&stream, 0, sizeof(stream));
+	if(inflateInit(&stream) != Z_OK) {
+		free_id3v2_memory(*p_data);
+		*p_data = NULL;
+		return 1;
+	}
+	stream.next_out = *p_data;
+	stream.avail_out = data_len;
+
+	/* Z_BUF_ERROR means that data are longer than data length indicator says */
+	ret = inflate_frame_data(&stream, buffer, len, unsync);
+	inflateEnd(&stream);
+	if(ret != Z_STREAM_END || stream.total_out != data_len) {
+		fprintf(stderr, "Decompressed data do not match data length indicator (%u bytes)\n", data_len);
+		free_id3v2_memory(*p_data);
+		*p_data = NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+
 void print_hexa(unsigned char *buffer, size_t len) {
 	size_t i;
 	for(i = 0; i<len; i++) {
@@ -510,135 +1442,60 @@ void print_id3v2_frame_header(id3v2_frame_header_t header) {
 }
 
 
-int write_parsed_data(char * orig_name) {
-	uint32_t i;
-	uint32_t j;
-	uint16_t len;
-	FILE *p_file;
-	FILE *p_file_image;
-	char *filename;
-	char *filename_image;
-	char *extension;
-
-	/* Write textual information from ID3 tag */
-	len = strlen(orig_name) + strlen(".tag.txt") + 1;
-	filename = malloc(len);
-	snprintf(filename, len, "%s%s", orig_name, ".tag.txt");
-
-	p_file = fopen(filename, "wb");
-	if(p_file == NULL) {
-		fprintf(stderr, "Error while opening file %s to write!\n", filename);
-		free(filename);
-		return 1;
-	}
-
-	fprintf(p_file, "Textual information parsed from file %s:\n", orig_name);
-	if(ferror (p_file)) {
-		fprintf(stderr, "Error while writing into file %s!\n", filename);
-		fclose(p_file);
-		free(filename);
-		return 1;
-	}
-	for(i=0; id3v2_textinfo[i].id; i++) {
-		if(id3v2_textinfo[i].text){
-			fprintf(p_file, "\t%s %s\n", id3v2_textinfo[i].info, id3v2_textinfo[i].text);
-			if(ferror (p_file)) {
-				fprintf(stderr, "Error while writing into file %s!\n", filename);
-				fclose(p_file);
-				return 1;
-			}
-		}
-	}
-
-	for(i=0; id3frame_apic_type[i].type != 0xff; i++) {
-		/* Write picture information from ID3 tag */
-		if(id3frame_apic_type[i].data){
-			len = sizeof(id3frame_apic_type[i].mime);
-			extension = malloc(len);
-			memset(extension, 0, len);
-			sscanf(id3frame_apic_type[i].mime, "%*[^/],%s", extension);
-
-			len = sizeof(orig_name) + sizeof(id3frame_apic_type[i].text) + sizeof(extension) + 3;
-			filename_image = malloc(len);
-			snprintf(filename_image, len, "%s.%s.%s", orig_name, id3frame_apic_type[i].text, extension);
-
-			p_file_image = fopen(filename_image, "wb");
-			unsigned char *p_data = id3frame_apic_type[i].data;
-			for(j = 0; j < id3frame_apic_type[i].len; j++) {
-				fwrite(p_data+j, 1 , 1, p_file_image);
-				if(id3frame_apic_type[i].flags & FLAG_FR_UNSYNC) { // if unsynchronization occurs
-					if((*(p_data+j) == 0xff) && (*(p_data+j+1) == 0x00)) {
-						j++;
-					}
-				}
-			}
-			fclose(p_file_image);
-
-
-			fprintf(p_file, "Picture:\n\t%s\n", id3frame_apic_type[i].mime);
-			if(id3frame_apic_type[i].descr) {
-				fprintf(p_file, "\tdescription: %s\n", id3frame_apic_type[i].descr);
-			}
-			fprintf(p_file, "\tpicture is stored in file %s\n", filename_image);
+void print_id3v2_event(void *opaque, const id3v2_event_t *event) {
+	(void) opaque;
 
-			free(extension);
-			free(filename_image);
+	switch(event->type) {
+	case EVENT_BUFFER:
+		if(event->path) {
+			printf("File: %s\n", event->path);
 		}
+		printf("Read tag data length: %u\n", event->len);
+		break;
+	case EVENT_TAG:
+		print_id3v2_header(*event->header);
+		break;
+	case EVENT_FRAME:
+		print_id3v2_frame_header(*event->frame_header);
+		break;
+	case EVENT_END:
+		printf("\n");
+		break;
 	}
-
-	if(id3v2_lyrics.text) {
-		fprintf(p_file, "Lyrics:\n\tLanguage: %s\n%s\n", id3v2_lyrics.lang, id3v2_lyrics.text);
-	}
-	if(ferror (p_file)) {
-		fprintf(stderr, "Error while writing into file %s!\n", filename);
-		fclose(p_file);
-		return 1;
-	}
-
-	printf("\nParsed ID3 tag textual frames written into file %s\n", filename);
-	fclose(p_file);
-	free(filename);
-
-	return 0;
 }
 
 
-void deallocate_memory(unsigned char *buffer) {
+void deallocate_memory(id3v2_tag_t *tag, unsigned char *buffer) {
 	uint16_t i;
 
 	/* Free memory for buffer of input MP3 file */
-	free(buffer);
+	free_id3v2_memory(buffer);
 
-	/* Free memory for each id3v2_textinfo.text */
+	/* Free memory for each tag->text */
 	for(i=0; id3v2_textinfo[i].id; i++) {
-		if(id3v2_textinfo[i].text){
-			free(id3v2_textinfo[i].text);
+		if(tag->text[i]){
+			free_id3v2_memory(tag->text[i]);
 		}
 	}
-	printf("\n");
 
-	/* Free memory for id3v2_lyrics items */
-	if(id3v2_lyrics.descr) {
-		free(id3v2_lyrics.descr);
-	}
-	if(id3v2_lyrics.text) {
-		free(id3v2_lyrics.text);
-	}
+	/* Free memory for tag->lyrics items */
+	free_id3v2_memory(tag->lyrics.lang);
+	free_id3v2_memory(tag->lyrics.descr);
+	free_id3v2_memory(tag->lyrics.text);
 
-	/* Free memory for id3frame_apic_type items */
+	/* Free memory for tag->pictures items */
 	for(i=0; id3frame_apic_type[i].type != 0xff; i++) {
-		if(id3frame_apic_type[i].mime){
-			free(id3frame_apic_type[i].mime);
+		if(tag->pictures[i].mime){
+			free_id3v2_memory(tag->pictures[i].mime);
 		}
-		if(id3frame_apic_type[i].descr){
-			free(id3frame_apic_type[i].descr);
+		if(tag->pictures[i].descr){
+			free_id3v2_memory(tag->pictures[i].descr);
 		}
-		if(id3frame_apic_type[i].data){
-			free(id3frame_apic_type[i].data);
+		if(tag->pictures[i].data){
+			free_id3v2_memory(tag->pictures[i].data);
 		}
 	}
-}
-
-
-
 
+	/* Structure can be reused by the next parsed file in batch mode */
+	init_id3v2_tag(tag);
+}
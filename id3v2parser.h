@@ -1,5 +1,5 @@
 /*
- * id3v2parser - program to parse ID3v2.4 tags
+ * id3v2parser - library to parse ID3v2.4 tags
  *
  *  Copyright (c) 2014 - Martin Rabek
  *  All rights reserved.
@@ -31,6 +31,16 @@
 #ifndef ID3V2PARSER_H_
 #define ID3V2PARSER_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+/** Version of the library API, new major version breaks compatibility */
+#define ID3V2_VERSION_MAJOR 1
+#define ID3V2_VERSION_MINOR 0
+#define ID3V2_VERSION_PATCH 0
+/** Version of the library API as one number (0x010000 for 1.0.0) */
+#define ID3V2_VERSION ((ID3V2_VERSION_MAJOR << 16) | (ID3V2_VERSION_MINOR << 8) | ID3V2_VERSION_PATCH)
+
 /** Specification as taken from http://id3.org/id3v2.4.0-structure
 
  * Overall tag structure:
@@ -88,7 +98,8 @@
    $80.
 
 
- * Extended header (not used in this parser)
+ * Extended header (CRC and restrictions are checked only when integrity
+   check is enabled)
 
    The extended header contains information that can provide further
    insight in the structure of the tag, but is not vital to the correct
@@ -119,6 +130,41 @@
    field length indicated by the length byte. If a flag has no attached
    data, the value $00 is used as length byte.
 
+   c - CRC data present
+
+     If this flag is set, a CRC-32 [ISO-3309] data is included in the
+     extended header. The CRC is calculated on all the data between the
+     header and footer as indicated by the header's tag length field,
+     minus the extended header. The CRC is stored as a 35 bit synchsafe
+     integer.
+
+       Flag data length       $05
+       Total frame CRC    5 * %0xxxxxxx
+
+   d - Tag restrictions
+
+       Flag data length       $01
+       Restrictions           %ppqrrstt
+
+     p - Tag size restrictions
+
+       00   No more than 128 frames and 1 MB total tag size.
+       01   No more than 64 frames and 128 KB total tag size.
+       10   No more than 32 frames and 40 KB total tag size.
+       11   No more than 32 frames and 4 KB total tag size.
+
+     q - Text encoding restrictions
+
+       0    No restrictions
+       1    Strings are only encoded with ISO-8859-1 or UTF-8.
+
+     r - Text fields size restrictions
+
+       00   No restrictions
+       01   No string is longer than 1024 characters.
+       10   No string is longer than 128 characters.
+       11   No string is longer than 30 characters.
+
 
  * ID3v2 frame header
 
@@ -326,6 +372,8 @@
 
 /** Macros for encoding */
 #define ENC_ISO_8859_1 0x00
+#define ENC_UTF_16 0x01
+#define ENC_UTF_16BE 0x02
 #define ENC_UTF_8 0x03
 
 
@@ -351,6 +399,38 @@ typedef struct id3v2_header_s {
 #define FLAG_ID3_FOOTER 0x10
 
 
+/** ID3 tag extended header structure */
+
+typedef struct id3v2_extended_header_s {
+	uint32_t size;			/**< size of the whole extended header */
+	uint8_t flags;			/**< extended flags */
+	uint32_t crc;			/**< CRC-32 of the tag data, if FLAG_EXT_CRC is set */
+	uint8_t restrictions;	/**< tag restrictions, if FLAG_EXT_RESTRICT is set */
+} id3v2_extended_header_t;
+
+/** Macros for flags in ID3 tag extended header */
+
+/** Tag is an update flag */
+#define FLAG_EXT_UPDATE 0x40
+/** CRC data present flag */
+#define FLAG_EXT_CRC 0x20
+/** Tag restrictions flag */
+#define FLAG_EXT_RESTRICT 0x10
+
+/** Macros for tag restrictions %ppqrrstt */
+
+/** Tag size restriction (pp) */
+#define RESTRICT_TAG_SIZE(r) (((r) >> 6) & 0x03)
+/** Text encoding restriction (q) */
+#define RESTRICT_TEXT_ENC 0x20
+/** Text fields size restriction (rr) */
+#define RESTRICT_TEXT_SIZE(r) (((r) >> 3) & 0x03)
+/** Image encoding restriction (s) */
+#define RESTRICT_IMG_ENC 0x04
+/** Image size restriction (tt) */
+#define RESTRICT_IMG_SIZE(r) ((r) & 0x03)
+
+
 /** ID3 frame header structure */
 
 typedef struct id3v2_frame_header_s {
@@ -378,6 +458,203 @@ typedef struct id3v2_frame_header_s {
 /** Data length indicator flag */
 #define FLAG_FR_LEN 0x0001
 
+/** Size of the chunk used to undo unsynchronisation of compressed frame */
+#define INFLATE_CHUNK_LEN 4096
+/** Largest decompressed frame body, larger compressed frames are skipped */
+#define MAX_INFLATE_LEN (16 * 1024 * 1024)
+/** Largest ratio of decompressed and compressed length which zlib can produce */
+#define MAX_INFLATE_RATIO 1032
+/** Length of decompressed APIC frame start searched for the picture type by the filter */
+#define PICTURE_TYPE_SCAN_LEN 256
+
+/** Length of RIFF/FORM container header (ID, size and form type) */
+#define CONTAINER_HEADER_LEN 12
+/** Length of RIFF/FORM chunk header (ID and size) */
+#define CHUNK_HEADER_LEN 8
+/** Maximal number of container chunks walked when looking for ID3 chunk */
+#define MAX_CONTAINER_CHUNKS 4096
+
+/** Length of the beginning of the file scanned for ID3 tag preceded by junk */
+#define RESYNC_SCAN_LEN 16384
+/** Maximal number of stacked (consecutive) ID3 tags which are parsed */
+#define MAX_STACKED_TAGS 8
+
+
+/** Number of supported text information frames */
+#define TEXTINFO_COUNT 45
+/** Number of picture types */
+#define APIC_TYPE_COUNT 21
+
+
+/** Lyrics information structure */
+
+typedef struct id3v2_lyrics_s {
+	char *lang;				/**< language of the lyrics */
+	char *descr;			/**< description of the lyrics */
+	char *text;				/**< lyrics text */
+} id3v2_lyrics_t;
+
+/** Picture information structure */
+
+typedef struct id3v2_picture_s {
+	char *mime;				/**< mime type of the image */
+	char *descr;			/**< description of the image */
+	unsigned char *data;	/**< binary data of the image */
+	uint16_t flags;			/**< flags of the frame header */
+	uint32_t len;			/**< length of store binary data */
+} id3v2_picture_t;
+
+/** Parsed ID3 tag, one per parsed file so more files can be parsed in parallel */
+
+typedef struct id3v2_tag_s {
+	char *text[TEXTINFO_COUNT];	/**< texts of text information frames, in order of get_id3v2_text_id() */
+	id3v2_lyrics_t lyrics;		/**< unsynchronised lyrics */
+	id3v2_picture_t pictures[APIC_TYPE_COUNT];	/**< attached pictures, indexed by picture type */
+} id3v2_tag_t;
+
+/** Compiled filter, see id3v2filter.h */
+struct id3v2_filter_s;
+
+/** Digest of ID3 tag, see id3v2digest.h */
+struct id3v2_digest_s;
+
+/** Allocator of tag data and read buffers
+
+   All memory which the library hands over to the caller (texts, lyrics
+   and pictures of id3v2_tag_t, buffers of read_file() and
+   read_tag_prefix()) is allocated by the allocator and must be released
+   by deallocate_memory() or free_id3v2_memory(). Internal structures of
+   the index builders are allocated by malloc().
+ */
+
+typedef struct id3v2_allocator_s {
+	void *opaque;			/**< passed to the functions */
+	void *(*realloc)(void *opaque, void *ptr, size_t len);	/**< allocate (ptr is NULL) or resize memory */
+	void (*free)(void *opaque, void *ptr);	/**< release memory (ptr is not NULL) */
+} id3v2_allocator_t;
+
+/** Events of parsing
+
+   Parsed headers of tags and frames are delivered as events to the
+   listener instead of being printed by the parser. print_id3v2_event()
+   is the default listener, it prints them to the standard output. The
+   verbosity selects the delivered events, in quiet mode no event is
+   built and nothing is formatted. Threads parsing in parallel deliver
+   their events from those threads, parse_buffer_context() gives each
+   call its own listener and verbosity and the path of the parsed file
+   passed in the events to tell the files apart.
+ */
+
+/** Verbosity of parsing */
+#define VERBOSITY_QUIET 0
+#define VERBOSITY_TAGS 1
+#define VERBOSITY_FRAMES 2
+
+/** Types of events */
+#define EVENT_BUFFER 0
+#define EVENT_TAG 1
+#define EVENT_FRAME 2
+#define EVENT_END 3
+
+typedef struct id3v2_event_s {
+	uint8_t type;			/**< EVENT_* type, EVENT_FRAME only with VERBOSITY_FRAMES */
+	uint32_t len;			/**< length of the parsed buffer, i.e. of the read tag data, not of the file (EVENT_BUFFER) */
+	uint32_t offset;		/**< offset of the frame in its tag (EVENT_FRAME) */
+	const id3v2_header_t *header;	/**< tag header (EVENT_TAG) */
+	const id3v2_frame_header_t *frame_header;	/**< frame header (EVENT_FRAME) */
+	int result;				/**< 0 if the buffer was parsed, 1 if not (EVENT_END) */
+	const char *path;		/**< path of the parsed file, NULL if it is not known */
+} id3v2_event_t;
+
+typedef struct id3v2_listener_s {
+	void *opaque;			/**< passed to the function */
+	void (*event)(void *opaque, const id3v2_event_t *event);	/**< handle the event */
+} id3v2_listener_t;
+
+typedef struct id3v2_parse_context_s {
+	const id3v2_listener_t *listener;	/**< listener of the events, NULL for the one of set_id3v2_listener() */
+	uint8_t verbosity;		/**< VERBOSITY_* verbosity of this call */
+	const char *path;		/**< path of the parsed file passed in the events, may be NULL */
+} id3v2_parse_context_t;
+
+
+/**
+ * Initialize empty ID3 tag structure
+ * @param tag			pointer to the ID3 tag structure
+ */
+void init_id3v2_tag(id3v2_tag_t *tag);
+
+/**
+ * Get frame ID code of the text information frame
+ * @param index			index of the text in id3v2_tag_t (less than TEXTINFO_COUNT)
+ * @return				four-char frame ID code
+ */
+const char *get_id3v2_text_id(uint32_t index);
+
+/**
+ * Get description of the text information frame
+ * @param index			index of the text in id3v2_tag_t (less than TEXTINFO_COUNT)
+ * @return				description padded for printing
+ */
+const char *get_id3v2_text_info(uint32_t index);
+
+/**
+ * Get description of the picture type
+ * @param index			picture type (less than APIC_TYPE_COUNT)
+ * @return				description of the picture type
+ */
+const char *get_id3v2_picture_type(uint32_t index);
+
+/**
+ * Get version of the linked library, to be compared with ID3V2_VERSION
+ * @return				version of the library API
+ */
+unsigned long get_id3v2_version(void);
+
+/**
+ * Set allocator of tag data and read buffers, must be called before any tag is parsed
+ * @param allocator		allocator (copied), NULL restores realloc() and free()
+ */
+void set_id3v2_allocator(const id3v2_allocator_t *allocator);
+
+/**
+ * Set listener of parsing events, must be called before any tag is parsed
+ * @param listener		listener (copied), NULL restores print_id3v2_event()
+ */
+void set_id3v2_listener(const id3v2_listener_t *listener);
+
+/**
+ * Set verbosity of parsing, i.e. which events are delivered to the listener
+ * @param verbosity		VERBOSITY_QUIET, VERBOSITY_TAGS or VERBOSITY_FRAMES (default)
+ */
+void set_id3v2_verbosity(uint8_t verbosity);
+
+/**
+ * Get verbosity of parsing
+ * @return				VERBOSITY_* verbosity
+ */
+uint8_t get_id3v2_verbosity(void);
+
+/**
+ * Allocate memory by the allocator of the library
+ * @param len			length of the memory
+ * @return				memory or NULL if problem has occurred
+ */
+void *alloc_id3v2_memory(size_t len);
+
+/**
+ * Resize memory allocated by the allocator of the library
+ * @param ptr			memory to resize or NULL
+ * @param len			new length of the memory
+ * @return				memory or NULL if problem has occurred (ptr is kept)
+ */
+void *realloc_id3v2_memory(void *ptr, size_t len);
+
+/**
+ * Release memory allocated by the allocator of the library
+ * @param ptr			memory to release or NULL
+ */
+void free_id3v2_memory(void *ptr);
 
 /**
  * Read content of the file and store it into the buffer
@@ -389,12 +666,87 @@ typedef struct id3v2_frame_header_s {
 int read_file(char * name, unsigned char ** p_buffer, uint32_t * p_len);
 
 /**
- * Parse buffer of binary file
+ * Get length of ID3 tag including its header and footer from the beginning of the file
+ * @param header		beginning of the file
+ * @param len			length of the beginning, at least HEADER_LEN to recognize the tag
+ * @return				length of the tag, or of the beginning (at most HEADER_LEN) if there is no tag
+ */
+uint32_t get_id3v2_tag_length(const unsigned char *header, uint32_t len);
+
+/**
+ * Find ID3 tag at the beginning of the file, in ID3 chunk of WAV (RIFF) or AIFF (FORM) file
+ * or after junk within RESYNC_SCAN_LEN bytes of the beginning of the file
+ * @param fd			file descriptor of the opened file
+ * @param p_offset		pointer to the offset of the tag, 0 if the tag is not found
+ * @return				0 if the tag is found, 1 otherwise
+ */
+int find_id3v2_tag(int fd, uint64_t *p_offset);
+
+/**
+ * Read only ID3 tag (and stacked tags following it) at the offset of the file into reusable buffer
+ * @param fd			file descriptor of the opened file
+ * @param offset		offset of the tag (see find_id3v2_tag())
+ * @param p_buffer		pointer to the buffer (may be NULL), it is reallocated if it is too small
+ * @param p_capacity	pointer to the allocated length of the buffer
+ * @param p_len			pointer to the length of read data
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int read_tag_at(int fd, uint64_t offset, unsigned char **p_buffer, uint32_t *p_capacity, uint32_t *p_len);
+
+/**
+ * Read only ID3 tag of the file, found by find_id3v2_tag(), into reusable buffer
+ * @param fd			file descriptor of the opened file
+ * @param p_buffer		pointer to the buffer (may be NULL), it is reallocated if it is too small
+ * @param p_capacity	pointer to the allocated length of the buffer
+ * @param p_len			pointer to the length of read data
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int read_tag_prefix(int fd, unsigned char **p_buffer, uint32_t *p_capacity, uint32_t *p_len);
+
+/**
+ * Parse buffer of binary file, tag preceded by junk is found within RESYNC_SCAN_LEN bytes
+ * and stacked tags following it are merged (the first frame of each kind is kept)
+ * @param tag			pointer to the initialized ID3 tag structure to store the parsed data
+ * @param buffer		buffer of input MP3 file
+ * @param buffer_len 	length of buffer (input MP3 file)
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int parse_buffer(id3v2_tag_t *tag, unsigned char *buffer, uint32_t buffer_len);
+
+/**
+ * Parse buffer of binary file if it matches the filter (see id3v2filter.h), frames referred to
+ * by the filter are decoded first and the rest of the tag only if the file matches
+ * @param tag			pointer to the initialized ID3 tag structure to store the parsed data
  * @param buffer		buffer of input MP3 file
  * @param buffer_len 	length of buffer (input MP3 file)
+ * @param filter		compiled filter, NULL to parse the tag as parse_buffer()
+ * @param p_match		pointer to the result, 1 if the file matches (the tag is parsed), 0 otherwise
  * @return				0 if OK, 1 if problem has occurred
  */
-int parse_buffer(unsigned char *buffer, uint32_t buffer_len);
+int parse_buffer_where(id3v2_tag_t *tag, unsigned char *buffer, uint32_t buffer_len, const struct id3v2_filter_s *filter, int *p_match);
+
+/**
+ * Parse buffer of binary file as parse_buffer_where() delivering the events by the context
+ * instead of by the listener and verbosity set for the whole process
+ * @param tag			pointer to the initialized ID3 tag structure to store the parsed data
+ * @param buffer		buffer of input MP3 file
+ * @param buffer_len 	length of buffer (input MP3 file)
+ * @param filter		compiled filter, NULL to parse the tag as parse_buffer()
+ * @param context		listener, verbosity and path of the file of this call
+ * @param p_match		pointer to the result, 1 if the file matches (the tag is parsed), 0 otherwise
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int parse_buffer_context(id3v2_tag_t *tag, unsigned char *buffer, uint32_t buffer_len, const struct id3v2_filter_s *filter,
+		const id3v2_parse_context_t *context, int *p_match);
+
+/**
+ * Compute digests of the frames of ID3 tag (and of stacked tags) in the buffer without decoding them
+ * @param buffer		buffer of input MP3 file
+ * @param buffer_len 	length of buffer (input MP3 file)
+ * @param digest		pointer to the initialized digest (see id3v2digest.h), its frames are replaced
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int digest_buffer(unsigned char *buffer, uint32_t buffer_len, struct id3v2_digest_s *digest);
 
 /**
  * Parse first 10 bytes from buffer into ID3 tag header structure
@@ -405,11 +757,39 @@ int parse_buffer(unsigned char *buffer, uint32_t buffer_len);
 int parse_id3v2_header(unsigned char **p_header_buff, id3v2_header_t* header);
 
 /**
- * Skip ID3 tag extended header because it is useless for the parsing process
+ * Parse ID3 tag extended header and move the pointer behind it
  * @param p_header_buff	pointer to the buffer of input MP3 file
- * @return				0 if OK
+ * @param len			size of ID3 tag body (upper bound of the extended header size)
+ * @param ext_header	pointer to the ID3 tag extended header structure
+ * @return				0 if OK, 1 if the extended header is corrupted
  */
-int skip_id3v2_extended_header(unsigned char **p_header_buff);
+int parse_id3v2_extended_header(unsigned char **p_header_buff, uint32_t len, id3v2_extended_header_t *ext_header);
+
+/**
+ * Enable or disable integrity check of parsed ID3 tags (CRC and restrictions)
+ * @param enable		1 to enable, 0 to disable
+ */
+void set_integrity_check(uint8_t enable);
+
+/**
+ * Verify CRC-32 of ID3 tag and its size restriction
+ * @param header		ID3 tag header structure
+ * @param ext_header	ID3 tag extended header structure
+ * @param data			tag data after the extended header (frames and padding)
+ * @param len			length of the tag data
+ * @return				0 if OK, 1 if the tag is corrupted or oversized
+ */
+int verify_id3v2_tag(id3v2_header_t header, id3v2_extended_header_t ext_header, unsigned char *data, uint32_t len);
+
+/**
+ * Check frame against restrictions of ID3 tag (frame count and text encoding and size)
+ * @param restrictions	tag restrictions byte from the extended header
+ * @param header		ID3 frame header structure
+ * @param body			ID3 frame body
+ * @param frames_count	number of frames parsed so far, including this one
+ * @return				0 if OK, 1 if the frame violates restrictions
+ */
+int check_id3v2_frame_restrictions(uint8_t restrictions, id3v2_frame_header_t header, unsigned char *body, uint32_t frames_count);
 
 /**
  * Parse 10 bytes from buffer into ID3 frame header structure
@@ -420,12 +800,26 @@ int skip_id3v2_extended_header(unsigned char **p_header_buff);
 int parse_id3v2_frame_header(unsigned char **p_header_buff, id3v2_frame_header_t* header);
 
 /**
- * Parse ID3 frame body and store data into static structures
+ * Parse ID3 frame body and store data into ID3 tag structure
+ * @param tag			pointer to the ID3 tag structure
  * @param p_header_buff	pointer to the buffer of input MP3 file
  * @param header 		pointer to the ID3 frame header structure
  * @return				0 if OK, 1 if problem has occurred
  */
-int parse_id3v2_frame_body(unsigned char **p_header_buff, id3v2_frame_header_t header);
+int parse_id3v2_frame_body(id3v2_tag_t *tag, unsigned char **p_header_buff, id3v2_frame_header_t header);
+
+
+/**
+ * Decompress zlib compressed frame body into a buffer of exactly data length indicator size,
+ * which may not exceed MAX_INFLATE_LEN and what the compressed length can produce
+ * @param buffer		compressed frame body (after additional information fields)
+ * @param len			length of the compressed frame body
+ * @param unsync		nonzero if unsynchronisation was applied to the frame
+ * @param data_len		decompressed size, as given by data length indicator
+ * @param p_data		pointer to the allocated decompressed data, caller frees it
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int inflate_id3v2_frame(unsigned char *buffer, uint32_t len, int unsync, uint32_t data_len, unsigned char **p_data);
 
 
 /**
@@ -448,17 +842,18 @@ void print_id3v2_header(id3v2_header_t header);
 void print_id3v2_frame_header(id3v2_frame_header_t header);
 
 /**
- * Write parsed data into file(s)
- * @param orig_name		original filename
- * @return				0 if OK, 1 if problem has occurred
+ * Print parsing event, the default listener
+ * @param opaque		unused
+ * @param event			parsing event
  */
-int write_parsed_data(char * orig_name);
+void print_id3v2_event(void *opaque, const id3v2_event_t *event);
 
 /**
- * Free dynamically allocated memory, including buffer and static structures
+ * Free dynamically allocated memory, including buffer and parsed data of ID3 tag
+ * @param tag			pointer to the ID3 tag structure, it is initialized again
  * @param buffer		buffer of input MP3 file
  */
-void deallocate_memory(unsigned char *buffer);
+void deallocate_memory(id3v2_tag_t *tag, unsigned char *buffer);
 
 
 #endif /* ID3V2PARSER_H_ */
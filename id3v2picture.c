@@ -0,0 +1,220 @@
+/*
+ *  id3v2picture - probing of attached pictures
+ *
+ * 	Detects real format, dimensions and size of attached pictures from the
+ * 	first bytes of their data, without decoding the image. See
+ * 	id3v2picture.h for the details.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "id3v2picture.h"
+
+
+/**
+ * Read big endian 16-bit number
+ * @param p				buffer of at least 2 bytes
+ * @return				number
+ */
+static uint32_t get_be16(const unsigned char *p) {
+	return ((uint32_t) p[0] << 8) | p[1];
+}
+
+
+/**
+ * Read little endian 16-bit number
+ * @param p				buffer of at least 2 bytes
+ * @return				number
+ */
+static uint32_t get_le16(const unsigned char *p) {
+	return p[0] | ((uint32_t) p[1] << 8);
+}
+
+
+/**
+ * Read big endian 32-bit number
+ * @param p				buffer of at least 4 bytes
+ * @return				number
+ */
+static uint32_t get_be32(const unsigned char *p) {
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+
+/**
+ * Read little endian 24-bit number
+ * @param p				buffer of at least 3 bytes
+ * @return				number
+ */
+static uint32_t get_le24(const unsigned char *p) {
+	return p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16);
+}
+
+
+/**
+ * Find dimensions of JPEG image in its first SOFn segment
+ * @param data			image data starting with SOI marker
+ * @param len			length of the data
+ * @param info			pointer to the info to fill in
+ * @return				0 if OK, 1 if SOFn segment is not found
+ */
+static int probe_jpeg(const unsigned char *data, uint32_t len, id3v2_picture_info_t *info) {
+	uint32_t pos = 2;
+	uint8_t marker;
+
+	while(pos + 4 <= len) {
+		if(data[pos] != 0xFF) {
+			return 1;
+		}
+		marker = data[pos + 1];
+		/* Marker may be preceded by fill bytes */
+		if(marker == 0xFF) {
+			pos++;
+			continue;
+		}
+		/* Standalone markers have no length */
+		if(marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+			pos += 2;
+			continue;
+		}
+		/* Image data start without any frame header */
+		if(marker == 0xD9 || marker == 0xDA) {
+			return 1;
+		}
+		/* SOF0 - SOF15 except DHT, JPG and DAC */
+		if(marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+			if(pos + 9 > len) {
+				return 1;
+			}
+			info->height = get_be16(data + pos + 5);
+			info->width = get_be16(data + pos + 7);
+			return 0;
+		}
+		pos += 2 + get_be16(data + pos + 2);
+	}
+
+	return 1;
+}
+
+
+/**
+ * Find dimensions of WebP image in its first chunk
+ * @param data			image data starting with RIFF header
+ * @param len			length of the data
+ * @param info			pointer to the info to fill in
+ * @return				0 if OK, 1 if the chunk is not recognised
+ */
+static int probe_webp(const unsigned char *data, uint32_t len, id3v2_picture_info_t *info) {
+	uint32_t bits;
+
+	if(len >= 30 && memcmp(data + 12, "VP8 ", 4) == 0 && memcmp(data + 23, "\x9D\x01\x2A", 3) == 0) {
+		/* Lossy bitstream, key frame start code is followed by 14-bit dimensions */
+		info->width = get_le16(data + 26) & 0x3FFF;
+		info->height = get_le16(data + 28) & 0x3FFF;
+		return 0;
+	}
+	if(len >= 25 && memcmp(data + 12, "VP8L", 4) == 0 && data[20] == 0x2F) {
+		/* Lossless bitstream, dimensions minus one are packed in 14 bits each */
+		bits = get_le24(data + 21) | ((uint32_t) data[24] << 24);
+		info->width = (bits & 0x3FFF) + 1;
+		info->height = ((bits >> 14) & 0x3FFF) + 1;
+		return 0;
+	}
+	if(len >= 30 && memcmp(data + 12, "VP8X", 4) == 0) {
+		/* Extended format, canvas dimensions minus one */
+		info->width = get_le24(data + 24) + 1;
+		info->height = get_le24(data + 27) + 1;
+		return 0;
+	}
+
+	return 1;
+}
+
+
+int probe_id3v2_picture(const unsigned char *data, uint32_t len, int unsync, id3v2_picture_info_t *info) {
+	unsigned char prefix[PICTURE_PROBE_LEN];
+	const unsigned char *p;
+	uint32_t prefix_len;
+	uint32_t i;
+	int result = 1;
+
+	memset(info, 0, sizeof(*info));
+	info->size = len;
+
+	if(unsync) {
+		/* Every $FF $00 pair of unsynchronised data stands for $FF */
+		for(p = data; (p = memchr(p, 0xFF, data + len - p)) != NULL && p + 1 < data + len; p++) {
+			if(p[1] == 0x00) {
+				info->size--;
+				p++;
+			}
+		}
+
+		/* Only the header of the picture is decoded, not the whole picture */
+		for(i = 0, prefix_len = 0; i < len && prefix_len < PICTURE_PROBE_LEN; i++) {
+			prefix[prefix_len++] = data[i];
+			if(data[i] == 0xFF && i + 1 < len && data[i + 1] == 0x00) {
+				i++;
+			}
+		}
+		data = prefix;
+		len = prefix_len;
+	}
+
+	if(len >= 4 && data[0] == 0xFF && data[1] == 0xD8) {
+		info->mime = "image/jpeg";
+		info->extension = "jpg";
+		result = probe_jpeg(data, len, info);
+	}
+	else if(len >= 24 && memcmp(data, "\x89PNG\r\n\x1A\n", 8) == 0 && memcmp(data + 12, "IHDR", 4) == 0) {
+		info->mime = "image/png";
+		info->extension = "png";
+		info->width = get_be32(data + 16);
+		info->height = get_be32(data + 20);
+		result = 0;
+	}
+	else if(len >= 10 && (memcmp(data, "GIF87a", 6) == 0 || memcmp(data, "GIF89a", 6) == 0)) {
+		info->mime = "image/gif";
+		info->extension = "gif";
+		info->width = get_le16(data + 6);
+		info->height = get_le16(data + 8);
+		result = 0;
+	}
+	else if(len >= 16 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0) {
+		info->mime = "image/webp";
+		info->extension = "webp";
+		result = probe_webp(data, len, info);
+	}
+
+	return result;
+}
@@ -0,0 +1,79 @@
+/*
+ * id3v2picture - probing of attached pictures
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ID3V2PICTURE_H_
+#define ID3V2PICTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Picture probe
+
+   Format and dimensions of the attached picture are taken from its
+   header, the image is not decoded:
+
+     JPEG   FF D8, segments up to the first SOFn marker (height, width)
+     PNG    89 'PNG' 0D 0A 1A 0A, IHDR chunk (width, height)
+     GIF    'GIF87a' or 'GIF89a', logical screen (width, height)
+     WebP   'RIFF' size 'WEBP', VP8, VP8L or VP8X chunk
+
+   The mime type of APIC frame is not trusted. The probe reads the
+   picture data in place; unsynchronised data are decoded only for the
+   first PICTURE_PROBE_LEN bytes, so SOF marker of such JPEG must lie
+   within them.
+ */
+
+/** Length of unsynchronised picture data decoded for the probe */
+#define PICTURE_PROBE_LEN 1024
+
+
+/** Detected format of the picture */
+
+typedef struct id3v2_picture_info_s {
+	const char *mime;		/**< detected mime type, NULL if the format is not recognised */
+	const char *extension;	/**< file extension of the format, NULL if it is not recognised */
+	uint32_t width;			/**< width in pixels */
+	uint32_t height;		/**< height in pixels */
+	uint32_t size;			/**< size of the image in bytes (without unsynchronisation) */
+} id3v2_picture_info_t;
+
+
+/**
+ * Detect format and dimensions of the picture from its header
+ * @param data			picture data of APIC frame
+ * @param len			length of the data
+ * @param unsync		non-zero if the data are unsynchronised
+ * @param info			pointer to the structure to fill in, size is filled in even if the format is unknown
+ * @return				0 if the format and dimensions are detected, 1 otherwise
+ */
+int probe_id3v2_picture(const unsigned char *data, uint32_t len, int unsync, id3v2_picture_info_t *info);
+
+
+#endif /* ID3V2PICTURE_H_ */
@@ -0,0 +1,692 @@
+/*
+ *  id3v2pipeline - staged pipeline for batch parsing
+ *
+ * 	Overlaps reading of tags with their parsing by separate stages of threads
+ * 	connected by bounded lock-free queues, with memory of tags in flight
+ * 	capped by a budget. See id3v2pipeline.h for the details.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "id3v2parser.h"
+#include "id3v2order.h"
+#include "id3v2pipeline.h"
+#include "id3v2trailer.h"
+
+/** Size of the cache line, positions of the queue do not share it */
+#define CACHE_LINE_LEN 64
+
+/** Status of the item */
+#define ITEM_READ_FAILED 0
+#define ITEM_PARSED 1
+#define ITEM_INVALID 2
+#define ITEM_FILTERED 3
+
+
+/** Cell of the queue */
+typedef struct queue_cell_s {
+	atomic_size_t sequence;	/**< position the cell is ready for */
+	void *data;				/**< stored pointer */
+} queue_cell_t;
+
+/** Bounded multi-producer multi-consumer queue of pointers */
+typedef struct queue_s {
+	alignas(CACHE_LINE_LEN) atomic_size_t enqueue_pos;	/**< next position to write */
+	alignas(CACHE_LINE_LEN) atomic_size_t dequeue_pos;	/**< next position to read */
+	alignas(CACHE_LINE_LEN) queue_cell_t *cells;		/**< cells of the queue */
+	size_t mask;			/**< number of cells minus one */
+	sem_t items;			/**< number of stored pointers, for blocking pop */
+	sem_t slots;			/**< number of free cells, for blocking push */
+} queue_t;
+
+/** Pooled buffer for tags */
+typedef struct pipeline_buffer_s {
+	unsigned char *data;	/**< tag data */
+	uint32_t capacity;		/**< allocated length of data */
+} pipeline_buffer_t;
+
+/** File passing through the pipeline */
+typedef struct pipeline_item_s {
+	const char *path;		/**< path of the file */
+	uint64_t size;			/**< size of the file */
+	uint64_t tag_offset;	/**< offset of the tag in the file */
+	size_t reserved;		/**< bytes reserved from the memory budget */
+	pipeline_buffer_t *buffer;	/**< buffer with the tag (until it is parsed) */
+	uint32_t len;			/**< length of the tag in the buffer */
+	int status;				/**< ITEM_* status */
+	id3v2_tag_t tag;		/**< parsed tag */
+	id3v2_tag_t trailer;	/**< texts of ID3v1 and APEv2 trailers */
+	uint32_t trailer_found;	/**< TRAILER_* mask of found trailers */
+} pipeline_item_t;
+
+/** State of the pipeline */
+typedef struct pipeline_s {
+	char **files;			/**< paths of the files */
+	size_t files_len;		/**< number of paths */
+	const id3v2_pipeline_config_t *config;	/**< configuration */
+	queue_t io_queue;		/**< discovery to I/O threads */
+	queue_t parse_queue;	/**< I/O threads to parse threads */
+	queue_t write_queue;	/**< parse threads to output */
+	queue_t pool;			/**< free buffers (never blocks) */
+	long io_threads;		/**< number of running I/O threads */
+	long parse_threads;		/**< number of running parse threads */
+	atomic_long io_active;	/**< I/O threads which have not finished */
+	atomic_long parse_active;	/**< parse threads which have not finished */
+	atomic_int discovery_result;	/**< 1 if discovery failed to queue a file */
+	pthread_mutex_t budget_lock;	/**< protects budget_used and pooled */
+	pthread_cond_t budget_cond;		/**< signals released budget */
+	size_t budget_used;		/**< bytes reserved by tags in flight */
+	size_t pooled;			/**< bytes of the buffers in the pool */
+} pipeline_t;
+
+
+/**
+ * Initialize the queue
+ * @param queue			queue
+ * @param len			number of cells (power of two)
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int init_queue(queue_t *queue, size_t len) {
+	size_t i;
+
+	queue->cells = malloc(len * sizeof(queue_cell_t));
+	if(queue->cells == NULL) {
+		return 1;
+	}
+	for(i = 0; i < len; i++) {
+		atomic_init(&queue->cells[i].sequence, i);
+	}
+	queue->mask = len - 1;
+	atomic_init(&queue->enqueue_pos, 0);
+	atomic_init(&queue->dequeue_pos, 0);
+	sem_init(&queue->items, 0, 0);
+	sem_init(&queue->slots, 0, len);
+
+	return 0;
+}
+
+
+/**
+ * Free the queue
+ * @param queue			queue
+ */
+static void destroy_queue(queue_t *queue) {
+	if(queue->cells) {
+		sem_destroy(&queue->items);
+		sem_destroy(&queue->slots);
+		free(queue->cells);
+		queue->cells = NULL;
+	}
+}
+
+
+/**
+ * Store the pointer into the queue without blocking
+ * @param queue			queue
+ * @param data			pointer to store
+ * @return				1 if stored, 0 if the queue is full
+ */
+static int try_enqueue(queue_t *queue, void *data) {
+	queue_cell_t *cell;
+	size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+	size_t sequence;
+	intptr_t diff;
+
+	for(;;) {
+		cell = &queue->cells[pos & queue->mask];
+		sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		diff = (intptr_t) sequence - (intptr_t) pos;
+		if(diff == 0) {
+			/* Cell is free, claim the position */
+			if(atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if(diff < 0) {
+			return 0;
+		}
+		else {
+			pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+		}
+	}
+	cell->data = data;
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+	return 1;
+}
+
+
+/**
+ * Take the pointer from the queue without blocking
+ * @param queue			queue
+ * @param p_data		pointer to the taken pointer
+ * @return				1 if taken, 0 if the queue is empty
+ */
+static int try_dequeue(queue_t *queue, void **p_data) {
+	queue_cell_t *cell;
+	size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+	size_t sequence;
+	intptr_t diff;
+
+	for(;;) {
+		cell = &queue->cells[pos & queue->mask];
+		sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		diff = (intptr_t) sequence - (intptr_t) (pos + 1);
+		if(diff == 0) {
+			/* Cell is filled, claim the position */
+			if(atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if(diff < 0) {
+			return 0;
+		}
+		else {
+			pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+		}
+	}
+	*p_data = cell->data;
+	atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+
+	return 1;
+}
+
+
+/**
+ * Wait on the semaphore, interrupted wait is restarted
+ * @param sem			semaphore
+ */
+static void wait_semaphore(sem_t *sem) {
+	while(sem_wait(sem) != 0 && errno == EINTR);
+}
+
+
+/**
+ * Store the pointer into the queue, block while the queue is full
+ * @param queue			queue
+ * @param data			pointer to store
+ */
+static void push_queue(queue_t *queue, void *data) {
+	wait_semaphore(&queue->slots);
+	/* Free cell is guaranteed, consumer may be just releasing it */
+	while(!try_enqueue(queue, data)) {
+		sched_yield();
+	}
+	sem_post(&queue->items);
+}
+
+
+/**
+ * Take the pointer from the queue, block while the queue is empty
+ * @param queue			queue
+ * @return				taken pointer
+ */
+static void *pop_queue(queue_t *queue) {
+	void *data;
+
+	wait_semaphore(&queue->items);
+	/* Stored pointer is guaranteed, producer may be just publishing it */
+	while(!try_dequeue(queue, &data)) {
+		sched_yield();
+	}
+	sem_post(&queue->slots);
+
+	return data;
+}
+
+
+/**
+ * Take buffer from the pool or allocate new one
+ * @param pipeline		state of the pipeline
+ * @return				buffer or NULL if problem has occurred
+ */
+static pipeline_buffer_t *get_buffer(pipeline_t *pipeline) {
+	void *buffer;
+
+	/* Memory of the buffer is charged to the file from now on */
+	if(try_dequeue(&pipeline->pool, &buffer)) {
+		pthread_mutex_lock(&pipeline->budget_lock);
+		pipeline->pooled -= ((pipeline_buffer_t *) buffer)->capacity;
+		pthread_mutex_unlock(&pipeline->budget_lock);
+		return buffer;
+	}
+	return calloc(1, sizeof(pipeline_buffer_t));
+}
+
+
+/**
+ * Return buffer into the pool, large buffer or buffer not fitting into the pool is freed.
+ * Pooled buffers are charged to the memory budget and may take at most half of it.
+ * @param pipeline		state of the pipeline
+ * @param buffer		buffer to return
+ */
+static void put_buffer(pipeline_t *pipeline, pipeline_buffer_t *buffer) {
+	uint32_t capacity;
+
+	if(buffer == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&pipeline->budget_lock);
+	if(buffer->capacity > POOL_BUFFER_MAX_LEN || pipeline->pooled + buffer->capacity > pipeline->config->memory_budget / 2) {
+		free_id3v2_memory(buffer->data);
+		buffer->data = NULL;
+		buffer->capacity = 0;
+	}
+	capacity = buffer->capacity;
+	pipeline->pooled += capacity;
+	pthread_mutex_unlock(&pipeline->budget_lock);
+
+	if(!try_enqueue(&pipeline->pool, buffer)) {
+		pthread_mutex_lock(&pipeline->budget_lock);
+		pipeline->pooled -= capacity;
+		pthread_mutex_unlock(&pipeline->budget_lock);
+		free_id3v2_memory(buffer->data);
+		free(buffer);
+	}
+}
+
+
+/**
+ * Reserve bytes from the memory budget, wait until they are available
+ * @param pipeline		state of the pipeline
+ * @param len			number of bytes
+ */
+static void reserve_budget(pipeline_t *pipeline, size_t len) {
+	pthread_mutex_lock(&pipeline->budget_lock);
+	/* Tag larger than the whole budget is processed alone */
+	while(pipeline->budget_used > 0 && pipeline->budget_used + pipeline->pooled + len > pipeline->config->memory_budget) {
+		pthread_cond_wait(&pipeline->budget_cond, &pipeline->budget_lock);
+	}
+	pipeline->budget_used += len;
+	pthread_mutex_unlock(&pipeline->budget_lock);
+}
+
+
+/**
+ * Release bytes reserved from the memory budget
+ * @param pipeline		state of the pipeline
+ * @param len			number of bytes
+ */
+static void release_budget(pipeline_t *pipeline, size_t len) {
+	pthread_mutex_lock(&pipeline->budget_lock);
+	pipeline->budget_used -= len;
+	pthread_cond_broadcast(&pipeline->budget_cond);
+	pthread_mutex_unlock(&pipeline->budget_lock);
+}
+
+
+/**
+ * Charge bytes to the memory budget without waiting, for memory which is already allocated
+ * @param pipeline		state of the pipeline
+ * @param len			number of bytes
+ */
+static void charge_budget(pipeline_t *pipeline, size_t len) {
+	pthread_mutex_lock(&pipeline->budget_lock);
+	pipeline->budget_used += len;
+	pthread_mutex_unlock(&pipeline->budget_lock);
+}
+
+
+/**
+ * Compute memory held by the parsed tag, i.e. by copies and decompressed frames
+ * @param tag			parsed tag
+ * @return				number of bytes
+ */
+static size_t get_tag_memory(const id3v2_tag_t *tag) {
+	size_t len = 0;
+	uint32_t i;
+
+	for(i = 0; i < TEXTINFO_COUNT; i++) {
+		len += tag->text[i] ? strlen(tag->text[i]) + 1 : 0;
+	}
+	len += tag->lyrics.lang ? strlen(tag->lyrics.lang) + 1 : 0;
+	len += tag->lyrics.descr ? strlen(tag->lyrics.descr) + 1 : 0;
+	len += tag->lyrics.text ? strlen(tag->lyrics.text) + 1 : 0;
+	for(i = 0; i < APIC_TYPE_COUNT; i++) {
+		len += tag->pictures[i].mime ? strlen(tag->pictures[i].mime) + 1 : 0;
+		len += tag->pictures[i].descr ? strlen(tag->pictures[i].descr) + 1 : 0;
+		len += tag->pictures[i].len;
+	}
+	return len;
+}
+
+
+/**
+ * Push end markers for all threads of the stage
+ * @param queue			input queue of the stage
+ * @param threads		number of threads of the stage
+ */
+static void finish_stage(queue_t *queue, long threads) {
+	while(threads-- > 0) {
+		push_queue(queue, NULL);
+	}
+}
+
+
+/**
+ * Discovery stage feeding files into the I/O queue
+ * @param arg			state of the pipeline
+ * @return				NULL
+ */
+static void *run_discovery(void *arg) {
+	pipeline_t *pipeline = arg;
+	pipeline_item_t *item;
+	size_t i;
+
+	for(i = 0; pipeline->config->prefetch && i < TAG_PREFETCH_DEPTH && i < pipeline->files_len; i++) {
+		advise_tag_prefetch(pipeline->files[i]);
+	}
+	for(i = 0; i < pipeline->files_len; i++) {
+		/* Keep the kernel TAG_PREFETCH_DEPTH files ahead of the I/O threads */
+		if(pipeline->config->prefetch && i + TAG_PREFETCH_DEPTH < pipeline->files_len) {
+			advise_tag_prefetch(pipeline->files[i + TAG_PREFETCH_DEPTH]);
+		}
+		item = calloc(1, sizeof(pipeline_item_t));
+		if(item == NULL) {
+			fprintf(stderr, "Error while allocating memory for file %s!\n", pipeline->files[i]);
+			atomic_store(&pipeline->discovery_result, 1);
+			continue;
+		}
+		item->path = pipeline->files[i];
+		push_queue(&pipeline->io_queue, item);
+	}
+	finish_stage(&pipeline->io_queue, pipeline->io_threads);
+
+	return NULL;
+}
+
+
+/**
+ * Read tag of the file into pooled buffer
+ * @param pipeline		state of the pipeline
+ * @param item			file to read
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int read_item(pipeline_t *pipeline, pipeline_item_t *item) {
+	unsigned char header[HEADER_LEN];
+	struct stat st;
+	ssize_t read_len;
+	int fd;
+	int result = 1;
+
+	fd = open(item->path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		fprintf(stderr, "Error while opening file %s!\n", item->path);
+		return 1;
+	}
+	/* WAV and AIFF files carry the tag in a chunk, only chunk headers are read */
+	find_id3v2_tag(fd, &item->tag_offset);
+	read_len = pread(fd, header, HEADER_LEN, item->tag_offset);
+	if(fstat(fd, &st) == 0 && read_len >= 0) {
+		item->size = st.st_size;
+		/* Buffer and copies of the frames in the parsed tag */
+		item->reserved = 2 * (size_t) get_id3v2_tag_length(header, read_len);
+		reserve_budget(pipeline, item->reserved);
+		item->buffer = get_buffer(pipeline);
+		result = item->buffer == NULL
+				|| read_tag_at(fd, item->tag_offset, &item->buffer->data, &item->buffer->capacity, &item->len) != 0;
+
+		/* Stacked tags and reused larger buffer exceed the estimate, they are charged without waiting */
+		if(item->buffer && item->buffer->capacity + (size_t) item->len > item->reserved) {
+			charge_budget(pipeline, item->buffer->capacity + (size_t) item->len - item->reserved);
+			item->reserved = item->buffer->capacity + (size_t) item->len;
+		}
+
+		/* Trailers are the second (and the last) read of the file */
+		init_id3v2_tag(&item->trailer);
+		if(result == 0 && pipeline->config->trailer != TRAILER_IGNORE
+				&& read_id3v2_trailer(fd, item->size, &item->trailer, &item->trailer_found) != 0) {
+			fprintf(stderr, "Error while reading trailer of file %s, it is skipped!\n", item->path);
+			deallocate_memory(&item->trailer, NULL);
+			item->trailer_found = 0;
+		}
+	}
+	if(result != 0) {
+		fprintf(stderr, "Error while reading MP3 file %s has appeared!\n", item->path);
+	}
+	close(fd);
+
+	return result;
+}
+
+
+/**
+ * I/O stage reading tags of the files
+ * @param arg			state of the pipeline
+ * @return				NULL
+ */
+static void *run_io_stage(void *arg) {
+	pipeline_t *pipeline = arg;
+	pipeline_item_t *item;
+
+	while((item = pop_queue(&pipeline->io_queue)) != NULL) {
+		item->status = read_item(pipeline, item) == 0 ? ITEM_PARSED : ITEM_READ_FAILED;
+		push_queue(&pipeline->parse_queue, item);
+	}
+
+	/* Last I/O thread ends the parse stage */
+	if(atomic_fetch_sub(&pipeline->io_active, 1) == 1) {
+		finish_stage(&pipeline->parse_queue, pipeline->parse_threads);
+	}
+	return NULL;
+}
+
+
+/**
+ * Parse stage parsing read tags
+ * @param arg			state of the pipeline
+ * @return				NULL
+ */
+static void *run_parse_stage(void *arg) {
+	pipeline_t *pipeline = arg;
+	pipeline_item_t *item;
+	id3v2_parse_context_t context = {NULL, get_id3v2_verbosity(), NULL};
+	const id3v2_filter_t *filter;
+	size_t tag_memory;
+	int match;
+
+	while((item = pop_queue(&pipeline->parse_queue)) != NULL) {
+		if(item->status != ITEM_READ_FAILED) {
+			init_id3v2_tag(&item->tag);
+			/* Merged trailers can decide the filter, it is evaluated on the merged tag then */
+			filter = pipeline->config->trailer == TRAILER_IGNORE ? pipeline->config->where : NULL;
+			/* Events of the parse threads are told apart by the path */
+			context.path = item->path;
+			if(parse_buffer_context(&item->tag, item->buffer->data, item->len, filter, &context, &match) != 0) {
+				fprintf(stderr, "Error while parsing input buffer occurred!\n");
+				deallocate_memory(&item->tag, NULL);
+				/* File with only ID3v1 or APEv2 tag is still parsed */
+				if(item->trailer_found == 0) {
+					item->status = ITEM_INVALID;
+				}
+			}
+			merge_id3v2_trailer(&item->tag, &item->trailer, pipeline->config->trailer);
+			if(pipeline->config->where && item->status == ITEM_PARSED && (match == 0
+					|| (filter == NULL && match_id3v2_filter(pipeline->config->where, &item->tag, 0, 1) != FILTER_MATCH))) {
+				deallocate_memory(&item->tag, NULL);
+				item->status = ITEM_FILTERED;
+			}
+		}
+
+		/* Parsed tag holds copies of the frames, buffer can be reused */
+		put_buffer(pipeline, item->buffer);
+		item->buffer = NULL;
+
+		/* Reservation follows the memory of the parsed tag, decompressed frames can exceed the estimate.
+		   Parse thread never waits for the budget, the I/O threads wait for the charged bytes instead. */
+		tag_memory = item->status == ITEM_PARSED ? get_tag_memory(&item->tag) : 0;
+		if(tag_memory > item->reserved) {
+			charge_budget(pipeline, tag_memory - item->reserved);
+		}
+		else if(item->reserved > tag_memory) {
+			release_budget(pipeline, item->reserved - tag_memory);
+		}
+		item->reserved = tag_memory;
+		push_queue(&pipeline->write_queue, item);
+	}
+
+	/* Last parse thread ends the output stage */
+	if(atomic_fetch_sub(&pipeline->parse_active, 1) == 1) {
+		finish_stage(&pipeline->write_queue, 1);
+	}
+	return NULL;
+}
+
+
+/**
+ * Start threads of the stage
+ * @param threads		array for the threads
+ * @param count			requested number of threads
+ * @param routine		routine of the threads
+ * @param pipeline		state of the pipeline
+ * @return				number of started threads
+ */
+static long start_stage(pthread_t *threads, long count, void *(*routine)(void *), pipeline_t *pipeline) {
+	long i;
+
+	for(i = 0; i < count; i++) {
+		if(pthread_create(&threads[i], NULL, routine, pipeline) != 0) {
+			fprintf(stderr, "Error while starting thread of pipeline!\n");
+			break;
+		}
+	}
+	return i;
+}
+
+
+int run_id3v2_pipeline(char **files, size_t len, const id3v2_pipeline_config_t *config,
+		id3v2_pipeline_output_t output, void *arg) {
+	pipeline_t pipeline;
+	pipeline_item_t *item;
+	pthread_t *threads;
+	pthread_t discovery;
+	int discovery_started = 0;
+	long io_requested = config->io_threads > 0 ? config->io_threads : 1;
+	long parse_requested = config->parse_threads > 0 ? config->parse_threads : 1;
+	long i;
+	void *buffer;
+	int result = 0;
+
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.files = files;
+	pipeline.files_len = len;
+	pipeline.config = config;
+	pthread_mutex_init(&pipeline.budget_lock, NULL);
+	pthread_cond_init(&pipeline.budget_cond, NULL);
+
+	threads = malloc((io_requested + parse_requested) * sizeof(pthread_t));
+	if(threads == NULL || init_queue(&pipeline.io_queue, PIPELINE_QUEUE_LEN) != 0
+			|| init_queue(&pipeline.parse_queue, PIPELINE_QUEUE_LEN) != 0
+			|| init_queue(&pipeline.write_queue, PIPELINE_QUEUE_LEN) != 0
+			|| init_queue(&pipeline.pool, PIPELINE_QUEUE_LEN) != 0) {
+		fprintf(stderr, "Error while allocating memory for pipeline!\n");
+		result = 1;
+		goto end;
+	}
+
+	/* Stages are started from the end, stage without threads is ended by its predecessor */
+	pipeline.parse_threads = start_stage(threads, parse_requested, run_parse_stage, &pipeline);
+	atomic_init(&pipeline.parse_active, pipeline.parse_threads);
+	if(pipeline.parse_threads == 0) {
+		result = 1;
+		goto end;
+	}
+	pipeline.io_threads = start_stage(threads + pipeline.parse_threads, io_requested, run_io_stage, &pipeline);
+	atomic_init(&pipeline.io_active, pipeline.io_threads);
+	atomic_init(&pipeline.discovery_result, 0);
+	if(pipeline.io_threads == 0) {
+		finish_stage(&pipeline.parse_queue, pipeline.parse_threads);
+		result = 1;
+	}
+	else if(pthread_create(&discovery, NULL, run_discovery, &pipeline) != 0) {
+		fprintf(stderr, "Error while starting thread of pipeline!\n");
+		finish_stage(&pipeline.io_queue, pipeline.io_threads);
+		result = 1;
+	}
+	else {
+		discovery_started = 1;
+	}
+
+	/* Calling thread is the single output stage */
+	while((item = pop_queue(&pipeline.write_queue)) != NULL) {
+		if(item->status == ITEM_READ_FAILED) {
+			result = 1;
+		}
+		else if(item->status != ITEM_FILTERED) {
+			/* Invalid file does not match any filter, it is only reported */
+			if(((config->where == NULL || item->status == ITEM_PARSED)
+					&& output(arg, item->path, item->size, item->tag_offset, &item->tag, item->status == ITEM_PARSED) != 0)
+					|| item->status != ITEM_PARSED) {
+				result = 1;
+			}
+			deallocate_memory(&item->tag, NULL);
+		}
+		release_budget(&pipeline, item->reserved);
+		free(item);
+	}
+	if(discovery_started) {
+		pthread_join(discovery, NULL);
+	}
+	result |= atomic_load(&pipeline.discovery_result);
+
+	for(i = 0; i < pipeline.parse_threads + pipeline.io_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+end:
+	while(pipeline.pool.cells && try_dequeue(&pipeline.pool, &buffer)) {
+		free_id3v2_memory(((pipeline_buffer_t *) buffer)->data);
+		free(buffer);
+	}
+	destroy_queue(&pipeline.io_queue);
+	destroy_queue(&pipeline.parse_queue);
+	destroy_queue(&pipeline.write_queue);
+	destroy_queue(&pipeline.pool);
+	pthread_mutex_destroy(&pipeline.budget_lock);
+	pthread_cond_destroy(&pipeline.budget_cond);
+	free(threads);
+
+	return result;
+}
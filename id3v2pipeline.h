@@ -0,0 +1,120 @@
+/*
+ * id3v2pipeline - staged pipeline for batch parsing
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ID3V2PIPELINE_H_
+#define ID3V2PIPELINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "id3v2parser.h"
+#include "id3v2filter.h"
+
+/** Pipeline stages
+
+     discovery --> I/O threads --> parse threads --> output
+      (1 thread)   read tags into   parse_buffer()    (calling thread)
+                   pooled buffers   and merge
+                   (and trailers)   trailers
+
+   Stages are connected by bounded lock-free queues (array based MPMC
+   queue by Dmitry Vyukov), a thread blocks on a semaphore only when its
+   queue is empty or full. Buffers are taken from a pool and returned to
+   it when the tag is parsed, large buffers are released instead of being
+   pooled and the pool keeps at most half of the memory budget.
+
+   Every file reserves twice the length of its first tag from the memory
+   budget before the tag is read, for the buffer and for copies of the
+   frames in the parsed tag. After the read, the reservation grows to the
+   capacity of the buffer and the length of all stacked tags. When the
+   buffer is returned, the reservation is set to the memory of the parsed
+   tag, decompressed frames included. The rest is released after the
+   output of the tag. Growth of a reservation is charged without waiting,
+   the I/O threads wait instead while reservations and pooled buffers
+   exceed the budget. The memory of tags in flight therefore exceeds the
+   budget only by one tag larger than the budget (processed alone) and by
+   tags which turned out larger than estimated, until they are output.
+   Decompression buffers of the parse threads (at most MAX_INFLATE_LEN
+   each) and trailers before they are merged are not counted.
+
+   Files are output in order of completion, not in order of the list.
+   With a filter, the parse stage evaluates it during parsing (or after
+   the merge of trailers) and not matching files skip the output.
+ */
+
+/** Default number of I/O threads */
+#define DEFAULT_IO_THREADS 4
+/** Default memory budget of tags in flight */
+#define DEFAULT_MEMORY_BUDGET (256 * 1024 * 1024)
+/** Capacity of the queues between stages (power of two) */
+#define PIPELINE_QUEUE_LEN 256
+/** Buffers larger than this are not kept in the pool */
+#define POOL_BUFFER_MAX_LEN (1024 * 1024)
+
+
+/** Configuration of the pipeline */
+
+typedef struct id3v2_pipeline_config_s {
+	long io_threads;		/**< number of I/O threads */
+	long parse_threads;		/**< number of parse threads */
+	size_t memory_budget;	/**< memory budget of tags in flight in bytes */
+	uint8_t prefetch;		/**< announce tags of the next files to the kernel (advise_tag_prefetch()) */
+	uint8_t trailer;		/**< precedence of ID3v1 and APEv2 trailers (TRAILER_*), TRAILER_IGNORE does not read them */
+	const id3v2_filter_t *where;	/**< files not matching the filter are not output, NULL outputs all files */
+} id3v2_pipeline_config_t;
+
+/**
+ * Output of the parsed file, called from the single output stage
+ * @param arg			argument given to run_id3v2_pipeline()
+ * @param path			path of the file
+ * @param size			size of the file
+ * @param tag_offset		offset of the tag in the file (non-zero in WAV and AIFF files)
+ * @param tag			parsed ID3 tag, it is deallocated after the call
+ * @param parsed		1 if the tag was parsed, 0 if it is not valid (tag is empty)
+ * @return				0 if OK, 1 if problem has occurred
+ */
+typedef int (*id3v2_pipeline_output_t)(void *arg, const char *path, uint64_t size, uint64_t tag_offset,
+		id3v2_tag_t *tag, int parsed);
+
+
+/**
+ * Parse the files by the pipeline and pass their tags to the output
+ * @param files			array of paths
+ * @param len			number of paths
+ * @param config		configuration of the pipeline
+ * @param output		output of the parsed files
+ * @param arg			argument passed to the output
+ * @return				0 if OK, 1 if any file could not be read, parsed or output
+ */
+int run_id3v2_pipeline(char **files, size_t len, const id3v2_pipeline_config_t *config,
+		id3v2_pipeline_output_t output, void *arg);
+
+
+#endif /* ID3V2PIPELINE_H_ */
@@ -0,0 +1,813 @@
+/*
+ *  id3v2search - inverted full-text index of ID3 tags
+ *
+ * 	Splits text information frames and lyrics into terms and builds one file
+ * 	with sorted terms and their delta encoded posting lists. The file is read
+ * 	back through mmap to answer term and prefix queries. See id3v2search.h for
+ * 	the file layout.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "id3v2search.h"
+
+/** Initial capacity of growing arrays */
+#define INITIAL_CAPACITY 16
+
+/** Round offset up to multiple of 8 bytes */
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t) 7)
+
+
+/** Term of the segment with its posting list */
+typedef struct search_term_s {
+	char *term;				/**< NUL terminated term */
+	uint32_t *docs;			/**< ascending documents containing the term */
+	uint32_t len;			/**< number of documents */
+	uint32_t capacity;		/**< allocated length of docs */
+} search_term_t;
+
+struct id3v2_search_segment_s {
+	search_term_t *terms;	/**< terms in order of insertion */
+	uint32_t count;			/**< number of terms */
+	uint32_t capacity;		/**< allocated length of terms */
+	uint32_t *slots;		/**< hash table of term numbers plus one (0 is empty slot) */
+	uint32_t slots_len;		/**< length of hash table, power of two */
+};
+
+
+id3v2_search_segment_t *create_search_segment(void) {
+	return calloc(1, sizeof(id3v2_search_segment_t));
+}
+
+
+void free_search_segment(id3v2_search_segment_t *segment) {
+	uint32_t i;
+
+	if(segment == NULL) {
+		return;
+	}
+	for(i = 0; i < segment->count; i++) {
+		free(segment->terms[i].term);
+		free(segment->terms[i].docs);
+	}
+	free(segment->terms);
+	free(segment->slots);
+	free(segment);
+}
+
+
+/**
+ * Compute FNV-1a hash of the term
+ * @param term			term to hash
+ * @param len			length of the term
+ * @return				hash
+ */
+static uint32_t hash_term(const char *term, size_t len) {
+	uint32_t hash = 2166136261u;
+
+	while(len--) {
+		hash = (hash ^ (unsigned char) *term++) * 16777619u;
+	}
+	return hash;
+}
+
+
+/**
+ * Find term in the segment, the term is added if it is not there
+ * @param segment		segment of the index
+ * @param term			term (not terminated)
+ * @param len			length of the term
+ * @return				term of the segment or NULL if problem has occurred
+ */
+static search_term_t *intern_term(id3v2_search_segment_t *segment, const char *term, size_t len) {
+	search_term_t *terms;
+	uint32_t *slots;
+	uint32_t slots_len;
+	uint32_t slot;
+	uint32_t i;
+
+	/* Keep load factor of the hash table under one half */
+	if((segment->count + 1) * 2 > segment->slots_len) {
+		slots_len = segment->slots_len ? segment->slots_len * 2 : 1024;
+		slots = calloc(slots_len, sizeof(uint32_t));
+		if(slots == NULL) {
+			return NULL;
+		}
+		for(i = 0; i < segment->count; i++) {
+			slot = hash_term(segment->terms[i].term, strlen(segment->terms[i].term)) & (slots_len - 1);
+			while(slots[slot]) {
+				slot = (slot + 1) & (slots_len - 1);
+			}
+			slots[slot] = i + 1;
+		}
+		free(segment->slots);
+		segment->slots = slots;
+		segment->slots_len = slots_len;
+	}
+
+	slot = hash_term(term, len) & (segment->slots_len - 1);
+	while(segment->slots[slot]) {
+		search_term_t *found = &segment->terms[segment->slots[slot] - 1];
+		if(strncmp(found->term, term, len) == 0 && found->term[len] == '\0') {
+			return found;
+		}
+		slot = (slot + 1) & (segment->slots_len - 1);
+	}
+
+	if(segment->count == segment->capacity) {
+		terms = realloc(segment->terms, (segment->capacity ? segment->capacity * 2 : 1024) * sizeof(search_term_t));
+		if(terms == NULL) {
+			return NULL;
+		}
+		segment->terms = terms;
+		segment->capacity = segment->capacity ? segment->capacity * 2 : 1024;
+	}
+	terms = &segment->terms[segment->count];
+	memset(terms, 0, sizeof(*terms));
+	terms->term = strndup(term, len);
+	if(terms->term == NULL) {
+		return NULL;
+	}
+	segment->slots[slot] = ++segment->count;
+
+	return terms;
+}
+
+
+/**
+ * Check whether the byte belongs to a term
+ * @param c				byte of the text
+ * @return				nonzero if it is part of a term
+ */
+static int is_term_byte(unsigned char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+
+/**
+ * Get next term of the text, folded to lower case
+ * @param p_text		pointer to the text, moved behind the term
+ * @param term			output buffer of SEARCH_TERM_MAX_LEN bytes
+ * @return				length of the term, 0 if there is no more term
+ */
+static size_t next_term(const char **p_text, char *term) {
+	const unsigned char *p = (const unsigned char *) *p_text;
+	size_t len = 0;
+
+	while(*p && !is_term_byte(*p)) {
+		p++;
+	}
+	while(*p && is_term_byte(*p)) {
+		if(len < SEARCH_TERM_MAX_LEN) {
+			term[len++] = (*p >= 'A' && *p <= 'Z') ? *p - 'A' + 'a' : *p;
+		}
+		p++;
+	}
+	*p_text = (const char *) p;
+
+	return len;
+}
+
+
+/**
+ * Add terms of the text into the segment
+ * @param segment		segment of the index
+ * @param doc			document number
+ * @param text			text to split into terms
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int add_search_text(id3v2_search_segment_t *segment, uint32_t doc, const char *text) {
+	char term[SEARCH_TERM_MAX_LEN];
+	search_term_t *entry;
+	uint32_t *docs;
+	size_t len;
+
+	while((len = next_term(&text, term)) > 0) {
+		entry = intern_term(segment, term, len);
+		if(entry == NULL) {
+			return 1;
+		}
+
+		/* Documents come in ascending order, so a repeated term is the last one */
+		if(entry->len > 0 && entry->docs[entry->len - 1] == doc) {
+			continue;
+		}
+		if(entry->len == entry->capacity) {
+			docs = realloc(entry->docs, (entry->capacity ? entry->capacity * 2 : INITIAL_CAPACITY) * sizeof(uint32_t));
+			if(docs == NULL) {
+				return 1;
+			}
+			entry->docs = docs;
+			entry->capacity = entry->capacity ? entry->capacity * 2 : INITIAL_CAPACITY;
+		}
+		entry->docs[entry->len++] = doc;
+	}
+
+	return 0;
+}
+
+
+int add_search_document(id3v2_search_segment_t *segment, uint32_t doc, const id3v2_tag_t *tag) {
+	uint32_t i;
+
+	for(i = 0; i < TEXTINFO_COUNT; i++) {
+		if(tag->text[i] && add_search_text(segment, doc, tag->text[i]) != 0) {
+			return 1;
+		}
+	}
+	if(tag->lyrics.text && add_search_text(segment, doc, tag->lyrics.text) != 0) {
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/** Segment being sorted, qsort() has no context argument */
+static const search_term_t *sorted_terms;
+
+/**
+ * Compare two term numbers by their terms
+ * @param a				pointer to the first term number
+ * @param b				pointer to the second term number
+ * @return				result of strcmp() of their terms
+ */
+static int compare_terms(const void *a, const void *b) {
+	return strcmp(sorted_terms[*(const uint32_t *) a].term, sorted_terms[*(const uint32_t *) b].term);
+}
+
+
+/**
+ * Compare two documents
+ * @param a				pointer to the first document
+ * @param b				pointer to the second document
+ * @return				negative, zero or positive value
+ */
+static int compare_docs(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * Write data at the current position followed by zero padding to 8 bytes
+ * @param file			output file
+ * @param data			data to write, NULL if they are already written and only padding is missing
+ * @param len			length of the data
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int write_aligned(FILE *file, const void *data, uint64_t len) {
+	static const unsigned char zeros[8];
+
+	if(data && len > 0 && fwrite(data, 1, len, file) != len) {
+		return 1;
+	}
+	if(ALIGN8(len) != len && fwrite(zeros, 1, ALIGN8(len) - len, file) != ALIGN8(len) - len) {
+		return 1;
+	}
+	return 0;
+}
+
+
+/** Merged index kept in memory until it is written */
+typedef struct merged_index_s {
+	char **terms;			/**< sorted distinct terms (owned by segments) */
+	uint64_t count;			/**< number of terms */
+	uint32_t *doc_counts;	/**< number of documents of each term */
+	uint64_t *posting_offsets;	/**< offsets of posting lists, count + 1 */
+	unsigned char *postings;	/**< delta encoded posting lists */
+	uint64_t postings_len;	/**< length of postings */
+} merged_index_t;
+
+
+/**
+ * Merge sorted terms of the segments and encode their posting lists
+ * @param segments		array of segments
+ * @param segments_len	number of segments
+ * @param order			sorted term numbers of each segment
+ * @param merged		merged index to fill in
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int merge_segments(id3v2_search_segment_t **segments, size_t segments_len, uint32_t **order, merged_index_t *merged) {
+	size_t *cursors;
+	uint64_t total_terms = 0;
+	uint64_t postings_capacity = 0;
+	uint32_t *docs = NULL;
+	uint64_t docs_capacity = 0;
+	uint64_t docs_len;
+	const char *min;
+	search_term_t *entry;
+	unsigned char *tmp;
+	uint32_t prev;
+	uint32_t delta;
+	uint64_t i;
+	size_t s;
+	int result = 1;
+
+	for(s = 0; s < segments_len; s++) {
+		total_terms += segments[s]->count;
+	}
+	cursors = calloc(segments_len ? segments_len : 1, sizeof(size_t));
+	merged->terms = malloc((total_terms + 1) * sizeof(char *));
+	merged->doc_counts = malloc((total_terms + 1) * sizeof(uint32_t));
+	merged->posting_offsets = malloc((total_terms + 1) * sizeof(uint64_t));
+	if(cursors == NULL || merged->terms == NULL || merged->doc_counts == NULL || merged->posting_offsets == NULL) {
+		goto end;
+	}
+
+	for(;;) {
+		/* Smallest term among heads of the segments */
+		min = NULL;
+		for(s = 0; s < segments_len; s++) {
+			if(cursors[s] < segments[s]->count) {
+				entry = &segments[s]->terms[order[s][cursors[s]]];
+				if(min == NULL || strcmp(entry->term, min) < 0) {
+					min = entry->term;
+				}
+			}
+		}
+		if(min == NULL) {
+			break;
+		}
+
+		/* Collect its documents from all segments */
+		docs_len = 0;
+		for(s = 0; s < segments_len; s++) {
+			if(cursors[s] >= segments[s]->count) {
+				continue;
+			}
+			entry = &segments[s]->terms[order[s][cursors[s]]];
+			if(strcmp(entry->term, min) != 0) {
+				continue;
+			}
+			if(docs_len + entry->len > docs_capacity) {
+				docs_capacity = (docs_len + entry->len) * 2;
+				uint32_t *tmp_docs = realloc(docs, docs_capacity * sizeof(uint32_t));
+				if(tmp_docs == NULL) {
+					goto end;
+				}
+				docs = tmp_docs;
+			}
+			memcpy(docs + docs_len, entry->docs, entry->len * sizeof(uint32_t));
+			docs_len += entry->len;
+			cursors[s]++;
+		}
+		if(segments_len > 1) {
+			qsort(docs, docs_len, sizeof(uint32_t), compare_docs);
+		}
+
+		/* Encode deltas, at most 5 bytes per document */
+		if(merged->postings_len + docs_len * 5 > postings_capacity) {
+			postings_capacity = (merged->postings_len + docs_len * 5) * 2;
+			tmp = realloc(merged->postings, postings_capacity);
+			if(tmp == NULL) {
+				goto end;
+			}
+			merged->postings = tmp;
+		}
+		merged->terms[merged->count] = (char *) min;
+		merged->doc_counts[merged->count] = docs_len;
+		merged->posting_offsets[merged->count] = merged->postings_len;
+		prev = 0;
+		for(i = 0; i < docs_len; i++) {
+			delta = docs[i] - prev;
+			prev = docs[i];
+			while(delta >= 0x80) {
+				merged->postings[merged->postings_len++] = (delta & 0x7F) | 0x80;
+				delta >>= 7;
+			}
+			merged->postings[merged->postings_len++] = delta;
+		}
+		merged->count++;
+	}
+	merged->posting_offsets[merged->count] = merged->postings_len;
+	result = 0;
+
+end:
+	free(cursors);
+	free(docs);
+	return result;
+}
+
+
+int write_search_index(id3v2_search_segment_t **segments, size_t segments_len, char **paths, uint32_t docs,
+		const char *name) {
+	id3v2_search_index_header_t header;
+	merged_index_t merged;
+	uint32_t **order;
+	uint64_t *offsets = NULL;
+	uint64_t heap_len;
+	uint64_t offset;
+	uint64_t i;
+	size_t s;
+	FILE *file = NULL;
+	int result = 1;
+
+	memset(&merged, 0, sizeof(merged));
+	order = calloc(segments_len ? segments_len : 1, sizeof(uint32_t *));
+	if(order == NULL) {
+		goto end;
+	}
+
+	/* Sort terms of every segment, then merge them */
+	for(s = 0; s < segments_len; s++) {
+		order[s] = malloc((segments[s]->count + 1) * sizeof(uint32_t));
+		if(order[s] == NULL) {
+			goto end;
+		}
+		for(i = 0; i < segments[s]->count; i++) {
+			order[s][i] = i;
+		}
+		sorted_terms = segments[s]->terms;
+		qsort(order[s], segments[s]->count, sizeof(uint32_t), compare_terms);
+	}
+	if(merge_segments(segments, segments_len, order, &merged) != 0) {
+		goto end;
+	}
+
+	offsets = malloc(((docs > merged.count ? docs : merged.count) + 1) * sizeof(uint64_t));
+	file = fopen(name, "wb");
+	if(offsets == NULL || file == NULL) {
+		goto end;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SEARCH_INDEX_MAGIC, sizeof(SEARCH_INDEX_MAGIC));
+	header.version = SEARCH_INDEX_VERSION;
+	header.docs = docs;
+	header.terms = merged.count;
+	if(fwrite(&header, sizeof(header), 1, file) != 1) {
+		goto end;
+	}
+	offset = ALIGN8(sizeof(header));
+
+	/* Paths of the documents */
+	heap_len = 0;
+	for(i = 0; i < docs; i++) {
+		offsets[i] = heap_len;
+		heap_len += strlen(paths[i]) + 1;
+	}
+	offsets[docs] = heap_len;
+	header.path_offsets = offset;
+	offset += ALIGN8((docs + 1) * sizeof(uint64_t));
+	header.path_heap = offset;
+	offset += ALIGN8(heap_len);
+	if(write_aligned(file, offsets, (docs + 1) * sizeof(uint64_t)) != 0) {
+		goto end;
+	}
+	for(i = 0; i < docs; i++) {
+		if(fwrite(paths[i], 1, strlen(paths[i]) + 1, file) != strlen(paths[i]) + 1) {
+			goto end;
+		}
+	}
+	if(write_aligned(file, NULL, heap_len) != 0) {
+		goto end;
+	}
+
+	/* Sorted terms */
+	heap_len = 0;
+	for(i = 0; i < merged.count; i++) {
+		offsets[i] = heap_len;
+		heap_len += strlen(merged.terms[i]) + 1;
+	}
+	offsets[merged.count] = heap_len;
+	header.term_offsets = offset;
+	offset += ALIGN8((merged.count + 1) * sizeof(uint64_t));
+	header.term_heap = offset;
+	offset += ALIGN8(heap_len);
+	if(write_aligned(file, offsets, (merged.count + 1) * sizeof(uint64_t)) != 0) {
+		goto end;
+	}
+	for(i = 0; i < merged.count; i++) {
+		if(fwrite(merged.terms[i], 1, strlen(merged.terms[i]) + 1, file) != strlen(merged.terms[i]) + 1) {
+			goto end;
+		}
+	}
+	if(write_aligned(file, NULL, heap_len) != 0) {
+		goto end;
+	}
+
+	/* Posting lists */
+	header.doc_counts = offset;
+	offset += ALIGN8(merged.count * sizeof(uint32_t));
+	header.posting_offsets = offset;
+	offset += ALIGN8((merged.count + 1) * sizeof(uint64_t));
+	header.postings = offset;
+	if(write_aligned(file, merged.doc_counts, merged.count * sizeof(uint32_t)) != 0
+			|| write_aligned(file, merged.posting_offsets, (merged.count + 1) * sizeof(uint64_t)) != 0
+			|| write_aligned(file, merged.postings, merged.postings_len) != 0) {
+		goto end;
+	}
+
+	/* Header is rewritten with offsets of the sections */
+	if(fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1) {
+		goto end;
+	}
+	result = 0;
+
+end:
+	if(file != NULL && fclose(file) != 0) {
+		result = 1;
+	}
+	if(result != 0) {
+		fprintf(stderr, "Error while writing index file %s!\n", name);
+	}
+	if(order != NULL) {
+		for(s = 0; s < segments_len; s++) {
+			free(order[s]);
+		}
+	}
+	free(order);
+	free(offsets);
+	free(merged.terms);
+	free(merged.doc_counts);
+	free(merged.posting_offsets);
+	free(merged.postings);
+
+	return result;
+}
+
+
+/**
+ * Check that the section lies within the mapped file
+ * @param index			pointer to the index structure
+ * @param offset		offset of the section
+ * @param len			length of the section
+ * @return				1 if valid, 0 otherwise
+ */
+static int is_valid_section(const id3v2_search_index_t *index, uint64_t offset, uint64_t len) {
+	return offset <= index->len && len <= index->len - offset && (offset & 7) == 0;
+}
+
+
+/**
+ * Check that the string offsets point into their heap and that the strings end within it
+ * @param index			pointer to the index structure
+ * @param offsets		offset of the string offsets (count + 1, the last one is length of the heap)
+ * @param count			number of strings
+ * @param heap			offset of the heap
+ * @return				1 if valid, 0 otherwise
+ */
+static int is_valid_heap(const id3v2_search_index_t *index, uint64_t offsets, uint64_t count, uint64_t heap) {
+	const uint64_t *p = (const uint64_t *) (index->base + offsets);
+	uint64_t i;
+
+	for(i = 0; i < count; i++) {
+		if(p[i] >= p[count]) {
+			return 0;
+		}
+	}
+	/* Heap ending with NUL terminates every string starting within it */
+	return count == 0 || index->base[heap + p[count] - 1] == '\0';
+}
+
+
+/**
+ * Check that the posting lists lie one after another within the postings
+ * @param index			pointer to the index structure
+ * @return				1 if valid, 0 otherwise
+ */
+static int is_valid_postings(const id3v2_search_index_t *index) {
+	const uint64_t *offsets = (const uint64_t *) (index->base + index->header->posting_offsets);
+	uint64_t i;
+
+	for(i = 0; i < index->header->terms; i++) {
+		if(offsets[i] > offsets[i + 1]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+int open_search_index(const char *name, id3v2_search_index_t *index) {
+	const id3v2_search_index_header_t *header;
+	struct stat st;
+	void *base;
+	int fd;
+
+	memset(index, 0, sizeof(*index));
+	fd = open(name, O_RDONLY);
+	if(fd < 0) {
+		fprintf(stderr, "Error while opening index file %s!\n", name);
+		return 1;
+	}
+	if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(id3v2_search_index_header_t)) {
+		fprintf(stderr, "Index file %s is too small\n", name);
+		close(fd);
+		return 1;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED) {
+		fprintf(stderr, "Error while mapping index file %s!\n", name);
+		return 1;
+	}
+	index->base = base;
+	index->len = st.st_size;
+	index->header = header = base;
+
+	/* Validate layout and offsets so the lookups need not check bounds */
+	if(memcmp(header->magic, SEARCH_INDEX_MAGIC, sizeof(SEARCH_INDEX_MAGIC)) != 0 || header->version != SEARCH_INDEX_VERSION
+			|| header->docs > index->len || header->terms > index->len
+			|| !is_valid_section(index, header->path_offsets, (header->docs + 1) * sizeof(uint64_t))
+			|| !is_valid_section(index, header->term_offsets, (header->terms + 1) * sizeof(uint64_t))
+			|| !is_valid_section(index, header->doc_counts, header->terms * sizeof(uint32_t))
+			|| !is_valid_section(index, header->posting_offsets, (header->terms + 1) * sizeof(uint64_t))
+			|| !is_valid_section(index, header->path_heap,
+					((const uint64_t *) (index->base + header->path_offsets))[header->docs])
+			|| !is_valid_section(index, header->term_heap,
+					((const uint64_t *) (index->base + header->term_offsets))[header->terms])
+			|| !is_valid_section(index, header->postings,
+					((const uint64_t *) (index->base + header->posting_offsets))[header->terms])
+			|| !is_valid_heap(index, header->path_offsets, header->docs, header->path_heap)
+			|| !is_valid_heap(index, header->term_offsets, header->terms, header->term_heap)
+			|| !is_valid_postings(index)) {
+		fprintf(stderr, "Index file %s is corrupted or of unsupported version\n", name);
+		close_search_index(index);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+void close_search_index(id3v2_search_index_t *index) {
+	if(index->base) {
+		munmap((void *) index->base, index->len);
+	}
+	memset(index, 0, sizeof(*index));
+}
+
+
+/**
+ * Get term of the index
+ * @param index			pointer to the index structure
+ * @param term			term number
+ * @return				NUL terminated term
+ */
+static const char *get_search_term(const id3v2_search_index_t *index, uint64_t term) {
+	const uint64_t *offsets = (const uint64_t *) (index->base + index->header->term_offsets);
+
+	return (const char *) (index->base + index->header->term_heap + offsets[term]);
+}
+
+
+/**
+ * Find the first term which is not less than the given one (binary search)
+ * @param index			pointer to the index structure
+ * @param term			term to find
+ * @return				term number, number of terms if all terms are less
+ */
+static uint64_t lower_bound_term(const id3v2_search_index_t *index, const char *term) {
+	uint64_t low = 0;
+	uint64_t high = index->header->terms;
+	uint64_t mid;
+
+	while(low < high) {
+		mid = low + (high - low) / 2;
+		if(strcmp(get_search_term(index, mid), term) < 0) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+
+/**
+ * Decode posting list of the term into the bitmap of documents
+ * @param index			pointer to the index structure
+ * @param term			term number
+ * @param bitmap		bitmap of documents to set
+ */
+static void decode_postings(const id3v2_search_index_t *index, uint64_t term, uint8_t *bitmap) {
+	const uint64_t *offsets = (const uint64_t *) (index->base + index->header->posting_offsets);
+	const uint32_t *counts = (const uint32_t *) (index->base + index->header->doc_counts);
+	const unsigned char *p = index->base + index->header->postings + offsets[term];
+	const unsigned char *end = index->base + index->header->postings + offsets[term + 1];
+	uint64_t doc = 0;
+	uint32_t delta;
+	uint32_t shift;
+	uint32_t i;
+
+	for(i = 0; i < counts[term] && p < end; i++) {
+		delta = 0;
+		shift = 0;
+		while(p < end && (*p & 0x80) && shift < 28) {
+			delta |= (uint32_t) (*p++ & 0x7F) << shift;
+			shift += 7;
+		}
+		if(p < end) {
+			delta |= (uint32_t) *p++ << shift;
+		}
+		doc += delta;
+		if(doc < index->header->docs) {
+			bitmap[doc >> 3] |= 1 << (doc & 7);
+		}
+	}
+}
+
+
+uint64_t search_index(const id3v2_search_index_t *index, const char *query, uint8_t **p_matches) {
+	uint64_t bitmap_len = (index->header->docs + 7) / 8;
+	uint8_t *word_docs;
+	char term[SEARCH_TERM_MAX_LEN + 1];
+	const char *p = query;
+	uint64_t matches = 0;
+	uint64_t first;
+	uint64_t t;
+	uint64_t i;
+	size_t len;
+	int prefix;
+	int words = 0;
+
+	*p_matches = malloc(bitmap_len ? bitmap_len : 1);
+	word_docs = malloc(bitmap_len ? bitmap_len : 1);
+	if(*p_matches == NULL || word_docs == NULL) {
+		free(*p_matches);
+		*p_matches = NULL;
+		free(word_docs);
+		return 0;
+	}
+	memset(*p_matches, 0xFF, bitmap_len);
+
+	/* Words are tokenized the same way as the indexed texts, all of them have to match */
+	while((len = next_term(&p, term)) > 0) {
+		term[len] = '\0';
+		prefix = (*p == '*');
+		memset(word_docs, 0, bitmap_len);
+
+		first = lower_bound_term(index, term);
+		for(t = first; t < index->header->terms; t++) {
+			if(prefix ? strncmp(get_search_term(index, t), term, len) != 0 : strcmp(get_search_term(index, t), term) != 0) {
+				break;
+			}
+			decode_postings(index, t, word_docs);
+		}
+		for(i = 0; i < bitmap_len; i++) {
+			(*p_matches)[i] &= word_docs[i];
+		}
+		words++;
+	}
+	free(word_docs);
+
+	if(words == 0) {
+		memset(*p_matches, 0, bitmap_len);
+		return 0;
+	}
+	if(index->header->docs & 7) {
+		(*p_matches)[bitmap_len - 1] &= (1 << (index->header->docs & 7)) - 1;
+	}
+	for(i = 0; i < bitmap_len; i++) {
+		matches += __builtin_popcount((*p_matches)[i]);
+	}
+
+	return matches;
+}
+
+
+const char *get_search_path(const id3v2_search_index_t *index, uint64_t doc) {
+	const uint64_t *offsets = (const uint64_t *) (index->base + index->header->path_offsets);
+
+	return (const char *) (index->base + index->header->path_heap + offsets[doc]);
+}
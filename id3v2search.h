@@ -0,0 +1,173 @@
+/*
+ * id3v2search - inverted full-text index of ID3 tags
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ID3V2SEARCH_H_
+#define ID3V2SEARCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "id3v2parser.h"
+
+/** Full-text index file layout
+
+   Text information frames and lyrics of every file (document) are split
+   into terms: runs of ASCII letters and digits (folded to lower case)
+   and non-ASCII bytes, so UTF-8 words are kept whole. Terms are sorted
+   by strcmp() which allows binary search for both exact terms and
+   prefixes. Posting list of a term is the ascending list of documents
+   containing it, stored as variable length deltas (7 bits per byte, the
+   highest bit set on all bytes but the last one).
+
+     +---------------------------------------------+
+     | Index header (88 bytes)                     |
+     +---------------------------------------------+
+     | Path offsets      uint64 * (docs + 1)       |
+     | Path heap         NUL terminated strings    |
+     | Term offsets      uint64 * (terms + 1)      |
+     | Term heap         NUL terminated strings    |
+     | Document counts   uint32 * terms            |
+     | Posting offsets   uint64 * (terms + 1)      |
+     | Postings          delta encoded documents   |
+     +---------------------------------------------+
+
+   As in the columnar index, integers are stored in byte order of the
+   host which built the index, sections are aligned to 8 bytes and their
+   offsets are absolute file offsets.
+
+   The index is built in parallel: every worker thread adds documents
+   into its own segment and the segments are merged when they are
+   written. Every document is added by one thread only, so posting lists
+   of the segments never overlap.
+ */
+
+/** Magic bytes of the index file */
+#define SEARCH_INDEX_MAGIC "ID3FTIX"
+/** Version of the index file layout */
+#define SEARCH_INDEX_VERSION 1
+/** Longest indexed term, longer ones are truncated */
+#define SEARCH_TERM_MAX_LEN 64
+
+
+/** Index file header */
+
+typedef struct id3v2_search_index_header_s {
+	char magic[8];				/**< SEARCH_INDEX_MAGIC */
+	uint32_t version;			/**< SEARCH_INDEX_VERSION */
+	uint32_t reserved;			/**< zero */
+	uint64_t docs;				/**< number of documents (files) */
+	uint64_t terms;				/**< number of distinct terms */
+	uint64_t path_offsets;		/**< offset of path offsets */
+	uint64_t path_heap;			/**< offset of path heap */
+	uint64_t term_offsets;		/**< offset of term offsets */
+	uint64_t term_heap;			/**< offset of term heap */
+	uint64_t doc_counts;		/**< offset of document counts */
+	uint64_t posting_offsets;	/**< offset of posting offsets */
+	uint64_t postings;			/**< offset of postings */
+} id3v2_search_index_header_t;
+
+/** Segment of the index built by one thread (opaque) */
+typedef struct id3v2_search_segment_s id3v2_search_segment_t;
+
+/** Memory mapped index */
+
+typedef struct id3v2_search_index_s {
+	const unsigned char *base;				/**< mapped file */
+	size_t len;								/**< length of the mapped file */
+	const id3v2_search_index_header_t *header;	/**< index header */
+} id3v2_search_index_t;
+
+
+/**
+ * Create empty segment of the index
+ * @return				segment or NULL if problem has occurred
+ */
+id3v2_search_segment_t *create_search_segment(void);
+
+/**
+ * Add terms of the parsed tag into the segment, documents have to be added in ascending order
+ * @param segment		segment of the index
+ * @param doc			document number (index of the file in the list of files)
+ * @param tag			pointer to the parsed ID3 tag structure
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int add_search_document(id3v2_search_segment_t *segment, uint32_t doc, const id3v2_tag_t *tag);
+
+/**
+ * Merge segments and write the index into file
+ * @param segments		array of segments
+ * @param segments_len	number of segments
+ * @param paths			paths of the documents
+ * @param docs			number of documents
+ * @param name			filename of the index
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int write_search_index(id3v2_search_segment_t **segments, size_t segments_len, char **paths, uint32_t docs,
+		const char *name);
+
+/**
+ * Free the segment
+ * @param segment		segment of the index
+ */
+void free_search_segment(id3v2_search_segment_t *segment);
+
+/**
+ * Map the index file into memory and validate its layout
+ * @param name			filename of the index
+ * @param index			pointer to the index structure to fill in
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int open_search_index(const char *name, id3v2_search_index_t *index);
+
+/**
+ * Unmap the index file
+ * @param index			pointer to the index structure
+ */
+void close_search_index(id3v2_search_index_t *index);
+
+/**
+ * Find documents matching all words of the query, word ending with '*' matches terms by prefix
+ * @param index			pointer to the index structure
+ * @param query			words separated by spaces
+ * @param p_matches		pointer to the allocated bitmap of matching documents, caller frees it (NULL if memory cannot be allocated)
+ * @return				number of matching documents
+ */
+uint64_t search_index(const id3v2_search_index_t *index, const char *query, uint8_t **p_matches);
+
+/**
+ * Get path of the document
+ * @param index			pointer to the index structure
+ * @param doc			document number
+ * @return				path of the file
+ */
+const char *get_search_path(const id3v2_search_index_t *index, uint64_t doc);
+
+
+#endif /* ID3V2SEARCH_H_ */
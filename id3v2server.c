@@ -0,0 +1,1055 @@
+/*
+ *  id3v2server - metadata daemon over Unix domain socket
+ *
+ * 	Keeps the parser warm in a long-running process and answers requests for
+ * 	parsed ID3 tags over a Unix domain socket, so that single-file lookups do
+ * 	not pay for process startup. See id3v2server.h for the protocol.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "id3v2parser.h"
+#include "id3v2picture.h"
+#include "id3v2server.h"
+
+/** Maximal number of events handled by one epoll_wait() */
+#define MAX_EVENTS 64
+/** Size of the chunk read from the socket */
+#define READ_CHUNK_LEN 65536
+
+/** Types of the requests */
+#define REQUEST_PATH 0
+#define REQUEST_DATA 1
+
+
+/** Growing buffer of bytes */
+typedef struct text_buffer_s {
+	char *data;				/**< content */
+	size_t len;				/**< used length */
+	size_t capacity;		/**< allocated length */
+} text_buffer_t;
+
+/** Client connection */
+typedef struct connection_s {
+	int fd;					/**< socket of the connection */
+	text_buffer_t in;		/**< received data not processed yet */
+	text_buffer_t out;		/**< responses not sent yet */
+	size_t out_pos;			/**< already sent part of out */
+	uint8_t busy;			/**< request is being parsed by a worker */
+	uint8_t closing;		/**< peer has closed the connection */
+	uint8_t half_closed;	/**< peer has finished sending, connection is closed when its requests are answered */
+	uint32_t events;		/**< events the socket is polled for */
+	struct connection_s *prev;	/**< previous connection of the server */
+	struct connection_s *next;	/**< next connection of the server */
+} connection_t;
+
+/** Request handed to the worker thread */
+typedef struct job_s {
+	connection_t *conn;		/**< connection of the request */
+	int type;				/**< REQUEST_PATH or REQUEST_DATA */
+	char *path;				/**< path of the file (REQUEST_PATH) */
+	unsigned char *data;	/**< data to parse (REQUEST_DATA) */
+	uint32_t len;			/**< length of the data */
+	text_buffer_t response;	/**< formatted response */
+	struct job_s *next;		/**< next job in the queue */
+} job_t;
+
+/** Queue of jobs */
+typedef struct job_queue_s {
+	job_t *head;			/**< first job */
+	job_t *tail;			/**< last job */
+} job_queue_t;
+
+/** Cached response of PATH request */
+typedef struct cache_entry_s {
+	char *path;				/**< path of the file, NULL if the entry is empty */
+	dev_t dev;				/**< device of the file */
+	ino_t ino;				/**< inode of the file */
+	off_t size;				/**< size of the file */
+	struct timespec mtime;	/**< modification time of the file */
+	char *response;			/**< formatted response */
+	size_t len;				/**< length of the response */
+} cache_entry_t;
+
+/** State of the daemon */
+typedef struct server_s {
+	int listen_fd;			/**< listening socket */
+	int epoll_fd;			/**< epoll instance */
+	int event_fd;			/**< signals finished jobs to the event loop */
+	connection_t *connections;	/**< list of open connections */
+	job_queue_t pending;	/**< jobs waiting for a worker */
+	job_queue_t done;		/**< jobs waiting for the event loop */
+	pthread_mutex_t lock;	/**< protects both queues and stop */
+	pthread_cond_t cond;	/**< signals pending jobs to workers */
+	uint8_t stop;			/**< workers should exit */
+	cache_entry_t *cache;	/**< direct mapped cache of responses */
+	pthread_mutex_t cache_lock;	/**< protects cache */
+} server_t;
+
+
+/** Set by the signal handler to stop the event loop */
+static volatile sig_atomic_t stop_requested = 0;
+
+
+/**
+ * Signal handler requesting stop of the daemon
+ * @param signum		number of the signal
+ */
+static void handle_stop_signal(int signum) {
+	(void) signum;
+	stop_requested = 1;
+}
+
+
+/**
+ * Append data to the growing buffer
+ * @param buffer		growing buffer
+ * @param data			data to append
+ * @param len			length of the data
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int append_text(text_buffer_t *buffer, const void *data, size_t len) {
+	char *tmp;
+	size_t capacity;
+
+	if(buffer->len + len > buffer->capacity) {
+		capacity = buffer->capacity ? buffer->capacity : 256;
+		while(capacity < buffer->len + len) {
+			capacity *= 2;
+		}
+		tmp = realloc(buffer->data, capacity);
+		if(tmp == NULL) {
+			return 1;
+		}
+		buffer->data = tmp;
+		buffer->capacity = capacity;
+	}
+	memcpy(buffer->data + buffer->len, data, len);
+	buffer->len += len;
+
+	return 0;
+}
+
+
+/**
+ * Append text with backslash, tab, carriage return and newline escaped
+ * @param buffer		growing buffer
+ * @param text			NUL terminated text
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int append_escaped(text_buffer_t *buffer, const char *text) {
+	const char *start = text;
+	const char *escape;
+
+	for(; *text; text++) {
+		switch(*text) {
+		case '\\':	escape = "\\\\"; break;
+		case '\t':	escape = "\\t"; break;
+		case '\r':	escape = "\\r"; break;
+		case '\n':	escape = "\\n"; break;
+		default:	continue;
+		}
+		if(append_text(buffer, start, text - start) != 0 || append_text(buffer, escape, 2) != 0) {
+			return 1;
+		}
+		start = text + 1;
+	}
+	return append_text(buffer, start, text - start);
+}
+
+
+/**
+ * Format the parsed tag as the response
+ * @param tag			pointer to the parsed ID3 tag structure
+ * @param out			buffer for the response
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int format_response(const id3v2_tag_t *tag, text_buffer_t *out) {
+	id3v2_picture_info_t info;
+	char line[64];
+	uint32_t i;
+	int result = append_text(out, "OK\n", 3);
+
+	for(i = 0; i < TEXTINFO_COUNT; i++) {
+		if(tag->text[i]) {
+			result |= append_text(out, get_id3v2_text_id(i), 4);
+			result |= append_text(out, "\t", 1);
+			result |= append_escaped(out, tag->text[i]);
+			result |= append_text(out, "\n", 1);
+		}
+	}
+	if(tag->lyrics.text) {
+		result |= append_text(out, "USLT\t", 5);
+		result |= append_escaped(out, tag->lyrics.lang ? tag->lyrics.lang : "");
+		result |= append_text(out, "\t", 1);
+		result |= append_escaped(out, tag->lyrics.text);
+		result |= append_text(out, "\n", 1);
+	}
+	for(i = 0; i < APIC_TYPE_COUNT; i++) {
+		if(tag->pictures[i].data) {
+			snprintf(line, sizeof(line), "APIC\t%u\t", i);
+			result |= append_text(out, line, strlen(line));
+			result |= append_escaped(out, tag->pictures[i].mime ? tag->pictures[i].mime : "");
+			probe_id3v2_picture(tag->pictures[i].data, tag->pictures[i].len, tag->pictures[i].flags & FLAG_FR_UNSYNC, &info);
+			snprintf(line, sizeof(line), "\t%u\t%s\t%u\t%u\n", tag->pictures[i].len,
+					info.mime ? info.mime : "", info.width, info.height);
+			result |= append_text(out, line, strlen(line));
+		}
+	}
+	result |= append_text(out, "\n", 1);
+
+	return result;
+}
+
+
+/**
+ * Format error response
+ * @param out			buffer for the response
+ * @param message		error message
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int format_error(text_buffer_t *out, const char *message) {
+	return append_text(out, "ERR ", 4) | append_text(out, message, strlen(message)) | append_text(out, "\n\n", 2);
+}
+
+
+/**
+ * Compute FNV-1a hash of the path
+ * @param path			path of the file
+ * @return				hash
+ */
+static uint32_t hash_path(const char *path) {
+	uint32_t hash = 2166136261u;
+
+	while(*path) {
+		hash = (hash ^ (unsigned char) *path++) * 16777619u;
+	}
+	return hash;
+}
+
+
+/**
+ * Append cached response of the unchanged file
+ * @param server		state of the daemon
+ * @param path			path of the file
+ * @param st			current attributes of the file
+ * @param out			buffer for the response
+ * @return				1 if the response was cached, 0 otherwise
+ */
+static int lookup_cache(server_t *server, const char *path, const struct stat *st, text_buffer_t *out) {
+	cache_entry_t *entry = &server->cache[hash_path(path) & (RESPONSE_CACHE_LEN - 1)];
+	int found = 0;
+
+	pthread_mutex_lock(&server->cache_lock);
+	if(entry->path && strcmp(entry->path, path) == 0 && entry->dev == st->st_dev && entry->ino == st->st_ino
+			&& entry->size == st->st_size && entry->mtime.tv_sec == st->st_mtim.tv_sec
+			&& entry->mtime.tv_nsec == st->st_mtim.tv_nsec) {
+		found = append_text(out, entry->response, entry->len) == 0;
+	}
+	pthread_mutex_unlock(&server->cache_lock);
+
+	return found;
+}
+
+
+/**
+ * Store response of the file into the cache, replacing the entry with the same slot
+ * @param server		state of the daemon
+ * @param path			path of the file
+ * @param st			attributes of the file when it was parsed
+ * @param response		formatted response
+ */
+static void store_cache(server_t *server, const char *path, const struct stat *st, const text_buffer_t *response) {
+	cache_entry_t *entry = &server->cache[hash_path(path) & (RESPONSE_CACHE_LEN - 1)];
+	char *path_copy = strdup(path);
+	char *response_copy = malloc(response->len);
+
+	if(path_copy == NULL || response_copy == NULL) {
+		free(path_copy);
+		free(response_copy);
+		return;
+	}
+	memcpy(response_copy, response->data, response->len);
+
+	pthread_mutex_lock(&server->cache_lock);
+	free(entry->path);
+	free(entry->response);
+	entry->path = path_copy;
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->size = st->st_size;
+	entry->mtime = st->st_mtim;
+	entry->response = response_copy;
+	entry->len = response->len;
+	pthread_mutex_unlock(&server->cache_lock);
+}
+
+
+/**
+ * Parse the request of the job and format its response
+ * @param server		state of the daemon
+ * @param job			job to process
+ * @param p_buffer		pointer to the read buffer of the worker
+ * @param p_capacity	pointer to the allocated length of the read buffer
+ */
+static void process_job(server_t *server, job_t *job, unsigned char **p_buffer, uint32_t *p_capacity) {
+	id3v2_tag_t tag;
+	unsigned char *buffer = job->data;
+	uint32_t len = job->len;
+	struct stat st;
+	int fd = -1;
+	int result;
+
+	if(job->type == REQUEST_PATH) {
+		fd = open(job->path, O_RDONLY);
+		if(fd < 0 || fstat(fd, &st) != 0 || read_tag_prefix(fd, p_buffer, p_capacity, &len) != 0) {
+			format_error(&job->response, "cannot read file");
+			if(fd >= 0) {
+				close(fd);
+			}
+			return;
+		}
+		close(fd);
+		buffer = *p_buffer;
+	}
+
+	init_id3v2_tag(&tag);
+	if(parse_buffer(&tag, buffer, len) == 0) {
+		result = format_response(&tag, &job->response);
+	}
+	else {
+		result = format_error(&job->response, "cannot parse ID3 tag");
+	}
+	deallocate_memory(&tag, NULL);
+
+	if(result != 0) {
+		job->response.len = 0;
+		format_error(&job->response, "out of memory");
+	}
+	else if(job->type == REQUEST_PATH) {
+		store_cache(server, job->path, &st, &job->response);
+	}
+}
+
+
+/**
+ * Worker thread parsing requests
+ * @param arg			state of the daemon
+ * @return				NULL
+ */
+static void *run_worker(void *arg) {
+	server_t *server = arg;
+	unsigned char *buffer = NULL;
+	uint32_t capacity = 0;
+	uint64_t one = 1;
+	job_t *job;
+
+	for(;;) {
+		pthread_mutex_lock(&server->lock);
+		while(server->pending.head == NULL && !server->stop) {
+			pthread_cond_wait(&server->cond, &server->lock);
+		}
+		if(server->stop) {
+			pthread_mutex_unlock(&server->lock);
+			break;
+		}
+		job = server->pending.head;
+		server->pending.head = job->next;
+		if(server->pending.head == NULL) {
+			server->pending.tail = NULL;
+		}
+		pthread_mutex_unlock(&server->lock);
+
+		process_job(server, job, &buffer, &capacity);
+
+		/* Hand the response back to the event loop */
+		job->next = NULL;
+		pthread_mutex_lock(&server->lock);
+		if(server->done.tail) {
+			server->done.tail->next = job;
+		}
+		else {
+			server->done.head = job;
+		}
+		server->done.tail = job;
+		pthread_mutex_unlock(&server->lock);
+		if(write(server->event_fd, &one, sizeof(one)) != sizeof(one)) {
+			fprintf(stderr, "Error while waking up event loop!\n");
+		}
+	}
+
+	free_id3v2_memory(buffer);
+	return NULL;
+}
+
+
+/**
+ * Free the job
+ * @param job			job to free
+ */
+static void free_job(job_t *job) {
+	free(job->path);
+	free(job->data);
+	free(job->response.data);
+	free(job);
+}
+
+
+/**
+ * Close connection and free it
+ * @param server		state of the daemon
+ * @param conn			connection to close
+ */
+static void close_connection(server_t *server, connection_t *conn) {
+	if(conn->fd >= 0) {
+		epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+		close(conn->fd);
+		conn->fd = -1;
+	}
+
+	/* Connection with a request being parsed is freed when the response comes back */
+	if(conn->busy) {
+		conn->closing = 1;
+		return;
+	}
+	if(conn->prev) {
+		conn->prev->next = conn->next;
+	}
+	else {
+		server->connections = conn->next;
+	}
+	if(conn->next) {
+		conn->next->prev = conn->prev;
+	}
+	free(conn->in.data);
+	free(conn->out.data);
+	free(conn);
+}
+
+
+/**
+ * Send buffered responses, socket is polled for writing if they cannot be sent at once
+ * @param server		state of the daemon
+ * @param conn			connection
+ * @return				0 if OK, 1 if the connection was closed
+ */
+static int flush_connection(server_t *server, connection_t *conn) {
+	struct epoll_event event;
+	ssize_t written;
+
+	while(conn->out_pos < conn->out.len) {
+		written = send(conn->fd, conn->out.data + conn->out_pos, conn->out.len - conn->out_pos, MSG_NOSIGNAL);
+		if(written < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			close_connection(server, conn);
+			return 1;
+		}
+		conn->out_pos += written;
+	}
+	if(conn->out_pos == conn->out.len) {
+		conn->out.len = 0;
+		conn->out_pos = 0;
+	}
+
+	/* Half-closed connection is closed once all of its requests are answered */
+	if(conn->half_closed && !conn->busy && conn->out.len == 0) {
+		close_connection(server, conn);
+		return 1;
+	}
+
+	/* Input is not read while a request is parsed, so the input buffer does not grow */
+	event.events = (conn->busy || conn->half_closed ? 0 : EPOLLIN | EPOLLRDHUP) | (conn->out_pos < conn->out.len ? EPOLLOUT : 0);
+	if(event.events != conn->events) {
+		event.data.ptr = conn;
+		epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+		conn->events = event.events;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Queue the job for the workers
+ * @param server		state of the daemon
+ * @param job			job to queue
+ */
+static void queue_job(server_t *server, job_t *job) {
+	job->conn->busy = 1;
+	pthread_mutex_lock(&server->lock);
+	if(server->pending.tail) {
+		server->pending.tail->next = job;
+	}
+	else {
+		server->pending.head = job;
+	}
+	server->pending.tail = job;
+	pthread_cond_signal(&server->cond);
+	pthread_mutex_unlock(&server->lock);
+}
+
+
+/**
+ * Remove processed bytes from the input buffer of the connection
+ * @param conn			connection
+ * @param len			number of processed bytes
+ */
+static void consume_input(connection_t *conn, size_t len) {
+	memmove(conn->in.data, conn->in.data + len, conn->in.len - len);
+	conn->in.len -= len;
+}
+
+
+/**
+ * Process complete requests of the connection until one is handed to a worker
+ * @param server		state of the daemon
+ * @param conn			connection
+ * @return				0 if OK, 1 if the connection was closed
+ */
+static int handle_requests(server_t *server, connection_t *conn) {
+	char *newline;
+	size_t line_len;
+	unsigned long data_len;
+	char *end;
+	struct stat st;
+	job_t *job;
+
+	while(!conn->busy && conn->in.len > 0) {
+		newline = memchr(conn->in.data, '\n', conn->in.len);
+		if(newline == NULL) {
+			if(conn->in.len > MAX_REQUEST_LINE) {
+				format_error(&conn->out, "request line too long");
+				/* Connection is closed by the flush once the error and earlier responses are sent */
+				conn->in.len = 0;
+				conn->half_closed = 1;
+				return flush_connection(server, conn);
+			}
+			break;
+		}
+		*newline = '\0';
+		line_len = newline - conn->in.data + 1;
+
+		job = calloc(1, sizeof(job_t));
+		if(job == NULL) {
+			close_connection(server, conn);
+			return 1;
+		}
+		job->conn = conn;
+
+		if(strncmp(conn->in.data, "PATH ", 5) == 0) {
+			/* Unchanged file is answered from the cache without leaving the event loop */
+			if(stat(conn->in.data + 5, &st) == 0 && lookup_cache(server, conn->in.data + 5, &st, &conn->out)) {
+				consume_input(conn, line_len);
+				free(job);
+				continue;
+			}
+			job->type = REQUEST_PATH;
+			job->path = strdup(conn->in.data + 5);
+			if(job->path == NULL) {
+				free_job(job);
+				close_connection(server, conn);
+				return 1;
+			}
+			consume_input(conn, line_len);
+			queue_job(server, job);
+		}
+		else if(strncmp(conn->in.data, "DATA ", 5) == 0) {
+			data_len = strtoul(conn->in.data + 5, &end, 10);
+			if(*end != '\0' || data_len > MAX_REQUEST_DATA) {
+				free_job(job);
+				format_error(&conn->out, "wrong data length");
+				/* Connection is closed by the flush once the error and earlier responses are sent */
+				conn->in.len = 0;
+				conn->half_closed = 1;
+				return flush_connection(server, conn);
+			}
+			if(conn->in.len < line_len + data_len) {
+				/* Wait for the rest of the data, the line is parsed again */
+				*newline = '\n';
+				free_job(job);
+				break;
+			}
+			job->type = REQUEST_DATA;
+			job->len = data_len;
+			job->data = malloc(data_len ? data_len : 1);
+			if(job->data == NULL) {
+				free_job(job);
+				close_connection(server, conn);
+				return 1;
+			}
+			memcpy(job->data, conn->in.data + line_len, data_len);
+			consume_input(conn, line_len + data_len);
+			queue_job(server, job);
+		}
+		else {
+			free_job(job);
+			consume_input(conn, line_len);
+			format_error(&conn->out, "unknown request");
+		}
+	}
+
+	return flush_connection(server, conn);
+}
+
+
+/**
+ * Read data from the connection and process its requests
+ * @param server		state of the daemon
+ * @param conn			connection
+ */
+static void read_connection(server_t *server, connection_t *conn) {
+	char chunk[READ_CHUNK_LEN];
+	ssize_t len;
+
+	/* Busy connection is not polled for input, it is read again when its request is answered */
+	if(conn->busy || conn->half_closed) {
+		return;
+	}
+
+	/* Input buffer holds at most one request, the rest is left in the socket */
+	while(conn->in.len < MAX_REQUEST_LINE + MAX_REQUEST_DATA) {
+		len = recv(conn->fd, chunk, sizeof(chunk), 0);
+		if(len > 0) {
+			if(append_text(&conn->in, chunk, len) != 0) {
+				close_connection(server, conn);
+				return;
+			}
+			continue;
+		}
+		if(len < 0 && errno == EINTR) {
+			continue;
+		}
+		if(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		if(len < 0) {
+			close_connection(server, conn);
+			return;
+		}
+		/* Peer has finished sending, requests already received are still answered */
+		conn->half_closed = 1;
+		break;
+	}
+
+	handle_requests(server, conn);
+}
+
+
+/**
+ * Accept all pending connections
+ * @param server		state of the daemon
+ */
+static void accept_connections(server_t *server) {
+	struct epoll_event event;
+	connection_t *conn;
+	int fd;
+
+	while((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		conn = calloc(1, sizeof(connection_t));
+		if(conn == NULL) {
+			close(fd);
+			continue;
+		}
+		conn->fd = fd;
+		conn->events = event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.ptr = conn;
+		if(epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+			close(fd);
+			free(conn);
+			continue;
+		}
+		conn->next = server->connections;
+		if(conn->next) {
+			conn->next->prev = conn;
+		}
+		server->connections = conn;
+	}
+}
+
+
+/**
+ * Deliver responses of finished jobs to their connections
+ * @param server		state of the daemon
+ */
+static void deliver_responses(server_t *server) {
+	uint64_t count;
+	job_t *job;
+	job_t *next;
+	connection_t *conn;
+
+	if(read(server->event_fd, &count, sizeof(count)) != sizeof(count)) {
+		return;
+	}
+	pthread_mutex_lock(&server->lock);
+	job = server->done.head;
+	server->done.head = server->done.tail = NULL;
+	pthread_mutex_unlock(&server->lock);
+
+	for(; job; job = next) {
+		next = job->next;
+		conn = job->conn;
+		conn->busy = 0;
+		if(conn->closing) {
+			close_connection(server, conn);
+		}
+		else if(append_text(&conn->out, job->response.data, job->response.len) != 0) {
+			close_connection(server, conn);
+		}
+		else {
+			/* Next request of the connection may be already buffered */
+			handle_requests(server, conn);
+		}
+		free_job(job);
+	}
+}
+
+
+/**
+ * Create listening socket
+ * @param socket_path	path of the socket
+ * @return				socket or -1 if problem has occurred
+ */
+static int create_listen_socket(const char *socket_path) {
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+
+	if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path %s is too long!\n", socket_path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd < 0) {
+		fprintf(stderr, "Error while creating socket!\n");
+		return -1;
+	}
+	/* Stale socket of a previous run is replaced, any other file is kept */
+	if(lstat(socket_path, &st) == 0) {
+		if(!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "File %s exists and it is not a socket!\n", socket_path);
+			close(fd);
+			return -1;
+		}
+		unlink(socket_path);
+	}
+	if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+		fprintf(stderr, "Error while listening on socket %s!\n", socket_path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+int run_id3v2_server(const char *socket_path, long threads) {
+	server_t server;
+	struct epoll_event event;
+	struct epoll_event events[MAX_EVENTS];
+	struct sigaction action;
+	pthread_t *workers;
+	long started = 0;
+	int count;
+	int i;
+	job_t *job;
+
+	/* Responses carry the tags, headers of parsed tags and frames are not printed */
+	set_id3v2_verbosity(VERBOSITY_QUIET);
+
+	memset(&server, 0, sizeof(server));
+	server.listen_fd = server.epoll_fd = server.event_fd = -1;
+	pthread_mutex_init(&server.lock, NULL);
+	pthread_cond_init(&server.cond, NULL);
+	pthread_mutex_init(&server.cache_lock, NULL);
+
+	workers = calloc(threads, sizeof(pthread_t));
+	server.cache = calloc(RESPONSE_CACHE_LEN, sizeof(cache_entry_t));
+	if(workers == NULL || server.cache == NULL) {
+		fprintf(stderr, "Error while allocating memory for server!\n");
+		goto end;
+	}
+
+	server.listen_fd = create_listen_socket(socket_path);
+	server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	server.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(server.listen_fd < 0 || server.epoll_fd < 0 || server.event_fd < 0) {
+		goto end;
+	}
+
+	/* Listening socket and eventfd are told apart from connections by their data */
+	event.events = EPOLLIN;
+	event.data.ptr = &server.listen_fd;
+	epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &event);
+	event.data.ptr = &server.event_fd;
+	epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.event_fd, &event);
+
+	for(started = 0; started < threads; started++) {
+		if(pthread_create(&workers[started], NULL, run_worker, &server) != 0) {
+			fprintf(stderr, "Error while starting worker thread!\n");
+			goto end;
+		}
+	}
+
+	/* Signals interrupt epoll_wait(), so they are not restarted */
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_stop_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	fprintf(stderr, "Listening on %s with %ld worker threads\n", socket_path, threads);
+	while(!stop_requested) {
+		count = epoll_wait(server.epoll_fd, events, MAX_EVENTS, -1);
+		if(count < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "Error while waiting for events!\n");
+			break;
+		}
+		for(i = 0; i < count; i++) {
+			if(events[i].data.ptr == &server.listen_fd) {
+				accept_connections(&server);
+			}
+			else if(events[i].data.ptr == &server.event_fd) {
+				deliver_responses(&server);
+			}
+			else if(events[i].events & (EPOLLHUP | EPOLLERR)) {
+				/* Peer has closed both directions, responses cannot be delivered */
+				close_connection(&server, events[i].data.ptr);
+			}
+			else if(events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+				read_connection(&server, events[i].data.ptr);
+			}
+			else if(events[i].events & EPOLLOUT) {
+				flush_connection(&server, events[i].data.ptr);
+			}
+		}
+	}
+
+end:
+	pthread_mutex_lock(&server.lock);
+	server.stop = 1;
+	pthread_cond_broadcast(&server.cond);
+	pthread_mutex_unlock(&server.lock);
+	while(started > 0) {
+		pthread_join(workers[--started], NULL);
+	}
+
+	/* Free jobs left in the queues and all connections */
+	for(job = server.pending.head; job; job = server.pending.head) {
+		server.pending.head = job->next;
+		job->conn->busy = 0;
+		free_job(job);
+	}
+	for(job = server.done.head; job; job = server.done.head) {
+		server.done.head = job->next;
+		job->conn->busy = 0;
+		free_job(job);
+	}
+	while(server.connections) {
+		server.connections->busy = 0;
+		close_connection(&server, server.connections);
+	}
+	if(server.cache) {
+		for(i = 0; i < RESPONSE_CACHE_LEN; i++) {
+			free(server.cache[i].path);
+			free(server.cache[i].response);
+		}
+	}
+	if(server.listen_fd >= 0) {
+		close(server.listen_fd);
+		unlink(socket_path);
+	}
+	if(server.epoll_fd >= 0) {
+		close(server.epoll_fd);
+	}
+	if(server.event_fd >= 0) {
+		close(server.event_fd);
+	}
+	free(server.cache);
+	free(workers);
+	pthread_mutex_destroy(&server.lock);
+	pthread_cond_destroy(&server.cond);
+	pthread_mutex_destroy(&server.cache_lock);
+
+	return stop_requested ? 0 : 1;
+}
+
+
+/**
+ * Compare two latencies
+ * @param a				pointer to the first latency
+ * @param b				pointer to the second latency
+ * @return				negative, zero or positive value
+ */
+static int compare_latencies(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * Send one PATH request and receive its response
+ * @param fd			socket connected to the daemon
+ * @param path			absolute path of the file
+ * @param response		buffer for the response
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int send_request(int fd, const char *path, text_buffer_t *response) {
+	char chunk[READ_CHUNK_LEN];
+	size_t len = strlen(path);
+	ssize_t received;
+	struct iovec iov[3];
+
+	iov[0].iov_base = "PATH ";
+	iov[0].iov_len = 5;
+	iov[1].iov_base = (void *) path;
+	iov[1].iov_len = len;
+	iov[2].iov_base = "\n";
+	iov[2].iov_len = 1;
+	if(writev(fd, iov, 3) != (ssize_t) (len + 6)) {
+		return 1;
+	}
+
+	/* Response ends with an empty line */
+	response->len = 0;
+	while(response->len < 2 || memcmp(response->data + response->len - 2, "\n\n", 2) != 0) {
+		received = recv(fd, chunk, sizeof(chunk), 0);
+		if(received <= 0 || append_text(response, chunk, received) != 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+int run_id3v2_client(const char *socket_path, char **paths, size_t paths_len, long repeat) {
+	struct sockaddr_un addr;
+	text_buffer_t response = {NULL, 0, 0};
+	struct timespec start;
+	struct timespec stop;
+	uint64_t *latencies;
+	char **absolute;
+	size_t count = 0;
+	size_t i;
+	long r;
+	int fd;
+	int result = 1;
+
+	latencies = malloc(paths_len * repeat * sizeof(uint64_t));
+	absolute = calloc(paths_len, sizeof(char *));
+	if(latencies == NULL || absolute == NULL || strlen(socket_path) >= sizeof(addr.sun_path)) {
+		free(latencies);
+		free(absolute);
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+		fprintf(stderr, "Error while connecting to %s!\n", socket_path);
+		goto end;
+	}
+
+	/* Daemon may run in another working directory */
+	for(i = 0; i < paths_len; i++) {
+		absolute[i] = realpath(paths[i], NULL);
+		if(absolute[i] == NULL) {
+			absolute[i] = strdup(paths[i]);
+		}
+	}
+
+	for(r = 0; r < repeat; r++) {
+		for(i = 0; i < paths_len; i++) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			if(send_request(fd, absolute[i], &response) != 0) {
+				fprintf(stderr, "Error while communicating with %s!\n", socket_path);
+				goto end;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+			latencies[count++] = (stop.tv_sec - start.tv_sec) * 1000000000ull + stop.tv_nsec - start.tv_nsec;
+			if(r == 0) {
+				printf("%s\n", paths[i]);
+				fwrite(response.data, 1, response.len, stdout);
+			}
+		}
+	}
+
+	if(repeat > 1) {
+		qsort(latencies, count, sizeof(uint64_t), compare_latencies);
+		fprintf(stderr, "%lu requests, latency p50 %.1f us, p99 %.1f us, max %.1f us\n", (unsigned long) count,
+				latencies[count / 2] / 1000.0, latencies[count * 99 / 100] / 1000.0, latencies[count - 1] / 1000.0);
+	}
+	result = 0;
+
+end:
+	if(fd >= 0) {
+		close(fd);
+	}
+	for(i = 0; i < paths_len; i++) {
+		free(absolute[i]);
+	}
+	free(absolute);
+	free(latencies);
+	free(response.data);
+
+	return result;
+}
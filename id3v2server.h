@@ -0,0 +1,97 @@
+/*
+ * id3v2server - metadata daemon over Unix domain socket
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ID3V2SERVER_H_
+#define ID3V2SERVER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Protocol of the daemon
+
+   Client sends requests over a stream Unix domain socket, every request
+   starts with a line terminated by '\n':
+
+     PATH <absolute path>    parse ID3 tag of the file
+     DATA <length>           parse <length> bytes following the line
+                             (ID3 tag or beginning of a file)
+
+   Requests of one connection are answered in order. Every response
+   starts with status line 'OK' or 'ERR <message>', continues with
+   lines of parsed data and ends with an empty line:
+
+     TIT2<TAB><text>                       text information frame
+     USLT<TAB><language><TAB><lyrics>      unsynchronised lyrics
+     APIC<TAB><type><TAB><mime><TAB><len><TAB><format><TAB><width><TAB><height>
+                                           attached picture, format and
+                                           dimensions are probed from the
+                                           picture (empty format and zero
+                                           dimensions if not recognised)
+
+   Backslash, tab, carriage return and newline in texts are escaped as
+   '\\', '\t', '\r' and '\n'.
+
+   The event loop (epoll) reads requests and answers PATH requests for
+   unchanged files (same device, inode, size and modification time)
+   directly from the cache of responses. Other requests are parsed by
+   worker threads, each reusing its read buffer, and their responses are
+   handed back to the event loop through an eventfd.
+ */
+
+/** Default path of the socket */
+#define DEFAULT_SOCKET_PATH "/tmp/id3v2parser.sock"
+/** Longest request line */
+#define MAX_REQUEST_LINE 4096
+/** Largest DATA request (maximal tag with header and footer) */
+#define MAX_REQUEST_DATA (0x0FFFFFFF + 20)
+/** Number of cached responses (power of two) */
+#define RESPONSE_CACHE_LEN 65536
+
+
+/**
+ * Run the daemon until SIGINT or SIGTERM is received
+ * @param socket_path	path of the socket to listen on
+ * @param threads		number of worker threads
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int run_id3v2_server(const char *socket_path, long threads);
+
+/**
+ * Send PATH requests to the daemon and print responses
+ * @param socket_path	path of the socket of the daemon
+ * @param paths			paths of the files
+ * @param paths_len		number of paths
+ * @param repeat		number of times every request is sent, latencies are printed if more than one
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int run_id3v2_client(const char *socket_path, char **paths, size_t paths_len, long repeat);
+
+
+#endif /* ID3V2SERVER_H_ */
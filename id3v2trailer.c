@@ -0,0 +1,292 @@
+/*
+ *  id3v2trailer - reading of ID3v1 and APEv2 trailers
+ *
+ * 	Reads ID3v1/1.1 tag and APEv2 tag from the end of the file by one read
+ * 	and merges their texts with the parsed ID3v2 tag. See id3v2trailer.h
+ * 	for the details.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "id3v2trailer.h"
+
+
+/** Text frames of APEv2 item keys (keys are case insensitive) */
+static const struct {
+	const char *key;
+	const char *id;
+} ape_keys[] = {
+	{"Title",			"TIT2"},
+	{"Subtitle",		"TIT3"},
+	{"Artist",			"TPE1"},
+	{"Album Artist",	"TPE2"},
+	{"Conductor",		"TPE3"},
+	{"Album",			"TALB"},
+	{"Track",			"TRCK"},
+	{"Disc",			"TPOS"},
+	{"Year",			"TDRC"},
+	{"Genre",			"TCON"},
+	{"Composer",		"TCOM"},
+	{"Lyricist",		"TEXT"},
+	{"Publisher",		"TPUB"},
+	{"Copyright",		"TCOP"},
+	{"ISRC",			"TSRC"},
+	{"Language",		"TLAN"},
+	{"Media",			"TMED"},
+	{NULL,				NULL}
+};
+
+
+/**
+ * Read little endian 32-bit number
+ * @param p				buffer of at least 4 bytes
+ * @return				number
+ */
+static uint32_t get_le32(const unsigned char *p) {
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+/**
+ * Store text of the trailer unless the text frame is already set
+ * @param trailer		pointer to the trailer
+ * @param id			four-char text frame ID code
+ * @param text			text, not terminated
+ * @param len			length of the text, empty text is not stored
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int set_trailer_text(id3v2_tag_t *trailer, const char *id, const char *text, uint32_t len) {
+	uint32_t i;
+
+	for(i = 0; i < TEXTINFO_COUNT; i++) {
+		if(strcmp(get_id3v2_text_id(i), id) == 0) {
+			break;
+		}
+	}
+	if(i == TEXTINFO_COUNT || len == 0 || trailer->text[i] != NULL) {
+		return 0;
+	}
+
+	trailer->text[i] = alloc_id3v2_memory(len + 1);
+	if(trailer->text[i] == NULL) {
+		fprintf(stderr, "Error while allocating memory for trailer text!\n");
+		return 1;
+	}
+	memcpy(trailer->text[i], text, len);
+	trailer->text[i][len] = '\0';
+
+	return 0;
+}
+
+
+/**
+ * Store field of ID3v1 tag without its padding
+ * @param trailer		pointer to the trailer
+ * @param id			four-char text frame ID code
+ * @param field			field of ID3v1 tag
+ * @param len			length of the field
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int set_id3v1_field(id3v2_tag_t *trailer, const char *id, const unsigned char *field, uint32_t len) {
+	len = strnlen((const char *) field, len);
+	while(len > 0 && field[len - 1] == ' ') {
+		len--;
+	}
+	return set_trailer_text(trailer, id, (const char *) field, len);
+}
+
+
+/**
+ * Parse ID3v1 (or ID3v1.1) tag
+ * @param trailer		pointer to the trailer
+ * @param tag			ID3v1 tag of ID3V1_TAG_LEN bytes
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int parse_id3v1_tag(id3v2_tag_t *trailer, const unsigned char *tag) {
+	char number[4];
+	int result;
+
+	result = set_id3v1_field(trailer, "TIT2", tag + 3, 30)
+			|| set_id3v1_field(trailer, "TPE1", tag + 33, 30)
+			|| set_id3v1_field(trailer, "TALB", tag + 63, 30)
+			|| set_id3v1_field(trailer, "TDRC", tag + 93, 4);
+
+	/* ID3v1.1 track number replaces the last byte of the comment */
+	if(result == 0 && tag[125] == 0 && tag[126] != 0) {
+		result = set_trailer_text(trailer, "TRCK", number, snprintf(number, sizeof(number), "%u", tag[126]));
+	}
+	/* ID3v2.4 content type refers to ID3v1 genre by its number */
+	if(result == 0 && tag[127] != 0xFF) {
+		result = set_trailer_text(trailer, "TCON", number, snprintf(number, sizeof(number), "%u", tag[127]));
+	}
+
+	return result;
+}
+
+
+/**
+ * Parse APEv2 tag ending at the end of the buffer
+ * @param trailer		pointer to the trailer
+ * @param buffer		buffer ending with APEv2 footer
+ * @param len			length of the buffer
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int parse_ape_tag(id3v2_tag_t *trailer, const unsigned char *buffer, uint32_t len) {
+	const unsigned char *footer = buffer + len - APE_FOOTER_LEN;
+	const unsigned char *p;
+	const unsigned char *end;
+	const char *key;
+	uint32_t size;
+	uint32_t items;
+	uint32_t value_len;
+	uint32_t flags;
+	uint32_t key_len;
+	uint32_t i;
+	uint32_t j;
+
+	size = get_le32(footer + 12);
+	items = get_le32(footer + 16);
+	if(size < APE_FOOTER_LEN || size > len) {
+		fprintf(stderr, "APEv2 tag does not fit into the read trailer, it is skipped\n");
+		return 0;
+	}
+
+	p = buffer + len - size;
+	end = footer;
+	for(i = 0; i < items && end - p >= 8; i++) {
+		value_len = get_le32(p);
+		flags = get_le32(p + 4);
+		key = (const char *) p + 8;
+		key_len = strnlen(key, end - p - 8);
+		p += 8 + key_len + 1;
+		if(p > end || value_len > (uint32_t) (end - p)) {
+			fprintf(stderr, "APEv2 tag is corrupted, rest of it is skipped\n");
+			break;
+		}
+
+		/* Only UTF-8 text items are decoded, binary and external items are skipped */
+		if(((flags >> 1) & 0x03) == 0) {
+			for(j = 0; ape_keys[j].key; j++) {
+				if(strcasecmp(ape_keys[j].key, key) == 0) {
+					/* Item value may be list of texts separated by zero, the first one is taken */
+					if(set_trailer_text(trailer, ape_keys[j].id, (const char *) p, strnlen((const char *) p, value_len)) != 0) {
+						return 1;
+					}
+					break;
+				}
+			}
+		}
+		p += value_len;
+	}
+
+	return 0;
+}
+
+
+int parse_id3v2_trailer(id3v2_tag_t *trailer, const unsigned char *buffer, uint32_t len, uint32_t *p_found) {
+	const unsigned char *id3v1 = NULL;
+
+	*p_found = 0;
+
+	/* APEv2 tag may be followed by ID3v1 tag */
+	if(len >= ID3V1_TAG_LEN && memcmp(buffer + len - ID3V1_TAG_LEN, "TAG", 3) == 0) {
+		id3v1 = buffer + len - ID3V1_TAG_LEN;
+		len -= ID3V1_TAG_LEN;
+		*p_found |= TRAILER_ID3V1;
+	}
+
+	/* Items of APEv2 tag are stored first, so they take precedence over ID3v1 fields */
+	if(len >= APE_FOOTER_LEN && memcmp(buffer + len - APE_FOOTER_LEN, "APETAGEX", 8) == 0) {
+		*p_found |= TRAILER_APE;
+		if(parse_ape_tag(trailer, buffer, len) != 0) {
+			return 1;
+		}
+	}
+	if(id3v1 && parse_id3v1_tag(trailer, id3v1) != 0) {
+		return 1;
+	}
+
+	return 0;
+}
+
+
+int read_id3v2_trailer(int fd, uint64_t size, id3v2_tag_t *trailer, uint32_t *p_found) {
+	unsigned char *buffer;
+	uint32_t len;
+	int result;
+
+	*p_found = 0;
+	len = size < TRAILER_READ_LEN ? size : TRAILER_READ_LEN;
+	if(len == 0) {
+		return 0;
+	}
+
+	buffer = alloc_id3v2_memory(len);
+	if(buffer == NULL) {
+		fprintf(stderr, "Error while allocating memory for buffer!\n");
+		return 1;
+	}
+
+	/* Both trailers are taken by one read of the end of the file */
+	if(pread(fd, buffer, len, size - len) != (ssize_t) len) {
+		fprintf(stderr, "Error while reading file!\n");
+		free_id3v2_memory(buffer);
+		return 1;
+	}
+	result = parse_id3v2_trailer(trailer, buffer, len, p_found);
+	free_id3v2_memory(buffer);
+
+	return result;
+}
+
+
+void merge_id3v2_trailer(id3v2_tag_t *tag, id3v2_tag_t *trailer, int precedence) {
+	uint32_t i;
+
+	for(i = 0; i < TEXTINFO_COUNT; i++) {
+		if(trailer->text[i] == NULL) {
+			continue;
+		}
+		if(tag->text[i] == NULL || precedence == TRAILER_OVERRIDE) {
+			free_id3v2_memory(tag->text[i]);
+			tag->text[i] = trailer->text[i];
+		}
+		else {
+			free_id3v2_memory(trailer->text[i]);
+		}
+		trailer->text[i] = NULL;
+	}
+}
@@ -0,0 +1,114 @@
+/*
+ * id3v2trailer - reading of ID3v1 and APEv2 trailers
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ID3V2TRAILER_H_
+#define ID3V2TRAILER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "id3v2parser.h"
+
+/** Trailers
+
+   ID3v1 tag is stored in the last 128 bytes of the file:
+
+     "TAG" title(30) artist(30) album(30) year(4) comment(30) genre(1)
+
+   ID3v1.1 stores the track number in the last byte of the comment if
+   the byte before it is zero. Texts are ISO-8859-1 padded by spaces or
+   zeros.
+
+   APEv2 tag ends with 32 byte footer, either at the end of the file or
+   in front of ID3v1 tag:
+
+     "APETAGEX" version(4) size(4) items(4) flags(4) reserved(8)
+
+   Numbers are little endian, the size includes items and the footer
+   (but not the optional header). Each item is
+
+     value size(4) flags(4) key (ASCII, terminated by $00) value
+
+   and only UTF-8 text items are decoded (the first value of a list).
+
+   Both trailers are taken from one read of the last TRAILER_READ_LEN
+   bytes of the file. APEv2 tag which does not fit into it is skipped.
+   Items of APEv2 tag take precedence over ID3v1 fields, the merged
+   trailer then either only fills text frames missing in ID3v2 tag or
+   replaces them.
+ */
+
+/** Length of the end of the file read for the trailers */
+#define TRAILER_READ_LEN (64 * 1024)
+/** Length of ID3v1 tag */
+#define ID3V1_TAG_LEN 128
+/** Length of APEv2 tag footer */
+#define APE_FOOTER_LEN 32
+
+/** Trailer found in the file (bit mask) */
+#define TRAILER_ID3V1 0x01
+#define TRAILER_APE 0x02
+
+/** Precedence of the trailer */
+#define TRAILER_IGNORE 0		/**< trailer is not read */
+#define TRAILER_FILL 1			/**< trailer fills text frames missing in ID3v2 tag */
+#define TRAILER_OVERRIDE 2		/**< trailer replaces text frames of ID3v2 tag */
+
+
+/**
+ * Parse ID3v1 and APEv2 trailers at the end of the buffer into empty tag (texts only)
+ * @param trailer		pointer to the initialized ID3 tag structure to store the parsed texts
+ * @param buffer		end of the file
+ * @param len			length of the buffer
+ * @param p_found		pointer to the mask of found trailers (TRAILER_ID3V1, TRAILER_APE)
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int parse_id3v2_trailer(id3v2_tag_t *trailer, const unsigned char *buffer, uint32_t len, uint32_t *p_found);
+
+/**
+ * Read end of the file by one pread() and parse its ID3v1 and APEv2 trailers
+ * @param fd			file descriptor of the opened file
+ * @param size			size of the file
+ * @param trailer		pointer to the initialized ID3 tag structure to store the parsed texts
+ * @param p_found		pointer to the mask of found trailers (TRAILER_ID3V1, TRAILER_APE)
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int read_id3v2_trailer(int fd, uint64_t size, id3v2_tag_t *trailer, uint32_t *p_found);
+
+/**
+ * Move texts of the trailer into ID3 tag, remaining texts of the trailer are deallocated
+ * @param tag			pointer to the parsed ID3 tag
+ * @param trailer		pointer to the parsed trailer, it is empty after the call
+ * @param precedence	TRAILER_FILL or TRAILER_OVERRIDE
+ */
+void merge_id3v2_trailer(id3v2_tag_t *tag, id3v2_tag_t *trailer, int precedence);
+
+
+#endif /* ID3V2TRAILER_H_ */
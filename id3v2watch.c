@@ -0,0 +1,940 @@
+/*
+ *  id3v2watch - incremental processing of watched library
+ *
+ * 	Keeps outputs of the library up to date by watching its tree with inotify
+ * 	and parsing only files which were added or modified since the last run.
+ * 	See id3v2watch.h for the details.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "id3v2parser.h"
+#include "id3v2output.h"
+#include "id3v2column.h"
+#include "id3v2watch.h"
+
+/** Events of the watched directories */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+/** Size of the buffer for inotify events */
+#define EVENT_BUFFER_LEN 65536
+/** Maximal number of file descriptors used by nftw() */
+#define NFTW_FD_LIMIT 16
+
+/** States of the pending path */
+#define PENDING_CHANGED 0
+#define PENDING_DELETED 1
+#define PENDING_UNCHANGED 2
+
+
+/** Entry of the path map */
+typedef struct path_entry_s {
+	char *path;				/**< path of the file, NULL if the slot is empty */
+	uint64_t size;			/**< size of the file */
+	int64_t mtime_sec;		/**< modification time of the file, seconds */
+	int64_t mtime_nsec;		/**< modification time of the file, nanoseconds */
+	uint32_t generation;	/**< last full scan which has seen the file (snapshot) */
+	uint8_t state;			/**< PENDING_* state (pending paths) */
+	uint8_t removed;		/**< slot was removed, kept for probing */
+} path_entry_t;
+
+/** Hash map of paths with open addressing */
+typedef struct path_map_s {
+	path_entry_t *entries;	/**< slots */
+	size_t capacity;		/**< number of slots (power of two) */
+	size_t len;				/**< number of paths */
+	size_t used;			/**< number of slots with path or removed */
+} path_map_t;
+
+/** State of the watch mode */
+typedef struct watch_s {
+	int inotify_fd;			/**< inotify instance */
+	char **dirs;			/**< watched directories indexed by watch descriptor */
+	size_t dirs_len;		/**< length of dirs */
+	path_map_t snapshot;	/**< processed files */
+	path_map_t pending;		/**< paths with events not processed yet */
+	uint32_t generation;	/**< number of the current full scan */
+	uint8_t full_scan;		/**< files not seen by the scan are deleted */
+	const char *index_name;	/**< columnar index to maintain or NULL */
+	unsigned char *buffer;	/**< reused buffer for tags */
+	uint32_t capacity;		/**< allocated length of buffer */
+} watch_t;
+
+
+/** Set by the signal handler to stop watching */
+static volatile sig_atomic_t stop_requested = 0;
+
+/** State of the scan, nftw() does not pass user data to its callback */
+static watch_t *scan_watch = NULL;
+
+/** Extensions of the watched audio files */
+static const char * const audio_extensions[] = {
+	".mp3", ".mp2", ".aac", ".wav", ".aif", ".aiff", NULL
+};
+
+
+/**
+ * Signal handler requesting stop of the watch mode
+ * @param signum		number of the signal
+ */
+static void handle_stop_signal(int signum) {
+	(void) signum;
+	stop_requested = 1;
+}
+
+
+/**
+ * Check whether the file is an audio file by its extension
+ * @param path			path of the file
+ * @return				1 if the file is an audio file, 0 otherwise
+ */
+static int is_audio_file(const char *path) {
+	const char *extension = strrchr(path, '.');
+	uint32_t i;
+
+	/* Snapshot stores one path per line */
+	if(extension == NULL || strchr(path, '\n')) {
+		return 0;
+	}
+	for(i = 0; audio_extensions[i]; i++) {
+		if(strcasecmp(extension, audio_extensions[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Compute FNV-1a hash of the path
+ * @param path			path of the file
+ * @return				hash
+ */
+static uint32_t hash_path(const char *path) {
+	uint32_t hash = 2166136261u;
+
+	while(*path) {
+		hash = (hash ^ (unsigned char) *path++) * 16777619u;
+	}
+	return hash;
+}
+
+
+/**
+ * Find the path in the map
+ * @param map			path map
+ * @param path			path to find
+ * @return				entry of the path or NULL if the path is not in the map
+ */
+static path_entry_t *find_path(path_map_t *map, const char *path) {
+	size_t i;
+
+	if(map->capacity == 0) {
+		return NULL;
+	}
+	for(i = hash_path(path) & (map->capacity - 1); map->entries[i].path || map->entries[i].removed;
+			i = (i + 1) & (map->capacity - 1)) {
+		if(map->entries[i].path && strcmp(map->entries[i].path, path) == 0) {
+			return &map->entries[i];
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * Resize the map, removed slots are dropped
+ * @param map			path map
+ * @param capacity		new number of slots (power of two)
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int resize_path_map(path_map_t *map, size_t capacity) {
+	path_entry_t *entries = calloc(capacity, sizeof(path_entry_t));
+	size_t i;
+	size_t j;
+
+	if(entries == NULL) {
+		return 1;
+	}
+	for(i = 0; i < map->capacity; i++) {
+		if(map->entries[i].path) {
+			for(j = hash_path(map->entries[i].path) & (capacity - 1); entries[j].path; j = (j + 1) & (capacity - 1));
+			entries[j] = map->entries[i];
+		}
+	}
+	free(map->entries);
+	map->entries = entries;
+	map->capacity = capacity;
+	map->used = map->len;
+
+	return 0;
+}
+
+
+/**
+ * Insert the path into the map
+ * @param map			path map
+ * @param path			path to insert
+ * @return				entry of the path (existing or new) or NULL if problem has occurred
+ */
+static path_entry_t *insert_path(path_map_t *map, const char *path) {
+	path_entry_t *entry = find_path(map, path);
+	size_t capacity;
+	size_t i;
+
+	if(entry) {
+		return entry;
+	}
+	/* Map mostly filled with removed slots is only rehashed */
+	if((map->used + 1) * 4 > map->capacity * 3) {
+		capacity = map->capacity == 0 ? 1024 : ((map->len + 1) * 2 > map->capacity ? map->capacity * 2 : map->capacity);
+		if(resize_path_map(map, capacity) != 0) {
+			return NULL;
+		}
+	}
+	for(i = hash_path(path) & (map->capacity - 1); map->entries[i].path || map->entries[i].removed;
+			i = (i + 1) & (map->capacity - 1));
+	entry = &map->entries[i];
+	memset(entry, 0, sizeof(path_entry_t));
+	entry->path = strdup(path);
+	if(entry->path == NULL) {
+		return NULL;
+	}
+	map->len++;
+	map->used++;
+
+	return entry;
+}
+
+
+/**
+ * Remove the entry from the map
+ * @param map			path map
+ * @param entry			entry of the map
+ */
+static void remove_path(path_map_t *map, path_entry_t *entry) {
+	free(entry->path);
+	entry->path = NULL;
+	entry->removed = 1;
+	map->len--;
+}
+
+
+/**
+ * Remove all paths from the map
+ * @param map			path map
+ */
+static void clear_path_map(path_map_t *map) {
+	size_t i;
+
+	for(i = 0; i < map->capacity; i++) {
+		free(map->entries[i].path);
+		map->entries[i].path = NULL;
+		map->entries[i].removed = 0;
+	}
+	map->len = 0;
+	map->used = 0;
+}
+
+
+/**
+ * Load the snapshot file, missing file is an empty snapshot
+ * @param name			filename of the snapshot
+ * @param map			map to fill in
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int load_snapshot(const char *name, path_map_t *map) {
+	char *line = NULL;
+	size_t line_capacity = 0;
+	ssize_t len;
+	unsigned long long size;
+	long long sec;
+	long long nsec;
+	int path_pos;
+	path_entry_t *entry;
+	FILE *file;
+	int result = 0;
+
+	file = fopen(name, "r");
+	if(file == NULL) {
+		return errno == ENOENT ? 0 : 1;
+	}
+	while((len = getline(&line, &line_capacity, file)) > 0) {
+		if(line[len - 1] == '\n') {
+			line[len - 1] = '\0';
+		}
+		if(sscanf(line, "%llu\t%lld\t%lld\t%n", &size, &sec, &nsec, &path_pos) != 3) {
+			fprintf(stderr, "Wrong line in snapshot %s, it is skipped!\n", name);
+			continue;
+		}
+		entry = insert_path(map, line + path_pos);
+		if(entry == NULL) {
+			result = 1;
+			break;
+		}
+		entry->size = size;
+		entry->mtime_sec = sec;
+		entry->mtime_nsec = nsec;
+	}
+	free(line);
+	fclose(file);
+
+	return result;
+}
+
+
+/**
+ * Write the snapshot into temporary file and rename it over the snapshot
+ * @param name			filename of the snapshot
+ * @param map			processed files
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int save_snapshot(const char *name, const path_map_t *map) {
+	size_t len = strlen(name) + sizeof(".tmp");
+	char *tmp_name = malloc(len);
+	FILE *file;
+	size_t i;
+	int result = 0;
+
+	if(tmp_name == NULL) {
+		return 1;
+	}
+	snprintf(tmp_name, len, "%s.tmp", name);
+	file = fopen(tmp_name, "w");
+	if(file == NULL) {
+		fprintf(stderr, "Error while opening snapshot %s to write!\n", tmp_name);
+		free(tmp_name);
+		return 1;
+	}
+	for(i = 0; i < map->capacity; i++) {
+		if(map->entries[i].path) {
+			fprintf(file, "%llu\t%lld\t%lld\t%s\n", (unsigned long long) map->entries[i].size,
+					(long long) map->entries[i].mtime_sec, (long long) map->entries[i].mtime_nsec, map->entries[i].path);
+		}
+	}
+	if(ferror(file) | fflush(file) | fsync(fileno(file))) {
+		result = 1;
+	}
+	if(fclose(file) != 0 || result != 0 || rename(tmp_name, name) != 0) {
+		fprintf(stderr, "Error while writing snapshot %s!\n", name);
+		unlink(tmp_name);
+		result = 1;
+	}
+	free(tmp_name);
+
+	return result;
+}
+
+
+/**
+ * Add the path into the pending paths
+ * @param watch			state of the watch mode
+ * @param path			path of the file
+ * @param state			PENDING_CHANGED or PENDING_DELETED
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int add_pending(watch_t *watch, const char *path, uint8_t state) {
+	path_entry_t *entry = insert_path(&watch->pending, path);
+
+	if(entry == NULL) {
+		fprintf(stderr, "Error while allocating memory for pending path!\n");
+		return 1;
+	}
+	/* Last event of the path wins */
+	entry->state = state;
+
+	return 0;
+}
+
+
+/**
+ * Add inotify watch of the directory
+ * @param watch			state of the watch mode
+ * @param dir			path of the directory
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int add_watch(watch_t *watch, const char *dir) {
+	char **tmp;
+	size_t len;
+	int wd;
+
+	wd = inotify_add_watch(watch->inotify_fd, dir, WATCH_EVENTS | IN_ONLYDIR);
+	if(wd < 0) {
+		fprintf(stderr, "Error while watching directory %s!\n", dir);
+		return 1;
+	}
+	if((size_t) wd >= watch->dirs_len) {
+		len = watch->dirs_len ? watch->dirs_len : 64;
+		while(len <= (size_t) wd) {
+			len *= 2;
+		}
+		tmp = realloc(watch->dirs, len * sizeof(char *));
+		if(tmp == NULL) {
+			return 1;
+		}
+		memset(tmp + watch->dirs_len, 0, (len - watch->dirs_len) * sizeof(char *));
+		watch->dirs = tmp;
+		watch->dirs_len = len;
+	}
+
+	/* Directory moved within the tree keeps its watch descriptor */
+	free(watch->dirs[wd]);
+	watch->dirs[wd] = strdup(dir);
+
+	return watch->dirs[wd] == NULL;
+}
+
+
+/**
+ * Callback of nftw() watching directories and comparing files with the snapshot
+ * @param path			path of the file
+ * @param st			attributes of the file
+ * @param type			type of the file
+ * @param ftw			position in the tree
+ * @return				0 to continue, 1 to stop the walk
+ */
+static int scan_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+	path_entry_t *entry;
+
+	(void) ftw;
+	if(type == FTW_D) {
+		add_watch(scan_watch, path);
+		return 0;
+	}
+	if(type != FTW_F || !S_ISREG(st->st_mode) || !is_audio_file(path)) {
+		return 0;
+	}
+
+	entry = find_path(&scan_watch->snapshot, path);
+	if(entry) {
+		entry->generation = scan_watch->generation;
+		if(entry->size == (uint64_t) st->st_size && entry->mtime_sec == st->st_mtim.tv_sec
+				&& entry->mtime_nsec == st->st_mtim.tv_nsec) {
+			return 0;
+		}
+	}
+	return add_pending(scan_watch, path, PENDING_CHANGED);
+}
+
+
+/**
+ * Walk the tree, watch its directories and find files changed since the snapshot
+ * @param watch			state of the watch mode
+ * @param dir			root of the walked tree
+ * @param full			1 if dir is the root of the library, files missing in the tree are deleted
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int scan_tree(watch_t *watch, const char *dir, int full) {
+	size_t i;
+
+	scan_watch = watch;
+	watch->generation++;
+	if(nftw(dir, scan_entry, NFTW_FD_LIMIT, FTW_PHYS) != 0) {
+		fprintf(stderr, "Error while scanning directory %s!\n", dir);
+		return 1;
+	}
+	if(full) {
+		for(i = 0; i < watch->snapshot.capacity; i++) {
+			if(watch->snapshot.entries[i].path && watch->snapshot.entries[i].generation != watch->generation
+					&& add_pending(watch, watch->snapshot.entries[i].path, PENDING_DELETED) != 0) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Mark all files of the directory removed from the tree as deleted and stop watching it
+ * @param watch			state of the watch mode
+ * @param dir			path of the directory
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int remove_tree(watch_t *watch, const char *dir) {
+	size_t len = strlen(dir);
+	size_t i;
+
+	for(i = 0; i < watch->snapshot.capacity; i++) {
+		if(watch->snapshot.entries[i].path && strncmp(watch->snapshot.entries[i].path, dir, len) == 0
+				&& watch->snapshot.entries[i].path[len] == '/'
+				&& add_pending(watch, watch->snapshot.entries[i].path, PENDING_DELETED) != 0) {
+			return 1;
+		}
+	}
+	/* Watch of a directory moved out of the tree would report events with wrong paths */
+	for(i = 0; i < watch->dirs_len; i++) {
+		if(watch->dirs[i] && strncmp(watch->dirs[i], dir, len) == 0
+				&& (watch->dirs[i][len] == '/' || watch->dirs[i][len] == '\0')) {
+			inotify_rm_watch(watch->inotify_fd, i);
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Read available inotify events and add their paths into the pending paths
+ * @param watch			state of the watch mode
+ * @param root			root directory of the library
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int read_events(watch_t *watch, const char *root) {
+	char buffer[EVENT_BUFFER_LEN] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	char *path;
+	size_t path_len;
+	ssize_t len;
+	char *p;
+	int result = 0;
+
+	len = read(watch->inotify_fd, buffer, sizeof(buffer));
+	if(len <= 0) {
+		return len < 0 && errno != EAGAIN && errno != EINTR;
+	}
+
+	for(p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + event->len) {
+		event = (const struct inotify_event *) p;
+
+		if(event->mask & IN_Q_OVERFLOW) {
+			/* Events were lost, compare the whole tree with the snapshot */
+			fprintf(stderr, "Event queue overflowed, library is scanned again\n");
+			result |= scan_tree(watch, root, 1);
+			continue;
+		}
+		if(event->wd < 0 || (size_t) event->wd >= watch->dirs_len || watch->dirs[event->wd] == NULL) {
+			continue;
+		}
+		if(event->mask & IN_IGNORED) {
+			free(watch->dirs[event->wd]);
+			watch->dirs[event->wd] = NULL;
+			continue;
+		}
+		if(event->len == 0) {
+			continue;
+		}
+
+		path_len = strlen(watch->dirs[event->wd]) + strlen(event->name) + 2;
+		path = malloc(path_len);
+		if(path == NULL) {
+			return 1;
+		}
+		snprintf(path, path_len, "%s/%s", watch->dirs[event->wd], event->name);
+
+		if(event->mask & IN_ISDIR) {
+			if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+				/* Files could be created before the directory was watched */
+				result |= scan_tree(watch, path, 0);
+			}
+			else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+				result |= remove_tree(watch, path);
+			}
+		}
+		else if(is_audio_file(path)) {
+			if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+				result |= add_pending(watch, path, PENDING_DELETED);
+			}
+			else if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB)) {
+				result |= add_pending(watch, path, PENDING_CHANGED);
+			}
+		}
+		free(path);
+	}
+
+	return result;
+}
+
+
+/**
+ * Read and parse ID3 tag of the file
+ * @param watch			state of the watch mode
+ * @param path			path of the file
+ * @param tag			pointer to the ID3 tag structure to fill in
+ * @param p_tag_offset	pointer to the offset of the tag in the file
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int parse_file(watch_t *watch, const char *path, id3v2_tag_t *tag, uint64_t *p_tag_offset) {
+	id3v2_parse_context_t context = {NULL, get_id3v2_verbosity(), NULL};
+	uint32_t len;
+	int match;
+	int fd;
+	int result;
+
+	/* Tag stays empty if the file cannot be read */
+	init_id3v2_tag(tag);
+	*p_tag_offset = 0;
+	fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		fprintf(stderr, "Error while opening file %s!\n", path);
+		return 1;
+	}
+	find_id3v2_tag(fd, p_tag_offset);
+	result = read_tag_at(fd, *p_tag_offset, &watch->buffer, &watch->capacity, &len);
+	close(fd);
+	if(result != 0) {
+		fprintf(stderr, "Error while reading MP3 file %s has appeared!\n", path);
+		return 1;
+	}
+
+	context.path = path;
+	if(parse_buffer_context(tag, watch->buffer, len, NULL, &context, &match) != 0) {
+		fprintf(stderr, "Error while parsing input buffer occurred!\n");
+		deallocate_memory(tag, NULL);
+		return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Rewrite the columnar index, rows of unchanged files are copied from the previous index
+ * @param watch			state of the watch mode
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int update_index(watch_t *watch) {
+	id3v2_column_index_t index;
+	const id3v2_column_entry_t *columns[TEXTINFO_COUNT];
+	const char *ids[TEXTINFO_COUNT + 1];
+	const char *texts[TEXTINFO_COUNT];
+	id3v2_column_builder_t *builder;
+	path_entry_t *entry;
+	id3v2_tag_t tag;
+	uint64_t tag_offset;
+	const char *path;
+	char *tmp_name;
+	size_t len;
+	uint64_t row;
+	uint32_t i;
+	int has_index;
+	int result = 0;
+
+	for(i = 0; i < TEXTINFO_COUNT; i++) {
+		ids[i] = get_id3v2_text_id(i);
+	}
+	ids[i] = NULL;
+	builder = create_column_builder(ids);
+	len = strlen(watch->index_name) + sizeof(".tmp");
+	tmp_name = malloc(len);
+	if(builder == NULL || tmp_name == NULL) {
+		fprintf(stderr, "Error while allocating memory for index!\n");
+		free_column_builder(builder);
+		free(tmp_name);
+		return 1;
+	}
+	snprintf(tmp_name, len, "%s.tmp", watch->index_name);
+
+	/* First batch creates the index */
+	has_index = access(watch->index_name, F_OK) == 0 && open_column_index(watch->index_name, &index) == 0;
+	if(has_index) {
+		for(i = 0; i < TEXTINFO_COUNT; i++) {
+			columns[i] = find_column(&index, ids[i]);
+		}
+		for(row = 0; row < index.header->rows && result == 0; row++) {
+			/* Rows of files missing in the snapshot are stale */
+			path = get_column_path(&index, row);
+			entry = find_path(&watch->pending, path);
+			if((entry && entry->state != PENDING_UNCHANGED) || find_path(&watch->snapshot, path) == NULL) {
+				continue;
+			}
+			for(i = 0; i < TEXTINFO_COUNT; i++) {
+				texts[i] = columns[i] ? get_column_value(&index, columns[i], get_column_codes(&index, columns[i])[row]) : NULL;
+			}
+			result = add_column_row(builder, path, get_column_size(&index, row), get_column_tag_offset(&index, row), texts);
+		}
+	}
+
+	for(i = 0; i < watch->pending.capacity && result == 0; i++) {
+		entry = &watch->pending.entries[i];
+		if(entry->path && entry->state == PENDING_CHANGED) {
+			/* File without (valid) tag is still a row of the library */
+			parse_file(watch, entry->path, &tag, &tag_offset);
+			result = add_column_row(builder, entry->path, entry->size, tag_offset, (const char * const *) tag.text);
+			deallocate_memory(&tag, NULL);
+		}
+	}
+
+	if(result != 0) {
+		free_column_builder(builder);
+	}
+	else if(write_column_index(builder, tmp_name) != 0 || rename(tmp_name, watch->index_name) != 0) {
+		fprintf(stderr, "Error while writing index %s!\n", watch->index_name);
+		unlink(tmp_name);
+		result = 1;
+	}
+	if(has_index) {
+		close_column_index(&index);
+	}
+	free(tmp_name);
+
+	return result;
+}
+
+
+/**
+ * Process the pending paths and save the snapshot
+ * @param watch			state of the watch mode
+ * @param snapshot_name	filename of the snapshot
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int process_pending(watch_t *watch, const char *snapshot_name) {
+	path_entry_t *entry;
+	path_entry_t *processed;
+	id3v2_tag_t tag;
+	uint64_t tag_offset;
+	struct stat st;
+	size_t changed = 0;
+	size_t deleted = 0;
+	size_t i;
+	int result = 0;
+
+	/* Resolve final state of every path, events may be stale */
+	for(i = 0; i < watch->pending.capacity; i++) {
+		entry = &watch->pending.entries[i];
+		if(entry->path == NULL) {
+			continue;
+		}
+		processed = find_path(&watch->snapshot, entry->path);
+		if(stat(entry->path, &st) != 0 || !S_ISREG(st.st_mode)) {
+			entry->state = processed ? PENDING_DELETED : PENDING_UNCHANGED;
+			continue;
+		}
+		entry->size = st.st_size;
+		entry->mtime_sec = st.st_mtim.tv_sec;
+		entry->mtime_nsec = st.st_mtim.tv_nsec;
+		if(processed && processed->size == entry->size && processed->mtime_sec == entry->mtime_sec
+				&& processed->mtime_nsec == entry->mtime_nsec) {
+			entry->state = PENDING_UNCHANGED;
+		}
+		else {
+			entry->state = PENDING_CHANGED;
+		}
+	}
+
+	if(watch->index_name) {
+		result = update_index(watch);
+	}
+
+	for(i = 0; i < watch->pending.capacity && result == 0; i++) {
+		entry = &watch->pending.entries[i];
+		if(entry->path == NULL || entry->state == PENDING_UNCHANGED) {
+			continue;
+		}
+		if(entry->state == PENDING_DELETED) {
+			if(watch->index_name == NULL) {
+				remove_parsed_data(entry->path);
+			}
+			remove_path(&watch->snapshot, find_path(&watch->snapshot, entry->path));
+			deleted++;
+			continue;
+		}
+
+		if(watch->index_name == NULL) {
+			/* Pictures of the previous version of the tag may be gone */
+			remove_parsed_data(entry->path);
+			if(parse_file(watch, entry->path, &tag, &tag_offset) == 0) {
+				if(write_parsed_data(&tag, entry->path) != 0) {
+					fprintf(stderr, "Error while writing parsed data into file(s) occurred!\n");
+				}
+				deallocate_memory(&tag, NULL);
+			}
+		}
+
+		/* File which cannot be parsed is not parsed again until it changes */
+		processed = insert_path(&watch->snapshot, entry->path);
+		if(processed == NULL) {
+			result = 1;
+			break;
+		}
+		processed->size = entry->size;
+		processed->mtime_sec = entry->mtime_sec;
+		processed->mtime_nsec = entry->mtime_nsec;
+		processed->generation = watch->generation;
+		changed++;
+	}
+	clear_path_map(&watch->pending);
+
+	if(changed || deleted) {
+		result |= save_snapshot(snapshot_name, &watch->snapshot);
+		fprintf(stderr, "%lu files parsed, %lu files removed\n", (unsigned long) changed, (unsigned long) deleted);
+	}
+
+	return result;
+}
+
+
+/**
+ * Get current monotonic time
+ * @return				time in milliseconds
+ */
+static int64_t get_time_ms(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+int run_id3v2_watch(const char *dir, const char *snapshot_name, const char *index_name) {
+	watch_t watch;
+	struct sigaction action;
+	struct pollfd poll_fd;
+	id3v2_column_index_t index;
+	char *root;
+	char *default_snapshot = NULL;
+	size_t len;
+	int64_t first_event = 0;
+	int64_t last_event = 0;
+	int64_t now;
+	int timeout;
+	int count;
+	int result = 1;
+
+	memset(&watch, 0, sizeof(watch));
+	watch.index_name = index_name;
+	watch.inotify_fd = -1;
+
+	/* Paths are built from the root, trailing slashes would double */
+	root = strdup(dir);
+	if(root == NULL) {
+		return 1;
+	}
+	for(len = strlen(root); len > 1 && root[len - 1] == '/'; len--) {
+		root[len - 1] = '\0';
+	}
+	if(snapshot_name == NULL) {
+		len = strlen(root) + strlen(DEFAULT_SNAPSHOT_NAME) + 2;
+		default_snapshot = malloc(len);
+		if(default_snapshot == NULL) {
+			goto end;
+		}
+		snprintf(default_snapshot, len, "%s/%s", root, DEFAULT_SNAPSHOT_NAME);
+		snapshot_name = default_snapshot;
+	}
+
+	watch.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(watch.inotify_fd < 0) {
+		fprintf(stderr, "Error while initializing inotify!\n");
+		goto end;
+	}
+	if(load_snapshot(snapshot_name, &watch.snapshot) != 0) {
+		fprintf(stderr, "Error while reading snapshot %s!\n", snapshot_name);
+		goto end;
+	}
+	if(index_name) {
+		/* Rows of unchanged files are copied from the index, without it all files are parsed */
+		if(access(index_name, F_OK) == 0 && open_column_index(index_name, &index) == 0) {
+			close_column_index(&index);
+		}
+		else {
+			clear_path_map(&watch.snapshot);
+		}
+	}
+
+	/* Watches are added before the scan, so no change is missed between them */
+	if(scan_tree(&watch, root, 1) != 0 || process_pending(&watch, snapshot_name) != 0) {
+		goto end;
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_stop_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	fprintf(stderr, "Watching %s, %lu files in snapshot %s\n", root, (unsigned long) watch.snapshot.len, snapshot_name);
+	poll_fd.fd = watch.inotify_fd;
+	poll_fd.events = POLLIN;
+	result = 0;
+	while(!stop_requested && result == 0) {
+		timeout = -1;
+		if(watch.pending.len > 0) {
+			now = get_time_ms();
+			timeout = last_event + WATCH_QUIET_MS - now;
+			if(first_event + WATCH_MAX_DELAY_MS - now < timeout) {
+				timeout = first_event + WATCH_MAX_DELAY_MS - now;
+			}
+			if(timeout <= 0) {
+				result = process_pending(&watch, snapshot_name);
+				continue;
+			}
+		}
+
+		count = poll(&poll_fd, 1, timeout);
+		if(count < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "Error while waiting for events!\n");
+			result = 1;
+		}
+		else if(count > 0) {
+			if(watch.pending.len == 0) {
+				first_event = get_time_ms();
+			}
+			result = read_events(&watch, root);
+			last_event = get_time_ms();
+		}
+	}
+
+	/* Events received before the stop are not lost */
+	if(watch.pending.len > 0) {
+		result |= process_pending(&watch, snapshot_name);
+	}
+
+end:
+	if(watch.inotify_fd >= 0) {
+		close(watch.inotify_fd);
+	}
+	for(len = 0; len < watch.dirs_len; len++) {
+		free(watch.dirs[len]);
+	}
+	free(watch.dirs);
+	clear_path_map(&watch.snapshot);
+	clear_path_map(&watch.pending);
+	free(watch.snapshot.entries);
+	free(watch.pending.entries);
+	free_id3v2_memory(watch.buffer);
+	free(default_snapshot);
+	free(root);
+
+	return result;
+}
@@ -0,0 +1,76 @@
+/*
+ * id3v2watch - incremental processing of watched library
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ID3V2WATCH_H_
+#define ID3V2WATCH_H_
+
+/** Watch mode
+
+   All directories of the library tree are watched by inotify. Events of
+   audio files (filtered by extension) are coalesced in a set of pending
+   paths, where the last event of the path wins, and the set is processed
+   when no event came for WATCH_QUIET_MS or the oldest pending event is
+   WATCH_MAX_DELAY_MS old. Only added and modified files are parsed
+   again, outputs of deleted files are removed.
+
+   Size and modification time of every processed file are kept in the
+   snapshot file, one line per file:
+
+     <size><TAB><mtime seconds><TAB><mtime nanoseconds><TAB><path>
+
+   At startup (and when the event queue overflows) the tree is walked and
+   compared with the snapshot, so changes made while the program was not
+   running are processed without parsing unchanged files.
+
+   Outputs are either the files written by write_parsed_data(), or rows
+   of the columnar index when the index is given. The index is rewritten
+   after every batch, rows of unchanged files are copied from the
+   previous index.
+ */
+
+/** Default filename of the snapshot, created in the watched directory */
+#define DEFAULT_SNAPSHOT_NAME ".id3v2parser.snapshot"
+/** Pending events are processed after this many milliseconds without event */
+#define WATCH_QUIET_MS 500
+/** Pending events are processed at latest after this many milliseconds */
+#define WATCH_MAX_DELAY_MS 5000
+
+
+/**
+ * Watch the library tree and process changed files until SIGINT or SIGTERM is received
+ * @param dir			root directory of the library
+ * @param snapshot_name	filename of the snapshot, NULL for DEFAULT_SNAPSHOT_NAME in dir
+ * @param index_name	filename of the columnar index to maintain, NULL to write parsed data files
+ * @return				0 if OK, 1 if problem has occurred
+ */
+int run_id3v2_watch(const char *dir, const char *snapshot_name, const char *index_name);
+
+
+#endif /* ID3V2WATCH_H_ */
@@ -0,0 +1,494 @@
+/*
+ *  id3v2writer - editing of ID3v2.4 tags
+ *
+ * 	Updates or adds text information frames of the ID3v2.4 tag. Frames which
+ * 	are not edited are copied from the original tag unchanged. The tag is
+ * 	written in place when it fits into the original tag (padding included),
+ * 	otherwise the file is rewritten with new padding.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "id3v2parser.h"
+#include "id3v2writer.h"
+
+/** Size of the chunk used to copy audio data when the file is rewritten */
+#define COPY_CHUNK_LEN 65536
+
+
+/** Frame kept from the original tag */
+typedef struct id3v2_kept_frame_s {
+	unsigned char *data;	/**< frame including its header */
+	uint32_t len;			/**< length of the frame including its header */
+} id3v2_kept_frame_t;
+
+
+int parse_id3v2_edit(const char *arg, id3v2_edit_t *edit) {
+	const char *eq;
+	uint8_t i;
+
+	eq = strchr(arg, '=');
+	if(eq == NULL || eq - arg != 4) {
+		fprintf(stderr, "Edit '%s' has to be in form ID=TEXT (e.g. TIT2=Title)\n", arg);
+		return 1;
+	}
+
+	for(i = 0; i < 4; i++) {
+		if(!((arg[i] >= 'A' && arg[i] <= 'Z') || (arg[i] >= '0' && arg[i] <= '9'))) {
+			fprintf(stderr, "Frame ID in edit '%s' is not valid\n", arg);
+			return 1;
+		}
+	}
+
+	/* Only plain text information frames can be edited */
+	if(arg[0] != 'T' || strncmp(arg, "TXXX", 4) == 0) {
+		fprintf(stderr, "Frame %.4s is not a text information frame, it cannot be edited\n", arg);
+		return 1;
+	}
+
+	memcpy(edit->id, arg, 4);
+	edit->id[4] = '\0';
+	edit->text = eq + 1;
+
+	return 0;
+}
+
+
+/**
+ * Store 28 bit value as 32 bit synchsafe integer
+ * @param buffer		output buffer of at least 4 bytes
+ * @param value			value to store
+ */
+static void write_synchsafe(unsigned char *buffer, uint32_t value) {
+	buffer[0] = (value >> 21) & 0x7F;
+	buffer[1] = (value >> 14) & 0x7F;
+	buffer[2] = (value >> 7) & 0x7F;
+	buffer[3] = value & 0x7F;
+}
+
+
+void write_id3v2_header(unsigned char *buffer, uint8_t flags, uint32_t size) {
+	memcpy(buffer, "ID3", 3);
+	buffer[3] = 4;			/* major version */
+	buffer[4] = 0;			/* revision number */
+	buffer[5] = flags;
+	write_synchsafe(buffer + 6, size);
+}
+
+
+void write_id3v2_frame_header(unsigned char *buffer, const char *id, uint16_t flags, uint32_t size) {
+	memcpy(buffer, id, 4);
+	write_synchsafe(buffer + 4, size);
+	buffer[8] = (flags >> 8) & 0xFF;
+	buffer[9] = flags & 0xFF;
+}
+
+
+/**
+ * Check whether the frame is replaced by one of the edits
+ * @param id			four-char frame ID code
+ * @param edits			array of edits
+ * @param edits_len		number of edits
+ * @return				1 if edited, 0 otherwise
+ */
+static int is_edited(const unsigned char *id, const id3v2_edit_t *edits, size_t edits_len) {
+	size_t i;
+
+	for(i = 0; i < edits_len; i++) {
+		if(memcmp(id, edits[i].id, 4) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Check whether the frame is known to the parser, i.e. it is a text information frame,
+ * unsynchronised lyrics or attached picture
+ * @param id			four-char frame ID code
+ * @return				1 if known, 0 otherwise
+ */
+static int is_known_frame(const unsigned char *id) {
+	const char *text_id;
+	uint32_t i;
+
+	if(memcmp(id, "USLT", 4) == 0 || memcmp(id, "APIC", 4) == 0) {
+		return 1;
+	}
+	for(i = 0; (text_id = get_id3v2_text_id(i)) != NULL; i++) {
+		if(memcmp(id, text_id, 4) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Check whether the edit produces a frame in the new tag. Empty text removes
+ * the frame and when the same frame is edited more times, the last edit wins.
+ * @param edits			array of edits
+ * @param edits_len		number of edits
+ * @param index			index of the edit to check
+ * @return				1 if the frame is written, 0 otherwise
+ */
+static int is_applied(const id3v2_edit_t *edits, size_t edits_len, size_t index) {
+	if(edits[index].text[0] == '\0') {
+		return 0;
+	}
+	return !is_edited((const unsigned char *) edits[index].id, edits + index + 1, edits_len - index - 1);
+}
+
+
+/**
+ * Collect frames of the original tag body which survive the edit
+ * @param body			ID3 tag body (after the tag header)
+ * @param header		ID3 tag header structure
+ * @param edits			array of edits
+ * @param edits_len		number of edits
+ * @param frames		output array, large enough for every frame of the body
+ * @param p_count		pointer to the number of collected frames
+ * @return				0 if OK, 1 if the tag is corrupted
+ */
+static int collect_kept_frames(unsigned char *body, id3v2_header_t header, const id3v2_edit_t *edits,
+		size_t edits_len, id3v2_kept_frame_t *frames, size_t *p_count) {
+	unsigned char *p_buff = body;
+	unsigned char *end = body + header.size;
+	unsigned char *frame_start;
+	id3v2_frame_header_t frame_header;
+	uint32_t ext_size;
+
+	*p_count = 0;
+
+	/* Extended header is dropped, its CRC and restrictions describe the original frames */
+	if(header.flags & FLAG_ID3_EXTEND) {
+		if(header.size < 6) {
+			return 1;
+		}
+		ext_size = ((p_buff[0] & 0x7F) << 21) | ((p_buff[1] & 0x7F) << 14) | ((p_buff[2] & 0x7F) << 7) | (p_buff[3] & 0x7F);
+		if(ext_size > header.size) {
+			return 1;
+		}
+		p_buff += ext_size;
+	}
+
+	while(end - p_buff >= HEADER_LEN) {
+		frame_start = p_buff;
+		if(parse_id3v2_frame_header(&p_buff, &frame_header) == 1) {
+			/* Padding reached */
+			break;
+		}
+		if(frame_header.size > (uint32_t) (end - p_buff)) {
+			fprintf(stderr, "Frame %s exceeds the ID3 tag\n", frame_header.id);
+			return 1;
+		}
+		p_buff += frame_header.size;
+
+		/* Tag alter preservation applies only to frames unknown to the parser */
+		if(is_edited(frame_header.id, edits, edits_len) || ((frame_header.flags & FLAG_FR_TAG) && !is_known_frame(frame_header.id))) {
+			continue;
+		}
+		/* Unsynchronisation of the whole tag is kept by the flag of each frame */
+		if(header.flags & FLAG_ID3_UNSYNC) {
+			frame_start[9] |= FLAG_FR_UNSYNC;
+		}
+		frames[*p_count].data = frame_start;
+		frames[*p_count].len = HEADER_LEN + frame_header.size;
+		(*p_count)++;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Write the whole buffer at the given offset
+ * @param fd			file descriptor
+ * @param buffer		data to write
+ * @param len			length of the data
+ * @param offset		offset in the file
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int pwrite_all(int fd, const unsigned char *buffer, size_t len, off_t offset) {
+	ssize_t written;
+
+	while(len > 0) {
+		written = pwrite(fd, buffer, len, offset);
+		if(written <= 0) {
+			return 1;
+		}
+		buffer += written;
+		len -= written;
+		offset += written;
+	}
+	return 0;
+}
+
+
+/**
+ * Rewrite the file with a new tag, followed by the audio data of the original file
+ * @param name			filename
+ * @param fd			file descriptor of the original file
+ * @param tag			serialised tag including padding
+ * @param tag_len		length of the serialised tag
+ * @param audio_offset	offset of the data following the original tag
+ * @param file_len		length of the original file
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int rewrite_file(char *name, int fd, const unsigned char *tag, size_t tag_len, off_t audio_offset, off_t file_len) {
+	char *tmp_name;
+	size_t len;
+	int tmp_fd;
+	unsigned char *chunk;
+	ssize_t read_len;
+	off_t offset;
+	struct stat st;
+
+	len = strlen(name) + strlen(".XXXXXX") + 1;
+	tmp_name = malloc(len);
+	chunk = malloc(COPY_CHUNK_LEN);
+	if(tmp_name == NULL || chunk == NULL) {
+		fprintf(stderr, "Error while allocating memory for rewriting!\n");
+		free(tmp_name);
+		free(chunk);
+		return 1;
+	}
+	snprintf(tmp_name, len, "%s.XXXXXX", name);
+
+	/* Temporary file is created next to the original one, so it can be renamed over it */
+	tmp_fd = mkstemp(tmp_name);
+	if(tmp_fd < 0) {
+		fprintf(stderr, "Error while creating temporary file %s!\n", tmp_name);
+		free(tmp_name);
+		free(chunk);
+		return 1;
+	}
+	if(fstat(fd, &st) == 0) {
+		fchmod(tmp_fd, st.st_mode & 07777);
+	}
+
+	if(pwrite_all(tmp_fd, tag, tag_len, 0) != 0) {
+		goto error;
+	}
+
+	for(offset = audio_offset; offset < file_len; offset += read_len) {
+		read_len = pread(fd, chunk, COPY_CHUNK_LEN, offset);
+		if(read_len <= 0) {
+			goto error;
+		}
+		if(pwrite_all(tmp_fd, chunk, read_len, tag_len + (offset - audio_offset)) != 0) {
+			goto error;
+		}
+	}
+
+	if(fsync(tmp_fd) != 0 || close(tmp_fd) != 0) {
+		tmp_fd = -1;
+		goto error;
+	}
+	tmp_fd = -1;
+
+	if(rename(tmp_name, name) != 0) {
+		goto error;
+	}
+
+	free(tmp_name);
+	free(chunk);
+	return 0;
+
+error:
+	fprintf(stderr, "Error while rewriting file %s!\n", name);
+	if(tmp_fd >= 0) {
+		close(tmp_fd);
+	}
+	unlink(tmp_name);
+	free(tmp_name);
+	free(chunk);
+	return 1;
+}
+
+
+int edit_id3v2_tag(char *name, const id3v2_edit_t *edits, size_t edits_len, uint32_t padding) {
+	int fd;
+	int result = EDIT_FAILED;
+	struct stat st;
+	unsigned char header_buff[HEADER_LEN];
+	unsigned char *p_buff;
+	id3v2_header_t header;
+	unsigned char *body = NULL;
+	id3v2_kept_frame_t *frames = NULL;
+	size_t frames_count = 0;
+	unsigned char *tag = NULL;
+	uint64_t frames_len;
+	uint32_t tag_size;
+	off_t old_tag_len = 0;
+	uint64_t tag_offset;
+	uint8_t flags;
+	size_t i;
+	size_t pos;
+
+	fd = open(name, O_RDWR);
+	if(fd < 0) {
+		fprintf(stderr, "Error while opening file %s!\n", name);
+		return EDIT_FAILED;
+	}
+	if(fstat(fd, &st) != 0) {
+		fprintf(stderr, "Error while reading attributes of file %s!\n", name);
+		close(fd);
+		return EDIT_FAILED;
+	}
+
+	/* Tag is written only at the beginning of the file, container or junk preceding it would be broken */
+	if(find_id3v2_tag(fd, &tag_offset) == 0 && tag_offset != 0) {
+		fprintf(stderr, "ID3 tag of file %s is not at its beginning (WAV or AIFF chunk or junk before it), it cannot be edited\n", name);
+		goto end;
+	}
+	if(st.st_size >= 4 && pread(fd, header_buff, 4, 0) == 4
+			&& (memcmp(header_buff, "RIFF", 4) == 0 || memcmp(header_buff, "FORM", 4) == 0)) {
+		fprintf(stderr, "File %s is WAV or AIFF file, ID3 tag cannot be added to it\n", name);
+		goto end;
+	}
+
+	/* Read the original tag, if there is any */
+	memset(&header, 0, sizeof(header));
+	if(st.st_size >= HEADER_LEN && pread(fd, header_buff, HEADER_LEN, 0) == HEADER_LEN
+			&& memcmp(header_buff, "ID3", 3) == 0) {
+		p_buff = header_buff;
+		parse_id3v2_header(&p_buff, &header);
+		if(header.major_version != 4) {
+			fprintf(stderr, "Cannot edit ID3v2.%u tag. Only editing of ID3v2.4 is implemented!\n", header.major_version);
+			goto end;
+		}
+		old_tag_len = HEADER_LEN + header.size + ((header.flags & FLAG_ID3_FOOTER) ? HEADER_LEN : 0);
+		if(old_tag_len > st.st_size) {
+			fprintf(stderr, "Error - file is too small to include ID3 tag (probably corrupted), as derived from ID3 header\n");
+			goto end;
+		}
+
+		body = malloc(header.size ? header.size : 1);
+		/* Every frame takes at least HEADER_LEN bytes */
+		frames = malloc((header.size / HEADER_LEN + 1) * sizeof(id3v2_kept_frame_t));
+		if(body == NULL || frames == NULL) {
+			fprintf(stderr, "Error while allocating memory for ID3 tag!\n");
+			goto end;
+		}
+		if(pread(fd, body, header.size, HEADER_LEN) != (ssize_t) header.size) {
+			fprintf(stderr, "Error while reading ID3 tag of file %s!\n", name);
+			goto end;
+		}
+		if(collect_kept_frames(body, header, edits, edits_len, frames, &frames_count) != 0) {
+			fprintf(stderr, "Error - ID3 tag of file %s is corrupted, it cannot be edited\n", name);
+			goto end;
+		}
+	}
+
+	/* Compute the size of the new frames, the tag is unsynchronised only if all of its frames are */
+	frames_len = 0;
+	flags = frames_count > 0 ? FLAG_ID3_UNSYNC : 0;
+	for(i = 0; i < frames_count; i++) {
+		frames_len += frames[i].len;
+		if(!(frames[i].data[9] & FLAG_FR_UNSYNC)) {
+			flags = 0;
+		}
+	}
+	for(i = 0; i < edits_len; i++) {
+		if(is_applied(edits, edits_len, i)) {
+			frames_len += HEADER_LEN + 1 + strlen(edits[i].text);
+			/* Edited frames are written without unsynchronisation */
+			flags = 0;
+		}
+	}
+
+	/* Reuse the original tag if the new frames fit into it (footer cannot be followed by padding) */
+	if(old_tag_len > 0 && !(header.flags & FLAG_ID3_FOOTER) && frames_len <= header.size) {
+		tag_size = header.size;
+		result = EDIT_IN_PLACE;
+	}
+	else {
+		if(frames_len + padding > MAX_TAG_SIZE) {
+			fprintf(stderr, "Error - edited ID3 tag would exceed the maximal tag size\n");
+			goto end;
+		}
+		tag_size = frames_len + padding;
+		result = EDIT_REWRITTEN;
+	}
+
+	/* Serialise the new tag, padding is zeroed by calloc */
+	tag = calloc(HEADER_LEN + tag_size, 1);
+	if(tag == NULL) {
+		fprintf(stderr, "Error while allocating memory for ID3 tag!\n");
+		result = EDIT_FAILED;
+		goto end;
+	}
+	write_id3v2_header(tag, flags, tag_size);
+	pos = HEADER_LEN;
+	for(i = 0; i < frames_count; i++) {
+		memcpy(tag + pos, frames[i].data, frames[i].len);
+		pos += frames[i].len;
+	}
+	for(i = 0; i < edits_len; i++) {
+		size_t len = strlen(edits[i].text);
+
+		if(!is_applied(edits, edits_len, i)) {
+			continue;
+		}
+		write_id3v2_frame_header(tag + pos, edits[i].id, 0, len + 1);
+		pos += HEADER_LEN;
+		tag[pos++] = ENC_UTF_8;
+		memcpy(tag + pos, edits[i].text, len);
+		pos += len;
+	}
+
+	if(result == EDIT_IN_PLACE) {
+		/* Only the tag region is overwritten, audio data stays untouched */
+		if(pwrite_all(fd, tag, HEADER_LEN + tag_size, 0) != 0) {
+			fprintf(stderr, "Error while writing ID3 tag into file %s!\n", name);
+			result = EDIT_FAILED;
+		}
+	}
+	else if(rewrite_file(name, fd, tag, HEADER_LEN + tag_size, old_tag_len, st.st_size) != 0) {
+		result = EDIT_FAILED;
+	}
+
+end:
+	close(fd);
+	free(tag);
+	free(frames);
+	free(body);
+
+	return result;
+}
@@ -0,0 +1,113 @@
+/*
+ * id3v2writer - editing of ID3v2.4 tags
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef ID3V2WRITER_H_
+#define ID3V2WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Editing strategy
+
+   A modified tag is serialised from the frames of the original tag
+   (kept byte for byte, including their flags) followed by the edited
+   text frames. Frames with the 'tag alter preservation' flag set are
+   discarded if they are unknown to the parser, as the specification
+   requires. The extended header is not written to the new tag, its CRC
+   and restrictions describe the frames of the original tag. The tag is
+   flagged as unsynchronised only if all of its frames are.
+   Only a tag at the beginning of the file is edited, files with the tag
+   in a WAV or AIFF chunk or after junk are refused.
+
+   If the new tag fits into the space of the original tag, i.e. into its
+   frames and padding, only the tag region at the beginning of the file
+   is overwritten and the rest of the file is left untouched. Otherwise
+   the whole file is rewritten into a temporary file with the requested
+   amount of padding reserved for future edits, and renamed over the
+   original file.
+ */
+
+/** Padding reserved by default when the file has to be rewritten */
+#define DEFAULT_PADDING 4096
+
+/** Largest tag size which can be stored in the synchsafe size field */
+#define MAX_TAG_SIZE 0x0FFFFFFF
+
+/** Result of the tag edit */
+#define EDIT_IN_PLACE 0
+#define EDIT_REWRITTEN 1
+#define EDIT_FAILED (-1)
+
+
+/** Edit of one text information frame */
+
+typedef struct id3v2_edit_s {
+	char id[5];				/**< text frame ID code */
+	const char *text;		/**< new UTF-8 text, empty text removes the frame */
+} id3v2_edit_t;
+
+
+/**
+ * Parse edit request in form 'ID=TEXT' (e.g. 'TIT2=Title')
+ * @param arg			edit request string
+ * @param edit			pointer to the edit structure to fill in
+ * @return				0 if OK, 1 if the request is malformed
+ */
+int parse_id3v2_edit(const char *arg, id3v2_edit_t *edit);
+
+/**
+ * Apply edits to the ID3 tag of the file, reusing its padding if possible
+ * @param name			filename
+ * @param edits			array of edits
+ * @param edits_len		number of edits
+ * @param padding		padding reserved if the file has to be rewritten
+ * @return				EDIT_IN_PLACE, EDIT_REWRITTEN or EDIT_FAILED
+ */
+int edit_id3v2_tag(char *name, const id3v2_edit_t *edits, size_t edits_len, uint32_t padding);
+
+/**
+ * Serialise ID3v2.4 tag header
+ * @param buffer		output buffer of at least HEADER_LEN bytes
+ * @param flags			ID3 tag header flags
+ * @param size			size of ID3 tag body
+ */
+void write_id3v2_header(unsigned char *buffer, uint8_t flags, uint32_t size);
+
+/**
+ * Serialise ID3 frame header
+ * @param buffer		output buffer of at least HEADER_LEN bytes
+ * @param id			four-char frame ID code
+ * @param flags			ID3 frame header flags
+ * @param size			size of ID3 frame body
+ */
+void write_id3v2_frame_header(unsigned char *buffer, const char *id, uint16_t flags, uint32_t size);
+
+
+#endif /* ID3V2WRITER_H_ */
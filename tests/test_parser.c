@@ -0,0 +1,762 @@
+/*
+ *  test_parser - regression tests of the parser
+ *
+ * 	Parses crafted tags from buffers of their exact length, so reads past
+ * 	the tag are reported by 'make test PROFILE=debug' (address sanitizer).
+ * 	Edited files, indexes and digests are written into temporary files
+ * 	and read back.
+ *
+ *
+ *  Copyright (c) 2014 - Martin Rabek
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimer in the documentation
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be
+ *     used to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "id3v2parser.h"
+#include "id3v2writer.h"
+#include "id3v2column.h"
+#include "id3v2search.h"
+#include "id3v2digest.h"
+
+/** Longest crafted tag */
+#define TEST_TAG_LEN 4096
+/** Template of temporary files */
+#define TEST_TEMP_NAME "/tmp/test_parserXXXXXX"
+
+
+/** Crafted tag */
+typedef struct test_tag_s {
+	unsigned char data[TEST_TAG_LEN];	/**< tag header and frames */
+	uint32_t len;			/**< length of the tag */
+	uint32_t crc_offset;	/**< offset of CRC data of the extended header, 0 if there is none */
+	uint32_t frames_offset;	/**< offset of the frames covered by CRC */
+} test_tag_t;
+
+
+/**
+ * Write synchsafe number
+ * @param p				output of 4 bytes
+ * @param value			number (at most 28 bits)
+ */
+static void put_synchsafe(unsigned char *p, uint32_t value) {
+	p[0] = (value >> 21) & 0x7F;
+	p[1] = (value >> 14) & 0x7F;
+	p[2] = (value >> 7) & 0x7F;
+	p[3] = value & 0x7F;
+}
+
+/**
+ * Start the tag with ID3v2.4 header, its size is set by end_tag()
+ * @param tag			crafted tag
+ */
+static void begin_tag(test_tag_t *tag) {
+	memcpy(tag->data, "ID3\x04\x00\x00", 6);
+	tag->len = HEADER_LEN;
+	tag->crc_offset = 0;
+	tag->frames_offset = HEADER_LEN;
+}
+
+/**
+ * Append extended header right after begin_tag(), CRC is set by end_tag()
+ * @param tag			crafted tag
+ * @param flags			extended flags (FLAG_EXT_CRC and FLAG_EXT_RESTRICT)
+ * @param restrictions	tag restrictions, if FLAG_EXT_RESTRICT is set
+ */
+static void add_extended_header(test_tag_t *tag, uint8_t flags, uint8_t restrictions) {
+	unsigned char *p = tag->data + tag->len;
+	uint32_t pos = 6;
+
+	tag->data[5] |= FLAG_ID3_EXTEND;
+	p[4] = 1;
+	p[5] = flags;
+	if(flags & FLAG_EXT_CRC) {
+		p[pos++] = 5;
+		tag->crc_offset = tag->len + pos;
+		memset(p + pos, 0, 5);
+		pos += 5;
+	}
+	if(flags & FLAG_EXT_RESTRICT) {
+		p[pos++] = 1;
+		p[pos++] = restrictions;
+	}
+	put_synchsafe(p, pos);
+	tag->len += pos;
+	tag->frames_offset = tag->len;
+}
+
+/**
+ * Append frame whose header claims the size, only the body is stored
+ * @param tag			crafted tag
+ * @param id			four-char frame ID code
+ * @param size			size written into the frame header
+ * @param body			frame body
+ * @param len			length of the frame body
+ */
+static void add_frame(test_tag_t *tag, const char *id, uint32_t size, const void *body, uint32_t len) {
+	memcpy(tag->data + tag->len, id, 4);
+	put_synchsafe(tag->data + tag->len + 4, size);
+	tag->data[tag->len + 8] = 0;
+	tag->data[tag->len + 9] = 0;
+	memcpy(tag->data + tag->len + HEADER_LEN, body, len);
+	tag->len += HEADER_LEN + len;
+}
+
+/**
+ * Append frame with flags, its size is the length of the body
+ * @param tag			crafted tag
+ * @param id			four-char frame ID code
+ * @param flags			ID3 frame header flags
+ * @param body			frame body
+ * @param len			length of the frame body
+ */
+static void add_frame_flags(test_tag_t *tag, const char *id, uint16_t flags, const void *body, uint32_t len) {
+	unsigned char *header = tag->data + tag->len;
+
+	add_frame(tag, id, len, body, len);
+	header[8] = flags >> 8;
+	header[9] = flags & 0xFF;
+}
+
+/**
+ * Append padding
+ * @param tag			crafted tag
+ * @param len			length of the padding
+ */
+static void add_padding(test_tag_t *tag, uint32_t len) {
+	memset(tag->data + tag->len, 0, len);
+	tag->len += len;
+}
+
+/**
+ * Set size of the tag to its frames and CRC of the extended header to the frames
+ * @param tag			crafted tag
+ */
+static void end_tag(test_tag_t *tag) {
+	unsigned char *p = tag->data + tag->crc_offset;
+	uint32_t crc;
+
+	put_synchsafe(tag->data + 6, tag->len - HEADER_LEN);
+	if(tag->crc_offset) {
+		/* 32 bit CRC is stored as 35 bit synchsafe integer */
+		crc = crc32(0, tag->data + tag->frames_offset, tag->len - tag->frames_offset);
+		p[0] = (crc >> 28) & 0x0F;
+		put_synchsafe(p + 1, crc & 0x0FFFFFFF);
+	}
+}
+
+/**
+ * Parse the tag from a buffer of its exact length
+ * @param tag			crafted tag
+ * @param parsed		pointer to the parsed ID3 tag
+ * @return				result of parse_buffer()
+ */
+static int parse_tag(const test_tag_t *tag, id3v2_tag_t *parsed) {
+	unsigned char *buffer;
+	int result;
+
+	buffer = malloc(tag->len);
+	if(buffer == NULL) {
+		return -1;
+	}
+	memcpy(buffer, tag->data, tag->len);
+	init_id3v2_tag(parsed);
+	result = parse_buffer(parsed, buffer, tag->len);
+	free(buffer);
+	return result;
+}
+
+
+/**
+ * Get text of the text information frame
+ * @param parsed		parsed ID3 tag
+ * @param id			frame ID code
+ * @return				text or NULL if the frame is not parsed
+ */
+static const char *get_text(const id3v2_tag_t *parsed, const char *id) {
+	uint32_t i;
+
+	for(i = 0; i < TEXTINFO_COUNT; i++) {
+		if(strcmp(get_id3v2_text_id(i), id) == 0) {
+			return parsed->text[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Check text of the text information frame
+ * @param parsed		parsed ID3 tag
+ * @param id			frame ID code
+ * @param text			expected text
+ * @return				1 if the frame has the text, 0 otherwise
+ */
+static int has_text(const id3v2_tag_t *parsed, const char *id, const char *text) {
+	const char *value = get_text(parsed, id);
+
+	return value != NULL && strcmp(value, text) == 0;
+}
+
+
+/**
+ * Write data into a new temporary file
+ * @param name			buffer of TEST_TEMP_NAME size, filled in with the filename
+ * @param data			content of the file
+ * @param len			length of the content
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int write_temp_file(char *name, const void *data, size_t len) {
+	int fd;
+	int result;
+
+	strcpy(name, TEST_TEMP_NAME);
+	fd = mkstemp(name);
+	if(fd < 0) {
+		fprintf(stderr, "Error while creating temporary file!\n");
+		return 1;
+	}
+	result = write(fd, data, len) != (ssize_t) len;
+	close(fd);
+	return result;
+}
+
+/**
+ * Get a temporary filename for output of the library
+ * @param name			buffer of TEST_TEMP_NAME size, filled in with the filename
+ * @return				0 if OK, 1 if problem has occurred
+ */
+static int get_temp_name(char *name) {
+	if(write_temp_file(name, NULL, 0) != 0) {
+		return 1;
+	}
+	unlink(name);
+	return 0;
+}
+
+/**
+ * Parse the file with the tag
+ * @param name			filename
+ * @param parsed		pointer to the parsed ID3 tag
+ * @param p_len			pointer to the length of the file
+ * @param data			pointer to a copy of the file (caller frees it by free_id3v2_memory()), NULL if not needed
+ * @return				result of parse_buffer(), -1 if the file cannot be read
+ */
+static int parse_file(char *name, id3v2_tag_t *parsed, uint32_t *p_len, unsigned char **data) {
+	unsigned char *buffer;
+	int result;
+
+	init_id3v2_tag(parsed);
+	if(read_file(name, &buffer, p_len) != 0) {
+		return -1;
+	}
+	result = parse_buffer(parsed, buffer, *p_len);
+	if(data) {
+		*data = buffer;
+	}
+	else {
+		free_id3v2_memory(buffer);
+	}
+	return result;
+}
+
+
+/**
+ * Truncated frames are skipped and the frames before them are kept
+ * @return				0 if OK, 1 if the test failed
+ */
+static int test_truncated_frame(void) {
+	static const char *ids[] = {"TIT2", "USLT", "APIC"};
+	test_tag_t tag;
+	id3v2_tag_t parsed;
+	int failed = 0;
+	size_t i;
+
+	for(i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+		begin_tag(&tag);
+		add_frame(&tag, "TPE1", 7, "\x03" "Artist", 7);
+		/* Size 0x0FFFFF of the last frame points far behind the tag */
+		add_frame(&tag, ids[i], 0x0FFFFF, "\x03" "image/png\x00\x03x\x00", 14);
+		end_tag(&tag);
+
+		if(parse_tag(&tag, &parsed) != 0 || get_text(&parsed, "TPE1") == NULL || strcmp(get_text(&parsed, "TPE1"), "Artist") != 0) {
+			fprintf(stderr, "FAIL: tag with truncated %s frame is not parsed\n", ids[i]);
+			failed = 1;
+		}
+		deallocate_memory(&parsed, NULL);
+	}
+
+	return failed;
+}
+
+/**
+ * Fields without terminator end with their frame
+ * @return				0 if OK, 1 if the test failed
+ */
+static int test_unterminated_fields(void) {
+	test_tag_t tag;
+	id3v2_tag_t parsed;
+	int failed = 0;
+
+	begin_tag(&tag);
+	add_frame(&tag, "USLT", 9, "\x03" "eng" "descr", 9);
+	add_frame(&tag, "APIC", 10, "\x03" "image/png", 10);
+	end_tag(&tag);
+
+	if(parse_tag(&tag, &parsed) != 0 || parsed.lyrics.descr == NULL || strcmp(parsed.lyrics.descr, "descr") != 0) {
+		fprintf(stderr, "FAIL: unterminated USLT description is not parsed\n");
+		failed = 1;
+	}
+	deallocate_memory(&parsed, NULL);
+
+	return failed;
+}
+
+
+/**
+ * Edited tag fitting into the padding overwrites only the tag, larger one rewrites the file
+ * @return				0 if OK, 1 if the test failed
+ */
+static int test_edit_tag(void) {
+	static const char audio[] = "\xFF\xFB\x90\x00 audio frame";
+	char name[sizeof(TEST_TEMP_NAME)];
+	char long_text[600];
+	test_tag_t tag;
+	id3v2_tag_t parsed;
+	id3v2_edit_t edits[2];
+	unsigned char *data = NULL;
+	uint32_t len;
+	int failed = 0;
+
+	begin_tag(&tag);
+	add_frame(&tag, "TIT2", 4, "\x03" "Old", 4);
+	add_frame(&tag, "TPE1", 7, "\x03" "Artist", 7);
+	add_padding(&tag, 200);
+	end_tag(&tag);
+	memcpy(tag.data + tag.len, audio, sizeof(audio));
+	if(write_temp_file(name, tag.data, tag.len + sizeof(audio)) != 0) {
+		return 1;
+	}
+
+	/* New title and removed artist fit into the padding */
+	init_id3v2_tag(&parsed);
+	parse_id3v2_edit("TIT2=New title", &edits[0]);
+	parse_id3v2_edit("TPE1=", &edits[1]);
+	if(edit_id3v2_tag(name, edits, 2, DEFAULT_PADDING) != EDIT_IN_PLACE) {
+		fprintf(stderr, "FAIL: edit fitting into padding is not done in place\n");
+		failed = 1;
+	}
+	else if(parse_file(name, &parsed, &len, &data) != 0 || len != tag.len + sizeof(audio)
+			|| memcmp(data + tag.len, audio, sizeof(audio)) != 0
+			|| !has_text(&parsed, "TIT2", "New title") || get_text(&parsed, "TPE1") != NULL) {
+		fprintf(stderr, "FAIL: tag edited in place is not read back\n");
+		failed = 1;
+	}
+	deallocate_memory(&parsed, NULL);
+	free_id3v2_memory(data);
+
+	/* Text longer than the padding rewrites the file with new padding */
+	memset(long_text, 'x', sizeof(long_text) - 1);
+	long_text[sizeof(long_text) - 1] = '\0';
+	memcpy(long_text, "TALB=", 5);
+	parse_id3v2_edit(long_text, &edits[0]);
+	init_id3v2_tag(&parsed);
+	data = NULL;
+	if(edit_id3v2_tag(name, edits, 1, DEFAULT_PADDING) != EDIT_REWRITTEN) {
+		fprintf(stderr, "FAIL: edit larger than padding does not rewrite the file\n");
+		failed = 1;
+	}
+	else if(parse_file(name, &parsed, &len, &data) != 0 || len < sizeof(audio) + DEFAULT_PADDING
+			|| memcmp(data + len - sizeof(audio), audio, sizeof(audio)) != 0
+			|| !has_text(&parsed, "TIT2", "New title") || !has_text(&parsed, "TALB", long_text + 5)) {
+		fprintf(stderr, "FAIL: rewritten tag is not read back\n");
+		failed = 1;
+	}
+	deallocate_memory(&parsed, NULL);
+	free_id3v2_memory(data);
+	unlink(name);
+
+	/* Tag inside a WAV chunk is not edited */
+	if(write_temp_file(name, "RIFF\x04\x00\x00\x00WAVE", 12) != 0) {
+		return 1;
+	}
+	if(edit_id3v2_tag(name, edits, 1, DEFAULT_PADDING) != EDIT_FAILED) {
+		fprintf(stderr, "FAIL: WAV file is edited\n");
+		failed = 1;
+	}
+	unlink(name);
+
+	return failed;
+}
+
+/**
+ * Compressed frames are decompressed to the exact length of data length indicator
+ * @return				0 if OK, 1 if the test failed
+ */
+static int test_inflate_frame(void) {
+	static const char text[] = "\x03" "Compressed title Compressed title Compressed title";
+	unsigned char compressed[256];
+	unsigned char body[256];
+	unsigned char *data;
+	uLongf compressed_len = sizeof(compressed);
+	uint32_t len = sizeof(text) - 1;
+	uint32_t body_len;
+	uint32_t i;
+	test_tag_t tag;
+	id3v2_tag_t parsed;
+	int failed = 0;
+
+	if(compress(compressed, &compressed_len, (const unsigned char *) text, len) != Z_OK) {
+		return 1;
+	}
+
+	if(inflate_id3v2_frame(compressed, compressed_len, 0, len, &data) != 0 || memcmp(data, text, len) != 0) {
+		fprintf(stderr, "FAIL: compressed frame is not decompressed\n");
+		failed = 1;
+	}
+	free_id3v2_memory(data);
+
+	/* Data length indicator has to match the decompressed data exactly */
+	if(inflate_id3v2_frame(compressed, compressed_len, 0, len + 1, &data) == 0 || data != NULL
+			|| inflate_id3v2_frame(compressed, compressed_len, 0, len - 1, &data) == 0 || data != NULL
+			|| inflate_id3v2_frame(compressed, compressed_len, 0, MAX_INFLATE_LEN + 1, &data) == 0 || data != NULL) {
+		fprintf(stderr, "FAIL: wrong data length indicator is accepted\n");
+		failed = 1;
+	}
+
+	/* Frame body is data length indicator followed by unsynchronised compressed data */
+	put_synchsafe(body, len);
+	body_len = 4;
+	for(i = 0; i < compressed_len; i++) {
+		body[body_len++] = compressed[i];
+		if(compressed[i] == 0xFF) {
+			body[body_len++] = 0x00;
+		}
+	}
+	begin_tag(&tag);
+	add_frame_flags(&tag, "TIT2", FLAG_FR_COMP | FLAG_FR_UNSYNC | FLAG_FR_LEN, body, body_len);
+	end_tag(&tag);
+	if(parse_tag(&tag, &parsed) != 0 || !has_text(&parsed, "TIT2", text + 1)) {
+		fprintf(stderr, "FAIL: compressed and unsynchronised frame is not parsed\n");
+		failed = 1;
+	}
+	deallocate_memory(&parsed, NULL);
+
+	return failed;
+}
+
+/**
+ * Tags failing CRC or violating restrictions are rejected when the integrity check is enabled
+ * @return				0 if OK, 1 if the test failed
+ */
+static int test_integrity_check(void) {
+	test_tag_t tag;
+	id3v2_tag_t parsed;
+	int failed = 0;
+
+	set_integrity_check(1);
+
+	begin_tag(&tag);
+	add_extended_header(&tag, FLAG_EXT_CRC, 0);
+	add_frame(&tag, "TIT2", 6, "\x03" "Title", 6);
+	add_padding(&tag, 16);
+	end_tag(&tag);
+	if(parse_tag(&tag, &parsed) != 0 || !has_text(&parsed, "TIT2", "Title")) {
+		fprintf(stderr, "FAIL: tag with valid CRC is not parsed\n");
+		failed = 1;
+	}
+	deallocate_memory(&parsed, NULL);
+
+	/* Frame changed after CRC was computed */
+	tag.data[tag.len - 17] = 'E';
+	if(parse_tag(&tag, &parsed) == 0) {
+		fprintf(stderr, "FAIL: tag with wrong CRC is parsed\n");
+		failed = 1;
+	}
+	deallocate_memory(&parsed, NULL);
+
+	/* Text fields are restricted to 30 characters */
+	begin_tag(&tag);
+	add_extended_header(&tag, FLAG_EXT_RESTRICT, 3 << 3);
+	add_frame(&tag, "TIT2", 41, "\x03" "Title longer than thirty characters ...", 41);
+	end_tag(&tag);
+	if(parse_tag(&tag, &parsed) == 0) {
+		fprintf(stderr, "FAIL: tag violating its restrictions is parsed\n");
+		failed = 1;
+	}
+	deallocate_memory(&parsed, NULL);
+
+	set_integrity_check(0);
+	if(parse_tag(&tag, &parsed) != 0) {
+		fprintf(stderr, "FAIL: restrictions are checked without integrity check\n");
+		failed = 1;
+	}
+	deallocate_memory(&parsed, NULL);
+
+	return failed;
+}
+
+/**
+ * Columnar index is read back as it was built
+ * @return				0 if OK, 1 if the test failed
+ */
+static int test_column_index(void) {
+	static const char * const ids[] = {"TIT2", "TPE1", NULL};
+	static const char * const rows[][2] = {{"Song", "Band"}, {"Other song", NULL}, {"Song", "Band"}};
+	char name[sizeof(TEST_TEMP_NAME)];
+	char path[16];
+	id3v2_column_builder_t *builder;
+	id3v2_column_index_t index;
+	const id3v2_column_entry_t *title;
+	const id3v2_column_entry_t *artist;
+	uint32_t code;
+	uint64_t i;
+	int failed = 0;
+
+	builder = create_column_builder(ids);
+	if(builder == NULL || get_temp_name(name) != 0) {
+		free_column_builder(builder);
+		return 1;
+	}
+	for(i = 0; i < 3; i++) {
+		sprintf(path, "file%u.mp3", (unsigned) i);
+		if(add_column_row(builder, path, 1000 + i, i * 12, rows[i]) != 0) {
+			free_column_builder(builder);
+			return 1;
+		}
+	}
+	if(write_column_index(builder, name) != 0 || open_column_index(name, &index) != 0) {
+		fprintf(stderr, "FAIL: columnar index is not written or opened\n");
+		unlink(name);
+		return 1;
+	}
+
+	title = find_column(&index, "TIT2");
+	artist = find_column(&index, "TPE1");
+	if(index.header->rows != 3 || title == NULL || artist == NULL || find_column(&index, "TALB") != NULL
+			|| title->count != 2 || artist->count != 1) {
+		fprintf(stderr, "FAIL: columns of the index are not read back\n");
+		failed = 1;
+	}
+	else {
+		for(i = 0; i < 3; i++) {
+			sprintf(path, "file%u.mp3", (unsigned) i);
+			code = get_column_codes(&index, title)[i];
+			if(strcmp(get_column_path(&index, i), path) != 0 || get_column_size(&index, i) != 1000 + i
+					|| get_column_tag_offset(&index, i) != i * 12
+					|| code != find_column_code(&index, title, rows[i][0])
+					|| strcmp(get_column_value(&index, title, code), rows[i][0]) != 0) {
+				fprintf(stderr, "FAIL: row %u of the index is not read back\n", (unsigned) i);
+				failed = 1;
+			}
+		}
+		if(get_column_codes(&index, artist)[1] != COLUMN_CODE_NONE || find_column_code(&index, title, "Missing") != COLUMN_CODE_NONE) {
+			fprintf(stderr, "FAIL: missing values are found in the index\n");
+			failed = 1;
+		}
+	}
+	close_column_index(&index);
+
+	/* Truncated index is rejected */
+	if(truncate(name, sizeof(id3v2_column_index_header_t) + 8) != 0 || open_column_index(name, &index) == 0) {
+		fprintf(stderr, "FAIL: truncated columnar index is opened\n");
+		close_column_index(&index);
+		failed = 1;
+	}
+	unlink(name);
+
+	return failed;
+}
+
+/**
+ * Full-text index merged from segments finds documents of all words
+ * @return				0 if OK, 1 if the test failed
+ */
+static int test_search_index(void) {
+	static const char * const texts[] = {"Love song", "Another song", "Lovely day"};
+	static char *paths[] = {"a.mp3", "b.mp3", "c.mp3"};
+	char name[sizeof(TEST_TEMP_NAME)];
+	id3v2_search_segment_t *segments[2];
+	id3v2_search_index_t index;
+	test_tag_t tag;
+	id3v2_tag_t parsed;
+	uint8_t *matches;
+	uint32_t i;
+	int failed = 0;
+
+	segments[0] = create_search_segment();
+	segments[1] = create_search_segment();
+	if(segments[0] == NULL || segments[1] == NULL || get_temp_name(name) != 0) {
+		free_search_segment(segments[0]);
+		free_search_segment(segments[1]);
+		return 1;
+	}
+
+	/* Documents are split among the segments as among the threads */
+	for(i = 0; i < 3; i++) {
+		begin_tag(&tag);
+		add_frame(&tag, "TIT2", strlen(texts[i]) + 1, "\x03", 1);
+		memcpy(tag.data + tag.len, texts[i], strlen(texts[i]));
+		tag.len += strlen(texts[i]);
+		end_tag(&tag);
+		if(parse_tag(&tag, &parsed) != 0 || add_search_document(segments[i % 2], i, &parsed) != 0) {
+			failed = 1;
+		}
+		deallocate_memory(&parsed, NULL);
+	}
+	if(failed || write_search_index(segments, 2, paths, 3, name) != 0 || open_search_index(name, &index) != 0) {
+		fprintf(stderr, "FAIL: full-text index is not written or opened\n");
+		free_search_segment(segments[0]);
+		free_search_segment(segments[1]);
+		unlink(name);
+		return 1;
+	}
+	free_search_segment(segments[0]);
+	free_search_segment(segments[1]);
+
+	if(search_index(&index, "song", &matches) != 2 || matches[0] != 0x03) {
+		fprintf(stderr, "FAIL: word is not found in the full-text index\n");
+		failed = 1;
+	}
+	free(matches);
+	if(search_index(&index, "LOVE*", &matches) != 2 || matches[0] != 0x05) {
+		fprintf(stderr, "FAIL: prefix is not found in the full-text index\n");
+		failed = 1;
+	}
+	free(matches);
+	if(search_index(&index, "love song", &matches) != 1 || matches[0] != 0x01
+			|| strcmp(get_search_path(&index, 0), "a.mp3") != 0) {
+		fprintf(stderr, "FAIL: documents of all words are not found in the full-text index\n");
+		failed = 1;
+	}
+	free(matches);
+	if(search_index(&index, "missing", &matches) != 0 || matches[0] != 0) {
+		fprintf(stderr, "FAIL: missing word is found in the full-text index\n");
+		failed = 1;
+	}
+	free(matches);
+	close_search_index(&index);
+	unlink(name);
+
+	return failed;
+}
+
+/**
+ * Digests of the frames are numbered per ID and read back from the digest file
+ * @return				0 if OK, 1 if the test failed
+ */
+static int test_digest(void) {
+	static const uint32_t instances[] = {0, 0, 1, 1, 2};
+	test_tag_t tag;
+	id3v2_digest_t digest;
+	id3v2_digest_t read;
+	FILE *file;
+	char *path = NULL;
+	uint32_t i;
+	int failed = 0;
+
+	begin_tag(&tag);
+	add_frame(&tag, "TXXX", 4, "\x03" "a\x00", 4);
+	add_frame(&tag, "TIT2", 6, "\x03" "Title", 6);
+	add_frame(&tag, "TXXX", 4, "\x03" "b\x00", 4);
+	add_frame(&tag, "TIT2", 6, "\x03" "Other", 6);
+	add_frame(&tag, "TXXX", 4, "\x03" "c\x00", 4);
+	end_tag(&tag);
+
+	init_id3v2_digest(&digest);
+	init_id3v2_digest(&read);
+	if(digest_buffer(tag.data, tag.len, &digest) != 0 || digest.len != 5) {
+		fprintf(stderr, "FAIL: digest of the tag is not computed\n");
+		free_id3v2_digest(&digest);
+		return 1;
+	}
+	for(i = 0; i < 5; i++) {
+		if(digest.frames[i].instance != instances[i]) {
+			fprintf(stderr, "FAIL: frame %u of the digest has instance %u\n", i, digest.frames[i].instance);
+			failed = 1;
+		}
+	}
+
+	file = tmpfile();
+	if(file == NULL) {
+		free_id3v2_digest(&digest);
+		return 1;
+	}
+	if(write_id3v2_digest(file, "file.mp3", &digest) != 0) {
+		failed = 1;
+	}
+	fputs("00000000000000000000000000000000\t3000000000\tforged.mp3\n", file);
+	rewind(file);
+	if(read_id3v2_digest(file, &path, &read) != 0 || strcmp(path, "file.mp3") != 0
+			|| diff_id3v2_digest(&digest, &read, NULL, NULL) != 0 || memcmp(digest.hash, read.hash, DIGEST_LEN) != 0) {
+		fprintf(stderr, "FAIL: digest is not read back\n");
+		failed = 1;
+	}
+	free(path);
+	path = NULL;
+	if(read_id3v2_digest(file, &path, &read) != -1) {
+		fprintf(stderr, "FAIL: record with forged frame count is read\n");
+		failed = 1;
+	}
+	free(path);
+	fclose(file);
+
+	/* Changed text of the last TXXX frame is reported as one modified frame */
+	tag.data[tag.len - 3] = 'd';
+	if(digest_buffer(tag.data, tag.len, &read) != 0 || diff_id3v2_digest(&digest, &read, NULL, NULL) != 1) {
+		fprintf(stderr, "FAIL: modified frame is not found by the digest\n");
+		failed = 1;
+	}
+	free_id3v2_digest(&digest);
+	free_id3v2_digest(&read);
+
+	return failed;
+}
+
+
+int main(void) {
+	int failed = 0;
+
+	set_id3v2_verbosity(VERBOSITY_QUIET);
+	failed |= test_truncated_frame();
+	failed |= test_unterminated_fields();
+	failed |= test_edit_tag();
+	failed |= test_inflate_frame();
+	failed |= test_integrity_check();
+	failed |= test_column_index();
+	failed |= test_search_index();
+	failed |= test_digest();
+
+	if(failed == 0) {
+		printf("All parser tests passed\n");
+	}
+	return failed;
+}